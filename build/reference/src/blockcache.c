@@ -0,0 +1,195 @@
+#include "blockcache.h"
+
+#include <pthread.h>    // pthread_mutex_*
+#include <stdint.h>     // uint64_t
+#include <stdlib.h>     // calloc, malloc, free
+#include <string.h>     // memcmp, memcpy
+
+struct block {
+	uint64_t hash;
+
+	// The source, HTML and link targets, one after the other.
+	char *data;
+	size_t source_len;
+	size_t html_len;
+	size_t links_len;
+
+	// Next block in the same bucket.
+	struct block *chain;
+
+	// Blocks form a circular list, most recently used first.
+	struct block *prev, *next;
+};
+
+struct block_cache {
+	pthread_mutex_t lock;
+
+	struct block **buckets;
+	size_t bucket_count; // A power of two.
+	size_t count;
+
+	struct block list; // Sentinel.
+	size_t used;
+	size_t max_bytes;
+};
+
+static uint64_t hash_source(const char *source, size_t len) {
+	// FNV-1a.
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char)source[i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+// What a block costs against the limit.
+static size_t block_size(const struct block *block) {
+	return sizeof(*block) + sizeof(block) + block->source_len + block->html_len + block->links_len;
+}
+
+static void unlink_block(struct block *block) {
+	block->prev->next = block->next;
+	block->next->prev = block->prev;
+}
+
+static void push_front(struct block_cache *cache, struct block *block) {
+	block->prev = &cache->list;
+	block->next = cache->list.next;
+	cache->list.next->prev = block;
+	cache->list.next = block;
+}
+
+static struct block **find(struct block_cache *cache, uint64_t hash, const char *source, size_t source_len) {
+	struct block **it = &cache->buckets[hash & (cache->bucket_count - 1)];
+	while (*it != NULL) {
+		struct block *block = *it;
+		if (block->hash == hash && block->source_len == source_len && memcmp(block->data, source, source_len) == 0) {
+			break;
+		}
+		it = &block->chain;
+	}
+	return it;
+}
+
+static void evict(struct block_cache *cache, struct block *block) {
+	struct block **it = find(cache, block->hash, block->data, block->source_len);
+	*it = block->chain;
+	unlink_block(block);
+	cache->count -= 1;
+	cache->used -= block_size(block);
+	free(block->data);
+	free(block);
+}
+
+// Double the number of buckets. Does nothing if that fails, since longer
+// chains are merely slower.
+static void grow(struct block_cache *cache) {
+	size_t bucket_count = cache->bucket_count * 2;
+	struct block **buckets = calloc(bucket_count, sizeof(*buckets));
+	if (buckets == NULL) {
+		return;
+	}
+	for (size_t i = 0; i < cache->bucket_count; ++i) {
+		for (struct block *block = cache->buckets[i], *next; block != NULL; block = next) {
+			next = block->chain;
+			struct block **bucket = &buckets[block->hash & (bucket_count - 1)];
+			block->chain = *bucket;
+			*bucket = block;
+		}
+	}
+	free(cache->buckets);
+	cache->buckets = buckets;
+	cache->bucket_count = bucket_count;
+}
+
+struct block_cache *block_cache_create(size_t max_bytes) {
+	struct block_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		return NULL;
+	}
+	cache->bucket_count = 1024;
+	cache->buckets = calloc(cache->bucket_count, sizeof(*cache->buckets));
+	if (cache->buckets == NULL) {
+		free(cache);
+		return NULL;
+	}
+	pthread_mutex_init(&cache->lock, NULL);
+	cache->list.prev = cache->list.next = &cache->list;
+	cache->max_bytes = max_bytes;
+	return cache;
+}
+
+bool block_cache_get(struct block_cache *cache, const char *source, size_t source_len, FILE *out,
+                     void (*link)(const char *target, size_t target_len, void *arg), void *arg) {
+	uint64_t hash = hash_source(source, source_len);
+
+	pthread_mutex_lock(&cache->lock);
+	struct block *block = *find(cache, hash, source, source_len);
+	if (block != NULL) {
+		unlink_block(block);
+		push_front(cache, block);
+
+		const char *html = block->data + block->source_len;
+		fwrite(html, 1, block->html_len, out);
+		if (link != NULL) {
+			const char *links = html + block->html_len;
+			for (const char *target = links; target < links + block->links_len; target += strlen(target) + 1) {
+				link(target, strlen(target), arg);
+			}
+		}
+	}
+	pthread_mutex_unlock(&cache->lock);
+
+	return block != NULL;
+}
+
+void block_cache_put(struct block_cache *cache, const char *source, size_t source_len,
+                     const char *html, size_t html_len, const char *links, size_t links_len) {
+	struct block *block = calloc(1, sizeof(*block));
+	if (block == NULL) {
+		return;
+	}
+	block->hash = hash_source(source, source_len);
+	block->source_len = source_len;
+	block->html_len = html_len;
+	block->links_len = links_len;
+	if (block_size(block) > cache->max_bytes || (block->data = malloc(source_len + html_len + links_len)) == NULL) {
+		free(block);
+		return;
+	}
+	memcpy(block->data, source, source_len);
+	memcpy(block->data + source_len, html, html_len);
+	memcpy(block->data + source_len + html_len, links, links_len);
+
+	pthread_mutex_lock(&cache->lock);
+	struct block **slot = find(cache, block->hash, source, source_len);
+	if (*slot != NULL) {
+		// Another thread got here first.
+		pthread_mutex_unlock(&cache->lock);
+		free(block->data);
+		free(block);
+		return;
+	}
+	while (cache->used + block_size(block) > cache->max_bytes) {
+		evict(cache, cache->list.prev);
+	}
+	if (cache->count >= cache->bucket_count) {
+		grow(cache);
+	}
+	slot = &cache->buckets[block->hash & (cache->bucket_count - 1)];
+	block->chain = *slot;
+	*slot = block;
+	push_front(cache, block);
+	cache->count += 1;
+	cache->used += block_size(block);
+	pthread_mutex_unlock(&cache->lock);
+}
+
+void block_cache_destroy(struct block_cache *cache) {
+	while (cache->list.next != &cache->list) {
+		evict(cache, cache->list.next);
+	}
+	pthread_mutex_destroy(&cache->lock);
+	free(cache->buckets);
+	free(cache);
+}
@@ -0,0 +1,42 @@
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+//
+// This module defines a cache of rendered blocks, so blocks which are the same
+// in successive revisions of a page are only rendered once. See
+// render_creole_ext().
+//
+// Blocks are keyed by a hash of their source, and the source is kept to rule
+// out collisions. When the cache grows beyond its size limit, the least
+// recently used blocks are evicted.
+//
+// The cache is thread-safe.
+//
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdio.h>   // FILE
+
+struct block_cache;
+
+// Create a cache holding at most `max_bytes` bytes, including bookkeeping.
+// Returns NULL on failure to allocate.
+struct block_cache *block_cache_create(size_t max_bytes);
+
+// Look up the block rendered from `source`. If it is found, its HTML is written
+// to `out`, `link` is called with the target of every link in it (unless
+// `link` is NULL) and true is returned. `link` is called with the cache
+// locked, so it must not use the cache.
+bool block_cache_get(struct block_cache *cache, const char *source, size_t source_len, FILE *out,
+                     void (*link)(const char *target, size_t target_len, void *arg), void *arg);
+
+// Remember that `source` renders to `html`. `links` holds the targets of the
+// links in the block, each terminated by a NUL byte. All of them are copied.
+// Blocks which don't fit, or can't be allocated, are silently not cached.
+void block_cache_put(struct block_cache *cache, const char *source, size_t source_len,
+                     const char *html, size_t html_len, const char *links, size_t links_len);
+
+// Free the cache and all of its blocks.
+void block_cache_destroy(struct block_cache *cache);
+
+#endif
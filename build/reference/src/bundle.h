@@ -0,0 +1,93 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+//
+// This module defines the bundle format, which stores the rendered output of
+// many commits in a single file instead of one file per page and commit.
+//
+// A bundle looks like this:
+//
+//     +--------+-----------------+-------+---------+---------+
+//     | header | content ...     | index | strings | trailer |
+//     +--------+-----------------+-------+---------+---------+
+//
+// Content is stored once per distinct output, no matter how many commits
+// contain it. The index is an array of fixed-size records sorted by path,
+// where a path is "<commit sha>/<path in tree>", so a page is found with a
+// binary search. The trailer at the very end of the file tells where the
+// index is. All integers are little-endian.
+//
+// Bundles are append-only. Adding to a bundle appends new content followed
+// by a complete new index and trailer, so bytes that have already been
+// written never change, and a reader which has mapped the file keeps seeing
+// a consistent (if old) snapshot.
+//
+
+#include <git2.h>    // git_oid
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+#define BUNDLE_MAGIC "SWBNDL01"
+
+// Where a page's content lives in the bundle, and where it came from.
+struct bundle_entry {
+	uint64_t offset;
+	uint64_t length;
+
+	// The blob the content was produced from, and how. Used for
+	// deduplication and ETags.
+	git_oid blob;
+	unsigned kind;
+};
+
+struct bundle;
+struct bundle_reader;
+
+// Open the bundle at `path` for appending, creating it if needed.
+// Panics on failure.
+struct bundle *bundle_open(const char *path);
+
+// Look up content produced from `blob` in the given way by this or an earlier
+// run. Returns false if there is none.
+bool bundle_find_content(const struct bundle *b, const git_oid *blob, unsigned kind, struct bundle_entry *entry);
+
+// Append content. `entry` is filled in with its location.
+// Panics on failure.
+void bundle_append(struct bundle *b, const git_oid *blob, unsigned kind, const void *data, size_t len, struct bundle_entry *entry);
+
+// Make `path` ("<commit sha>/<path in tree>") refer to `entry`.
+void bundle_add(struct bundle *b, const char *path, const struct bundle_entry *entry);
+
+// Record `commit` as the one served as "latest".
+void bundle_set_latest(struct bundle *b, const git_oid *commit);
+
+// Write an index and trailer covering everything added so far, making it
+// visible to readers which open the bundle afterwards. More content can be
+// added afterwards. Panics on failure.
+void bundle_flush(struct bundle *b);
+
+// Flush the bundle if anything was added since the last flush, and close it.
+// Panics on failure.
+void bundle_close(struct bundle *b);
+
+// Map the bundle at `path` for reading.
+// Panics on failure.
+struct bundle_reader *bundle_reader_open(const char *path);
+
+// Look up `path`. Returns false if it is not in the bundle.
+bool bundle_reader_find(const struct bundle_reader *r, const char *path, size_t path_len, struct bundle_entry *entry);
+
+// Returns the commit recorded as "latest", or NULL if there is none.
+const git_oid *bundle_reader_latest(const struct bundle_reader *r);
+
+// Returns a pointer to the mapped contents of `entry`.
+const char *bundle_reader_data(const struct bundle_reader *r, const struct bundle_entry *entry);
+
+// Returns a file descriptor for the bundle, e.g. for sendfile(2).
+int bundle_reader_fd(const struct bundle_reader *r);
+
+// Unmap and close the bundle.
+void bundle_reader_close(struct bundle_reader *r);
+
+#endif
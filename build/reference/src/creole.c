@@ -0,0 +1,1132 @@
+#include "creole.h"
+
+#include "blockcache.h"
+#include <assert.h>
+#include <ctype.h>
+#include <pthread.h>
+#include <regex.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define LENGTH(x)  (sizeof(x)/sizeof((x)[0]))
+
+#define DEBUG(...) (fprintf(stderr, __VA_ARGS__), fflush(stderr))
+
+// Smaller blocks are quicker to render than to look up.
+#define MIN_CACHED_BLOCK 64
+
+// The options of the render in progress on this thread. Several threads may
+// render at once.
+static _Thread_local const struct creole_options *options;
+
+// Where the targets of links are collected while a block is rendered for the
+// block cache, if it is.
+static _Thread_local FILE *block_links;
+
+// Nested markup (the text of a paragraph, a link, and so on) isn't rendered by
+// recursion. Instead, parsers push tasks for it onto a stack, which process()
+// works through in a loop. Each parser pushes a few tasks at most, so the
+// stack of the thread stays flat no matter how deeply markup is nested.
+enum task_kind {
+	TASK_TEXT,    // Write `begin`, a string.
+	TASK_ESCAPED, // Write [begin, end) escaped.
+	TASK_RANGE,   // Render [begin, end).
+	TASK_LIST,    // Render the list items starting at `begin`. See do_list().
+};
+
+struct task {
+	enum task_kind kind;
+	const char *begin, *end;
+
+	// For TASK_RANGE, whether `begin` starts a block.
+	bool new_block;
+
+	// For TASK_LIST, the marker of the list and how deep the current item
+	// is nested, and whether there are items left.
+	char marker;
+	unsigned level;
+	bool more_items;
+};
+
+// The tasks of the render in progress on this thread.
+static _Thread_local struct {
+	struct task *items;
+	size_t count;
+	size_t capacity;
+
+	// Number of TASK_RANGE tasks on the stack, i.e. how deeply markup is
+	// nested right now.
+	unsigned depth;
+} tasks;
+
+void process(const char *begin, const char *end, bool new_block, FILE *out);
+long do_headers(const char *begin, const char *end, bool new_block, FILE *out);
+long do_paragraph(const char *begin, const char *end, bool new_block, FILE *out);
+long do_replacements(const char *begin, const char *end, bool new_block, FILE *out);
+long do_link(const char *begin, const char *end, bool new_block, FILE *out);
+long do_raw_url(const char *begin, const char *end, bool new_block, FILE *out);
+long do_emphasis(const char *begin, const char *end, bool new_block, FILE *out);
+long do_bold(const char *begin, const char *end, bool new_block, FILE *out);
+long do_nowiki_inline(const char *begin, const char *end, bool new_block, FILE *out);
+long do_nowiki_block(const char *begin, const char *end, bool new_block, FILE *out);
+long do_list(const char *begin, const char *end, bool new_block, FILE *out);
+long do_horizontal_rule(const char *begin, const char *end, bool new_block, FILE *out);
+
+// Prints string with special HTML characters escaped.
+//
+// Unlike many other functions, this function does not assume that (end >=
+// begin). This simplifies some logic in callers since bracket-matching is prone
+// to off-by-one errors when the brackets are empty.
+void hprint(FILE *out, const char *begin, const char *end) {
+	for (const char *p = begin; p < end; p++) {
+		if (*p == '&') {
+			fputs("&amp;", out);
+		} else if (*p == '"') {
+			fputs("&quot;", out);
+		} else if (*p == '>') {
+			fputs("&gt;", out);
+		} else if (*p == '<') {
+			fputs("&lt;", out);
+		} else {
+			fputc(*p, out);
+		}
+	}
+}
+
+bool starts_with(const char *haystack_begin, const char *haystack_end, const char *needle) {
+	size_t needle_len = strlen(needle);
+	size_t haystack_len = haystack_end - haystack_begin;
+	if (needle_len > haystack_len) {
+		return false;
+	} else {
+		return memcmp(haystack_begin, needle, needle_len) == 0;
+	}
+}
+
+const char *find_char(const char *haystack_begin, const char *haystack_end, char needle) {
+	for (const char *p = haystack_begin; p < haystack_end; ++p) {
+		if (*p == needle) {
+			return p;
+		}
+	}
+
+	return haystack_end;
+}
+
+bool contains_only_spaces(const char *begin, const char *end) {
+	assert(begin <= end);
+
+	for (const char *p = begin; p < end; ++p) {
+		if (!isspace(*p)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Make sure `n` more tasks can be pushed without allocating.
+static void reserve_tasks(size_t n) {
+	if (tasks.count + n <= tasks.capacity) {
+		return;
+	}
+	size_t capacity = (tasks.capacity == 0) ? 64 : tasks.capacity * 2;
+	while (capacity < tasks.count + n) {
+		capacity *= 2;
+	}
+	struct task *items = realloc(tasks.items, capacity * sizeof(*items));
+	if (items == NULL) {
+		// There is no way to render the rest of the page correctly.
+		fputs("creole: failed to allocate render stack\n", stderr);
+		abort();
+	}
+	tasks.items = items;
+	tasks.capacity = capacity;
+}
+
+static void push_task(struct task task) {
+	reserve_tasks(1);
+	tasks.items[tasks.count++] = task;
+	if (task.kind == TASK_RANGE) {
+		tasks.depth += 1;
+	}
+}
+
+static void pop_task(void) {
+	assert(tasks.count > 0);
+	if (tasks.items[--tasks.count].kind == TASK_RANGE) {
+		tasks.depth -= 1;
+	}
+}
+
+// Free the stack once rendering on this thread is done.
+static void free_tasks(void) {
+	assert(tasks.count == 0);
+	free(tasks.items);
+	tasks.items = NULL;
+	tasks.capacity = 0;
+}
+
+// Render [begin, end) as the content of an element, then write `closing`.
+// Past the nesting limit the content is written as plain text instead.
+//
+// Parsers call this after writing their opening tag and must not write
+// anything after it, since the content is only rendered once the parser has
+// returned.
+static void process_nested(const char *begin, const char *end, const char *closing) {
+	unsigned max_depth = (options != NULL && options->max_depth > 0) ? options->max_depth : CREOLE_MAX_DEPTH;
+	reserve_tasks(2);
+	push_task((struct task){ .kind = TASK_TEXT, .begin = closing });
+	if (tasks.depth < max_depth) {
+		push_task((struct task){ .kind = TASK_RANGE, .begin = begin, .end = end, .new_block = false });
+	} else {
+		push_task((struct task){ .kind = TASK_ESCAPED, .begin = begin, .end = end });
+	}
+}
+
+// The closing delimiters searched for by find_closing().
+enum closing {
+	CLOSE_LINK,
+	CLOSE_EMPHASIS,
+	CLOSE_BOLD,
+	CLOSE_NOWIKI_INLINE,
+	CLOSE_NOWIKI_BLOCK,
+	CLOSE_COUNT,
+};
+
+// A search which is known to fail when started anywhere in [from, limit) of a
+// range ending at or before `end`.
+struct miss {
+	const char *from, *limit, *end;
+};
+
+// Where each closing delimiter is known to be missing. Without this, a
+// paragraph full of unclosed "[[" would be searched to its end once for every
+// one of them.
+static _Thread_local struct miss unclosed[CLOSE_COUNT];
+
+// Likewise for the scheme of a raw URL. See do_raw_url().
+static _Thread_local struct miss not_url;
+
+static bool known_miss(const struct miss *miss, const char *from, const char *end) {
+	return miss->from <= from && from < miss->limit && end <= miss->end;
+}
+
+// Only one miss is kept per search, so a search in a short nested range must
+// not replace what is known about the enclosing one.
+static void remember_miss(struct miss *miss, const char *from, const char *limit, const char *end) {
+	if (limit >= miss->limit) {
+		*miss = (struct miss){ .from = from, .limit = limit, .end = end };
+	}
+}
+
+// Forget what is known about the previous document.
+static void reset_searches(void) {
+	memset(unclosed, 0, sizeof(unclosed));
+	memset(&not_url, 0, sizeof(not_url));
+}
+
+// Find the first `delim` in [from, end) which isn't preceded by one of the
+// characters in `escapes`. Returns NULL if there is none.
+static const char *find_closing(enum closing kind, const char *from, const char *end, const char *delim, const char *escapes) {
+	if (known_miss(&unclosed[kind], from, end)) {
+		return NULL;
+	}
+
+	const char *stop;
+	for (const char *p = from; p < end && (stop = strnstr(p, delim, end - p)) != NULL; p = stop + 1) {
+		if (stop[-1] == '\0' || strchr(escapes, stop[-1]) == NULL) {
+			return stop;
+		}
+	}
+
+	// Like strnstr(), the search stops at a NUL byte, so that is as far as
+	// we know the delimiter is missing.
+	if (from < end) {
+		const char *nul = memchr(from, '\0', end - from);
+		remember_miss(&unclosed[kind], from, (nul != NULL) ? nul : end, end);
+	}
+	return NULL;
+}
+
+// A parser takes a (sub)string and returns the number of characters consumed, if any.
+//
+// The parameter `new_block` determines whether `begin` points to the beginning of a new block.
+// The sign of the return value determines whether a new block should begin, after the consumed text.
+typedef long (* parser_t)(const char *begin, const char *end, bool new_block, FILE *out);
+
+static parser_t parsers[] = {
+	// Block-level elements
+	do_headers,
+	do_nowiki_block,
+	do_list,
+	do_horizontal_rule,
+	do_paragraph, // <p> should be last as it eats anything
+
+	// Inline-level elements
+	do_emphasis,
+	do_bold,
+	do_link,
+	do_raw_url,
+	do_nowiki_inline,
+	do_replacements,
+
+};
+
+long do_headers(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!new_block) { // Headers are block-level elements.
+		return 0;
+	}
+
+	if (*begin != '=') {
+		return 0;
+	}
+
+	unsigned level = 0;
+	const char *start = begin;
+	while (start < end && *start == '=') {
+		level += 1;
+		start += 1;
+	}
+	if (level > 6) {
+		return 0;
+	}
+
+	while (start < end && isspace(*start)) {
+		start += 1;
+	}
+
+	const char *eol = start;
+	while (eol != end && *eol != '\n') {
+		eol += 1;
+	}
+
+	const char *stop = eol;
+	assert(stop > begin);
+	while (stop > start && (stop[-1] == '=' || isspace(stop[-1]))) {
+		stop -= 1;
+	}
+
+	static const char *closing[] = { NULL, "</h1>", "</h2>", "</h3>", "</h4>", "</h5>", "</h6>" };
+	fprintf(out, "<h%u>", level);
+	process_nested(start, stop, closing[level]);
+
+	return -(eol - begin);
+}
+
+long do_paragraph(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!new_block) { // Paragraphs are block-level elements.
+		return 0;
+	}
+
+	const char *stop = begin + 1;
+	while (stop + 1 < end) {
+		if (stop[0] == '\n' && stop[1] == '\n') {
+			goto found_double_newline;
+		} else {
+			stop += 1;
+		}
+	}
+	stop = end;
+found_double_newline:
+
+	fputs("<p>", out);
+	process_nested(begin, stop, "</p>");
+
+	return -(stop - begin);
+}
+
+static struct {
+	const char *from, *to;
+} replacements[] = {
+	// Escaped special characters
+	{"~[[", "[["},
+	{"~]]", "]]"}, // NOTE: This pattern is duplicated in do_link().
+	{"~//", "//"},
+	{"~**", "**"},
+	{"~{{{", "{{{"},
+	// Characters that have special meaning in HTML
+	// NOTE: These rules are duplicated in hprint().
+	{"<", "&lt;"},
+	{">", "&gt;"},
+	{"\"", "&quot;"},
+	{"&", "&amp;"},
+};
+
+long do_replacements(const char *begin, const char *end, bool new_block, FILE *out)
+{
+	for (unsigned i = 0; i < LENGTH(replacements); ++i) {
+		size_t length = strlen(replacements[i].from);
+		if ((size_t)(end - begin) < length) {
+			continue;
+		}
+		if (strncmp(replacements[i].from, begin, length) == 0) {
+			fputs(replacements[i].to, out);
+			return length;
+		}
+	}
+
+	return 0;
+}
+
+long do_link(const char *begin, const char *end, bool new_block, FILE *out)
+{
+	// Links start with "[[".
+	if (!starts_with(begin, end, "[[")) {
+		return 0;
+	}
+	const char *start = begin + 2;
+
+	// Find the matching, unescaped "]]".
+	const char *stop = find_closing(CLOSE_LINK, start, end, "]]", "~");
+	if (stop == NULL) {
+		return 0;
+	}
+
+	// FIXME: How do we handle WikiWord style links? Should we just append ".html" if is_wikiword()?
+
+	const char *pipe = strnstr(start, "|", stop - start);
+	const char *target_stop = (pipe != NULL) ? pipe : stop;
+	if (options != NULL && options->link != NULL) {
+		options->link(start, target_stop - start, options->arg);
+	}
+	if (block_links != NULL) {
+		fwrite(start, 1, target_stop - start, block_links);
+		fputc('\0', block_links);
+	}
+	if (pipe != NULL) {
+		const char *link_address_start = start;
+		const char *link_address_stop = pipe;
+		fprintf(out, "<a href=\"");
+		hprint(out, link_address_start, link_address_stop);
+		fprintf(out, "\">");
+
+		const char *link_text_start = pipe + 1;
+		const char *link_text_stop = stop;
+		process_nested(link_text_start, link_text_stop, "</a>");
+	} else {
+		fprintf(out, "<a href=\"");
+		hprint(out, start, stop);
+		fprintf(out, "\">");
+		hprint(out, start, stop); // Don't parse markup when we know it's a link.
+		fprintf(out, "</a>");
+	}
+
+	return stop - start + 4 /* [[]] */;
+}
+
+long do_raw_url(const char *begin, const char *end, bool new_block, FILE *out)
+{
+	const char *p = begin;
+
+	// This piece of spaghetti is necessary to handle escaped urls.
+	// These should not actually be turned into anchor tags.
+	// See: <http://www.wikicreole.org/wiki/Creole1.0#section-Creole1.0-EscapeCharacter>
+	bool escaped = false;
+	if (*begin == '~') {
+		escaped = true;
+		p += 1;
+	}
+
+	// Eat a scheme followed by a ":". Here are the relevant rules from RFC 3986.
+	// - URI = scheme ":" hier-part [ "?" query ] [ "#" fragment ]
+	// - scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
+	// See: <https://www.rfc-editor.org/rfc/rfc3986#section-3.1>
+	if (p >= end || !isalpha(*p)) {
+		return 0;
+	}
+	if (known_miss(&not_url, p, end)) {
+		return 0;
+	}
+	const char *scheme = p;
+	while (p < end && (isalnum(*p) || *p == '+' || *p == '-' || *p == '.')) {
+		p += 1;
+	}
+	if (p >= end || p[0] != ':') {
+		goto not_a_url;
+	}
+	p += 1;
+
+        // Eat the remainder of the URI, purely going by what "legal" URI
+        // characters it contains.
+	// See: <https://stackoverflow.com/a/7109208>
+        const char *q = p;
+	while (q < end) {
+		switch (*q) {
+			case '0' ... '9':
+			case 'a' ... 'z':
+			case 'A' ... 'Z':
+			case '-': case '.': case '_': case '~':
+			case ':': case '/': case '?': case '#':
+			case '[': case ']': case '@': case '!':
+			case '$': case '&': case '\'': case '(':
+			case ')': case '*': case '+': case ',':
+			case ';': case '%': case '=':
+				q += 1;
+				break;
+			default:
+				goto end_url;
+		}
+	}
+end_url:
+
+        // If there is nothing following the colon, don't accept it as a raw
+        // url. Otherwise we'd incorrectly find a link with the "said" protocol
+        // here: "And he said: blah blah".
+        if (q == p) {
+		goto not_a_url;
+	}
+
+        // Special case: If we end on a ".", assume it's a full stop at the end
+        // of a sentence. Here's an example:
+	// My favorite webside is https://cohost.org/.
+        if (q[-1] == '.') {
+		q -= 1;
+	}
+
+	if (escaped) {
+		hprint(out, begin + 1 /* ~ */, q);
+	} else {
+		fputs("<a href=\"", out);
+		hprint(out, begin, q);
+		fputs("\">", out);
+		hprint(out, begin, q);
+		fputs("</a>", out);
+	}
+
+	return q - begin;
+
+not_a_url:
+	// Every scheme starting later in the same run ends at the same place, so
+	// if this isn't a URL, neither are they.
+	remember_miss(&not_url, scheme, p, end);
+	return 0;
+}
+
+long do_emphasis(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!starts_with(begin, end, "//")) {
+		return 0;
+	}
+	const char *start = begin + 2; /* // */
+
+	const char *stop = find_closing(CLOSE_EMPHASIS, start + 1, end, "//", "~:");
+	if (stop == NULL) {
+		return 0;
+	}
+
+	fputs("<em>", out);
+	process_nested(start, stop, "</em>");
+
+	return stop - start + 4; /* //...// */
+}
+
+// FIXME: This is //almost// just a copy/paste of do_emphasis. Not very DRY...
+//        The one difficult part is that : should only be treated as an escape character for //.
+long do_bold(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!starts_with(begin, end, "**")) {
+		return 0;
+	}
+	const char *start = begin + 2; /* // */
+
+	const char *stop = find_closing(CLOSE_BOLD, start + 1, end, "**", "~");
+	if (stop == NULL) {
+		return 0;
+	}
+
+	fputs("<strong>", out);
+	process_nested(start, stop, "</strong>");
+
+	return stop - start + 4; /* **...** */
+}
+
+// The inline-level nowiki element.
+// This is specified together with the block-level nowiki element in the spec, but for this parser it makes more sense to treat them as separate.
+// See: <http://www.wikicreole.org/wiki/Creole1.0#section-Creole1.0-NowikiPreformatted>
+long do_nowiki_inline(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!starts_with(begin, end, "{{{")) {
+		return 0;
+	}
+	const char *start = begin + 3;
+
+	const char *stop = find_closing(CLOSE_NOWIKI_INLINE, start, end, "}}}", "");
+	if (stop == NULL) {
+		return 0;
+	}
+
+	// Include trailing closing braces in the span.
+	while (stop + 3 < end && stop[3] == '}') {
+		stop += 1;
+	}
+
+	const char *trim_start = start;
+	while (isspace(*trim_start)) {
+		trim_start += 1;
+	}
+	const char *trim_stop = stop;
+	while (isspace(trim_stop[-1]) && trim_start <= trim_stop - 1) {
+		trim_stop -= 1;
+	}
+
+	fputs("<tt>", out);
+	hprint(out, trim_start, trim_stop);
+	fputs("</tt>", out);
+
+	return 3 + (stop - start) + 3; /* {{{...}}} */
+}
+
+long do_nowiki_block(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!(new_block && starts_with(begin, end, "{{{\n"))) {
+		return 0;
+	}
+	const char *start = begin + 4;
+
+	const char *stop = find_closing(CLOSE_NOWIKI_BLOCK, start - 1, end, "\n}}}", "");
+	if (stop == NULL) {
+		return 0;
+	}
+
+	fputs("<pre><code>", out);
+	hprint(out, start, stop);
+	fputs("</code></pre>", out);
+
+	return -(stop - start + 8);
+}
+
+// Find the end of the list item whose text starts at `item_begin`. Sets
+// `more_items` if another item follows.
+static const char *find_item_end(const char *item_begin, const char *end, char marker, bool *more_items) {
+	// This part essentailly emulates the regular expression /\n\n|\n[ \t]*\*|$/.
+	const char *item_end = item_begin;
+	while (true) {
+		if (starts_with(item_end, end, "\n\n")) {
+			*more_items = false;
+			break;
+		} else if (item_end == end) {
+			*more_items = false;
+			break;
+		} else if (item_end < end && *item_end == '\n') {
+			const char *q = item_end + 1;
+			while (q < end && (*q == ' ' || *q == '\t'))
+				q += 1;
+
+			if (q < end && *q == marker) {
+				// Include the final newline in the output; will be eaten by special case in process().
+				item_end = q;
+				break;
+			}
+		}
+
+		item_end++;
+	}
+	return item_end;
+}
+
+// Skip the markers at the start of a list item, returning its level.
+static unsigned skip_markers(const char **item_begin, const char *end, char marker) {
+	unsigned level = 0;
+	while (**item_begin == marker && *item_begin + 1 < end) {
+		*item_begin += 1;
+		level++;
+	}
+	return level;
+}
+
+// Render the next item of the list `task`, or close the list if there are no
+// items left. Called by process() for TASK_LIST; the task stays on the stack
+// until the list is closed.
+static void list_step(size_t index, FILE *out) {
+	struct task *task = &tasks.items[index];
+	char marker = task->marker;
+	if (!task->more_items) {
+		while (task->level > 0) {
+			fputs((marker == '*') ? "</ul>" : "</ol>", out);
+			task->level -= 1;
+		}
+		pop_task();
+		return;
+	}
+
+	// At this point in the code, item_begin should point to the
+	// first star that marks the start of a new list item. We will start by reading the depth.
+	const char *item_begin = task->begin;
+	unsigned level = skip_markers(&item_begin, task->end, marker);
+	if (level > task->level) {
+		while (level > task->level) {
+			fputs((marker == '*') ? "<ul>" : "<ol>", out);
+			task->level += 1;
+		}
+	} else if (level < task->level){
+		while (level < task->level) {
+			fputs((marker == '*') ? "</ul>" : "</ol>", out);
+			task->level -= 1;
+		}
+	}
+
+	const char *item_end = find_item_end(item_begin, task->end, marker, &task->more_items);
+	task->begin = item_end;
+
+	// Note how we don't close the <li> tag! We can avoid some
+	// tricky logic by using the fact that <li> is a self-closing tag.
+	//
+	// See: https://html.spec.whatwg.org/#syntax-tag-omission
+	// See: https://html.spec.whatwg.org/#the-li-element
+	fputs("<li>", out);
+	process_nested(item_begin, item_end, "");
+}
+
+// TODO: We still do not handle mixing ol/ul in nested lists.
+//       See: http://www.wikicreole.org/wiki/Lists#section-Lists-Mixing
+long do_list(const char *begin, const char *end, bool new_block, FILE *out) {
+	// FIXME: Some sample documents allow a list to start without begin
+	// separated form the above text by \n\n. In order to allow that, we
+	// would need to know if the current * is at the start of a line.
+	if (!new_block) {
+		return 0;
+	}
+
+	const char *begin_stripped = begin;
+	while (begin_stripped < end && (*begin_stripped == ' ' || *begin_stripped == '\t')) {
+		begin_stripped++;
+	}
+
+	char marker;
+	if (starts_with(begin_stripped, end, "* ")) {
+		fputs("<ul>", out);
+		marker = '*';
+	} else if (starts_with(begin_stripped, end, "# ")) {
+		fputs("<ol>", out);
+		marker = '#';
+	} else {
+		return 0;
+	}
+
+	// Find where the list ends. The items are rendered one at a time by
+	// list_step().
+	bool more_items = true;
+	const char *item_end = begin_stripped;
+	while (more_items) {
+		const char *item_begin = item_end;
+		skip_markers(&item_begin, end, marker);
+		item_end = find_item_end(item_begin, end, marker, &more_items);
+	}
+	push_task((struct task){
+		.kind = TASK_LIST,
+		.begin = begin_stripped,
+		.end = end,
+		.marker = marker,
+		.level = 1,
+		.more_items = true,
+	});
+
+	return -(item_end - begin);
+}
+
+long do_horizontal_rule(const char *begin, const char *end, bool new_block, FILE *out) {
+	if (!new_block) {
+		return 0;
+	}
+
+	unsigned length = 0;
+	const char *q = begin;
+	while (q < end && *q == '-') {
+		q++;
+	}
+
+	// Anything at least 4 hyphens long is a horizontal rule.
+	// See: http://www.wikicreole.org/wiki/HorizontalRuleReasoning
+	if (length >= 4) {
+		fputs("<hr>", out);
+	}
+
+	return length;
+}
+
+// Parse the element at `p`, updating `new_block` for the next one. Returns
+// where the next element starts, or NULL if there is nothing left to render.
+// Whatever is nested in the element is left on the task stack.
+static const char *parse_element(const char *p, const char *end, bool *new_block, FILE *out) {
+	// Eat all newlines if we're starting a block.
+	if (*new_block) {
+		while (*p == '\n') {
+			p += 1;
+			if (p == end) {
+				return NULL;
+			}
+		}
+	}
+
+	// Greedily try all parsers.
+	long affected;
+	for (unsigned i = 0; i < LENGTH(parsers); ++i) {
+		affected = parsers[i](p, end, *new_block, out);
+		if (affected) {
+			break;
+		}
+	}
+	if (affected) {
+		p += labs(affected);
+	} else {
+		fputc(*p, out);
+		p += 1;
+	}
+
+	if (p + 1 == end) {
+		// Don't print single newline at end.
+		if (*p == '\n') {
+			return NULL;
+		}
+	} else {
+		// Determine whether we've reached a new block.
+		if (p + 1 < end && p[0] == '\n' && p[1] == '\n') {
+			// Double newline characters separate blocks;
+			// if we've found them, we're starting a new block
+			*new_block = true;
+		} else {
+			// ...otherwise the parser gets to decide.
+			*new_block = affected < 0;
+		}
+	}
+	return p;
+}
+
+// Work through the task stack until only the bottom `base` tasks are left.
+static void run_tasks(size_t base, FILE *out) {
+	while (tasks.count > base) {
+		size_t top = tasks.count - 1;
+		struct task task = tasks.items[top];
+		switch (task.kind) {
+			case TASK_TEXT: {
+				fputs(task.begin, out);
+				pop_task();
+			} break;
+			case TASK_ESCAPED: {
+				hprint(out, task.begin, task.end);
+				pop_task();
+			} break;
+			case TASK_RANGE: {
+				if (task.begin == NULL || task.begin >= task.end) {
+					pop_task();
+					break;
+				}
+				// Parsing may push more tasks, which are run before
+				// the rest of the range.
+				const char *p = parse_element(task.begin, task.end, &task.new_block, out);
+				tasks.items[top].begin = p;
+				tasks.items[top].new_block = task.new_block;
+			} break;
+			case TASK_LIST: {
+				list_step(top, out);
+			} break;
+		}
+	}
+}
+
+// Render the element at `p`, updating `new_block` for the next one. Returns
+// where the next element starts, or NULL if there is nothing left to render.
+const char *process_element(const char *p, const char *end, bool *new_block, FILE *out) {
+	size_t base = tasks.count;
+	p = parse_element(p, end, new_block, out);
+	run_tasks(base, out);
+	return p;
+}
+
+void process(const char *begin, const char *end, bool new_block, FILE *out) {
+	assert(begin <= end);
+
+	// DEBUG("Processing: %.*s\n", (int)(end - begin), begin);
+
+	size_t base = tasks.count;
+	push_task((struct task){ .kind = TASK_RANGE, .begin = begin, .end = end, .new_block = new_block });
+	run_tasks(base, out);
+}
+
+// Like process(), except that the blocks separated by double newlines are
+// looked up in `cache` and only rendered if they aren't there yet. Rendering
+// stops at the first element starting at or after `limit`, so a document can
+// be rendered in pieces. Returns where the next element starts, or NULL if
+// there is nothing left to render.
+//
+// A block can be reused if rendering it stops right at the double newline.
+// That is the case for headers, lists and paragraphs, which never look past
+// it. Preformatted blocks ({{{) may span several blocks, so blocks containing
+// them are always rendered.
+const char *process_cached(const char *p, const char *limit, const char *end, bool *new_block_p, struct block_cache *cache, FILE *out) {
+	bool new_block = *new_block_p;
+	while (p != NULL && p < limit) {
+		if (!new_block) {
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+
+		// Find the block at `p`, including the double newline which ends it,
+		// since that also determines how it is rendered.
+		while (*p == '\n') {
+			p += 1;
+			if (p == end) {
+				*new_block_p = new_block;
+				return NULL;
+			}
+		}
+		const char *stop = p;
+		while (stop + 1 < end && !(stop[0] == '\n' && stop[1] == '\n')) {
+			stop += 1;
+		}
+		const char *block_end = (stop + 1 < end) ? stop + 2 : end;
+		if (stop + 1 >= end) {
+			stop = end;
+		}
+		size_t block_len = block_end - p;
+
+		if (block_len < MIN_CACHED_BLOCK || strnstr(p, "{{{", stop - p) != NULL) {
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+		void (*link)(const char *, size_t, void *) = (options != NULL) ? options->link : NULL;
+		if (block_cache_get(cache, p, block_len, out, link, (options != NULL) ? options->arg : NULL)) {
+			p = (stop == end) ? NULL : stop;
+			new_block = true;
+			continue;
+		}
+
+		// Render the block on the side, so it can be cached.
+		char *html = NULL, *links = NULL;
+		size_t html_len = 0, links_len = 0;
+		FILE *block_out = open_memstream(&html, &html_len);
+		block_links = open_memstream(&links, &links_len);
+		if (block_out == NULL || block_links == NULL) {
+			// Rendering directly works just as well.
+			if (block_out != NULL) {
+				fclose(block_out);
+				free(html);
+			}
+			if (block_links != NULL) {
+				fclose(block_links);
+				free(links);
+				block_links = NULL;
+			}
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+		const char *q = p;
+		while (q != NULL && q < stop) {
+			q = process_element(q, end, &new_block, block_out);
+		}
+		fclose(block_out);
+		fclose(block_links);
+		block_links = NULL;
+		fwrite(html, 1, html_len, out);
+		if ((q == stop && new_block) || (q == NULL && stop == end)) {
+			block_cache_put(cache, p, block_len, html, html_len, links, links_len);
+		}
+		free(html);
+		free(links);
+		p = q;
+	}
+	*new_block_p = new_block;
+	return p;
+}
+
+// Render from `p` up to the first element starting at or after `limit`,
+// using the block cache if there is one. Returns where the next element
+// starts, or NULL if there is nothing left to render.
+const char *process_range(const char *p, const char *limit, const char *end, bool *new_block, FILE *out) {
+	if (options != NULL && options->cache != NULL) {
+		return process_cached(p, limit, end, new_block, options->cache, out);
+	}
+	while (p != NULL && p < limit) {
+		p = process_element(p, end, new_block, out);
+	}
+	return p;
+}
+
+// A part of a document rendered on its own thread by process_parallel().
+struct piece {
+	// The piece starts at a double newline, where a new block begins, and
+	// ends where the next one starts. `run_end` is the first character
+	// after the newlines at `begin`.
+	const char *begin, *run_end, *limit, *end;
+
+	const struct creole_options *options;
+	struct creole_options piece_options;
+
+	FILE *out, *links;
+	char *html, *link_targets;
+	size_t html_len, link_targets_len;
+
+	// Where rendering of the piece stopped, as returned by process_range().
+	const char *stop;
+	bool new_block;
+
+	pthread_t thread;
+	bool started;
+};
+
+static void collect_piece_link(const char *target, size_t target_len, void *arg) {
+	FILE *links = arg;
+	fwrite(target, 1, target_len, links);
+	fputc('\0', links);
+}
+
+static void *render_piece(void *arg) {
+	struct piece *piece = arg;
+	options = &piece->piece_options;
+	reset_searches();
+	piece->new_block = true;
+	piece->stop = process_range(piece->begin, piece->limit, piece->end, &piece->new_block, piece->out);
+	free_tasks();
+	options = NULL;
+	return NULL;
+}
+
+// Find where the piece after the one starting at `begin` should start: at a
+// double newline at least `size` bytes on, which isn't inside a preformatted
+// block. Returns NULL if there is no such place.
+static const char *next_boundary(const char *begin, const char *end, size_t size) {
+	if ((size_t)(end - begin) <= size) {
+		return NULL;
+	}
+	const char *boundary = begin + size, *q = begin;
+	while (true) {
+		boundary = strnstr(boundary, "\n\n", end - boundary);
+		if (boundary == NULL) {
+			return NULL;
+		}
+
+		// Skip past preformatted blocks which would be cut in two.
+		const char *open;
+		while (q < boundary && (open = strnstr(q, "{{{", boundary - q)) != NULL) {
+			const char *close = strnstr(open + 3, "}}}", end - (open + 3));
+			if (close == NULL) {
+				return NULL;
+			}
+			q = close + 3;
+		}
+		if (q <= boundary) {
+			break;
+		}
+		boundary = q;
+	}
+
+	// A boundary followed by nothing but newlines is no use.
+	const char *run_end = boundary;
+	while (run_end < end && *run_end == '\n') {
+		run_end += 1;
+	}
+	return (run_end < end) ? boundary : NULL;
+}
+
+// Render the document in up to `options->threads` pieces at once.
+//
+// Each piece after the first is rendered as if a new block started where it
+// does. That is only what process() would do if rendering the previous piece
+// ends right there, which isn't known until it has been rendered, so the
+// pieces are checked in order: a piece whose start doesn't match where the
+// previous one stopped is discarded and rendered again from there. Output is
+// thus the same as process() would give, even when an element spans pieces.
+void process_parallel(const char *begin, const char *end, FILE *out) {
+	size_t count = options->threads;
+	size_t size = (size_t)(end - begin) / count;
+	if (size < options->split_size) {
+		size = options->split_size;
+	}
+	struct piece *pieces = calloc(count, sizeof(*pieces));
+	if (pieces == NULL) {
+		bool new_block = true;
+		process_range(begin, end, end, &new_block, out);
+		return;
+	}
+
+	size_t n = 0;
+	for (const char *p = begin; p != NULL && n < count; ++n) {
+		struct piece *piece = &pieces[n];
+		piece->begin = p;
+		piece->run_end = p;
+		while (piece->run_end < end && *piece->run_end == '\n') {
+			piece->run_end += 1;
+		}
+		piece->end = end;
+		p = (n + 1 < count) ? next_boundary(p, end, size) : NULL;
+		piece->limit = (p != NULL) ? p : end;
+	}
+	if (n > 0) {
+		pieces[n - 1].limit = end;
+	}
+
+	// The first piece is rendered directly, on this thread.
+	for (size_t i = 1; i < n; ++i) {
+		struct piece *piece = &pieces[i];
+		piece->piece_options = *options;
+		piece->out = open_memstream(&piece->html, &piece->html_len);
+		if (piece->out == NULL) {
+			continue;
+		}
+		if (options->link != NULL) {
+			piece->links = open_memstream(&piece->link_targets, &piece->link_targets_len);
+			if (piece->links == NULL) {
+				fclose(piece->out);
+				piece->out = NULL;
+				continue;
+			}
+			piece->piece_options.link = collect_piece_link;
+			piece->piece_options.arg = piece->links;
+		}
+		piece->started = pthread_create(&piece->thread, NULL, render_piece, piece) == 0;
+	}
+
+	bool new_block = true;
+	const char *p = process_range(begin, pieces[0].limit, end, &new_block, out);
+	for (size_t i = 1; i < n; ++i) {
+		struct piece *piece = &pieces[i];
+		if (piece->started) {
+			pthread_join(piece->thread, NULL);
+		}
+		if (piece->out != NULL) {
+			fclose(piece->out);
+		}
+		if (piece->links != NULL) {
+			fclose(piece->links);
+		}
+
+		// Newlines starting a block are skipped, so any place among them
+		// is as good as `begin`.
+		if (p == NULL) {
+			// Already done.
+		} else if (piece->started && new_block && piece->begin <= p && p <= piece->run_end) {
+			fwrite(piece->html, 1, piece->html_len, out);
+			for (const char *target = piece->link_targets;
+			     target < piece->link_targets + piece->link_targets_len;
+			     target += strlen(target) + 1) {
+				options->link(target, strlen(target), options->arg);
+			}
+			p = piece->stop;
+			new_block = piece->new_block;
+		} else {
+			p = process_range(p, piece->limit, end, &new_block, out);
+		}
+		free(piece->html);
+		free(piece->link_targets);
+	}
+	free(pieces);
+}
+
+void render_creole(FILE *out, const char *source, size_t source_length)
+{
+	render_creole_ext(out, source, source_length, NULL);
+}
+
+void render_creole_ext(FILE *out, const char *source, size_t source_length, const struct creole_options *render_options)
+{
+	options = render_options;
+	reset_searches();
+	if (options != NULL && options->threads > 1 && source_length > options->split_size) {
+		process_parallel(source, source + source_length, out);
+	} else {
+		bool new_block = true;
+		process_range(source, source + source_length, source + source_length, &new_block, out);
+	}
+	free_tasks();
+	options = NULL;
+}
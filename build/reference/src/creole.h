@@ -0,0 +1,44 @@
+#ifndef CREOLE_H
+#define CREOLE_H
+
+// Defines a module for rendering Wiki Creole [1] to a file. This functionality
+// of this module is based on the formal grammar [2] of Wiki Creole.
+//
+// [1]: http://www.wikicreole.org/wiki/Home
+// [2]: http://www.wikicreole.org/wiki/EBNFGrammarForWikiCreole1.0
+
+#include <stddef.h> // size_t
+#include <stdio.h>  // FILE
+
+struct block_cache;
+
+void render_creole(FILE *out, const char *source, size_t length);
+
+// Options for render_creole_ext(). Zeroed options behave like
+// render_creole().
+struct creole_options {
+	// If not NULL, called with the target of every [[link]] as it is
+	// rendered.
+	void (*link)(const char *target, size_t target_len, void *arg);
+	void *arg;
+
+	// If not NULL, blocks which were rendered before are taken from here
+	// instead of being rendered again.
+	struct block_cache *cache;
+
+	// If greater than one, documents longer than `split_size` bytes are
+	// split into pieces of at least that size, which are rendered by up to
+	// `threads` threads at once. The output is the same either way.
+	unsigned threads;
+	size_t split_size;
+
+	// How deeply markup may be nested before the rest is written as plain
+	// text. Zero means CREOLE_MAX_DEPTH.
+	unsigned max_depth;
+};
+
+#define CREOLE_MAX_DEPTH 256
+
+void render_creole_ext(FILE *out, const char *source, size_t length, const struct creole_options *options);
+
+#endif
@@ -0,0 +1,129 @@
+#include "creole.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Fuzz target for render_creole(). Besides what the sanitizers catch, every
+// input is rendered repeated 1, 2 and 4 times, and inputs whose render time or
+// output grows much faster than that are reported as crashes, so quadratic
+// paths in the parser are found like any other bug.
+//
+// Built with -fsanitize=fuzzer, this is a libFuzzer target. Built with
+// -DCREOLE_REPLAY, it is a program which runs the target on every file given
+// on its command line instead, which is how the regression corpus is checked.
+
+// The smallest input rendered when checking how rendering scales. Smaller
+// inputs are repeated until they are this long, so the timings aren't lost in
+// the noise.
+#define MIN_SCALED_LENGTH 4096
+
+// Rendering four times as much may take at most this many times as long...
+#define MAX_TIME_RATIO 10.0
+
+// ...unless it is this quick anyway, in seconds.
+#define MIN_REPORTED_TIME 0.005
+
+// Likewise for the size of the output, in bytes.
+#define MAX_OUTPUT_RATIO 6.0
+#define MIN_REPORTED_OUTPUT 4096
+
+static double cpu_time(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+// Render `count` copies of `data` and return how long that took, at best, in
+// seconds. The size of the output is stored in `output_len`.
+static double render_copies(const uint8_t *data, size_t size, size_t count, size_t *output_len) {
+	char *source = malloc(size * count);
+	if (source == NULL) {
+		abort();
+	}
+	for (size_t i = 0; i < count; ++i) {
+		memcpy(source + i * size, data, size);
+	}
+
+	double best = 0;
+	for (int attempt = 0; attempt < 2; ++attempt) {
+		char *output = NULL;
+		FILE *out = open_memstream(&output, output_len);
+		if (out == NULL) {
+			abort();
+		}
+		double start = cpu_time();
+		render_creole(out, source, size * count);
+		fclose(out);
+		double elapsed = cpu_time() - start;
+		if (attempt == 0 || elapsed < best) {
+			best = elapsed;
+		}
+		free(output);
+	}
+	free(source);
+	return best;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+	if (size == 0) {
+		return 0;
+	}
+
+	size_t base = (MIN_SCALED_LENGTH + size - 1) / size;
+	size_t output_len[3];
+	double elapsed[3];
+	for (int i = 0; i < 3; ++i) {
+		elapsed[i] = render_copies(data, size, base << i, &output_len[i]);
+	}
+
+	if (elapsed[2] > MIN_REPORTED_TIME && elapsed[2] > MAX_TIME_RATIO * elapsed[0]) {
+		fprintf(stderr, "render time grows super-linearly: %zu bytes took %.4fs, %zu took %.4fs, %zu took %.4fs\n",
+		        size * base, elapsed[0], size * base * 2, elapsed[1], size * base * 4, elapsed[2]);
+		abort();
+	}
+	if (output_len[2] > MIN_REPORTED_OUTPUT && (double)output_len[2] > MAX_OUTPUT_RATIO * (double)output_len[0]) {
+		fprintf(stderr, "output grows super-linearly: %zu bytes gave %zu, %zu gave %zu, %zu gave %zu\n",
+		        size * base, output_len[0], size * base * 2, output_len[1], size * base * 4, output_len[2]);
+		abort();
+	}
+	return 0;
+}
+
+#ifdef CREOLE_REPLAY
+int main(int argc, char *argv[]) {
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s file...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	for (int i = 1; i < argc; ++i) {
+		FILE *fp = fopen(argv[i], "rb");
+		if (fp == NULL) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+		char *data = NULL;
+		size_t size = 0;
+		FILE *buffer = open_memstream(&data, &size);
+		if (buffer == NULL) {
+			perror("open_memstream");
+			return EXIT_FAILURE;
+		}
+		int c;
+		while ((c = getc(fp)) != EOF) {
+			putc(c, buffer);
+		}
+		fclose(buffer);
+		fclose(fp);
+
+		printf("Running: %s\n", argv[i]);
+		fflush(stdout);
+		LLVMFuzzerTestOneInput((const uint8_t *)data, size);
+		free(data);
+	}
+	return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,266 @@
+#include "diff.h"
+
+#include "die.h"        // die
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint64_t
+#include <stdlib.h>     // malloc, calloc, free
+#include <string.h>     // memchr, memcmp
+
+// Lines of context around each change.
+#define CONTEXT 3
+
+struct line {
+	const char *text;
+	size_t len; // Including the newline, if any.
+	uint64_t hash;
+};
+
+struct diff {
+	struct line *old;
+	struct line *new;
+
+	// Which lines were removed from `old` and added to `new`.
+	bool *removed;
+	bool *added;
+
+	// Furthest reaching paths of the forward and backward searches, by
+	// diagonal. See bisect().
+	long *forward;
+	long *backward;
+};
+
+// Split `text` into lines, hashing each of them. Returns the number of lines.
+static size_t split_lines(const char *text, size_t len, struct line **lines) {
+	size_t count = 0;
+	for (const char *p = text, *end = text + len; p < end; count++) {
+		const char *newline = memchr(p, '\n', end - p);
+		p = (newline == NULL) ? end : newline + 1;
+	}
+
+	*lines = calloc(count + 1, sizeof(**lines));
+	if (*lines == NULL) {
+		die("failed to allocate %zu lines", count);
+	}
+	const char *p = text, *end = text + len;
+	for (size_t i = 0; i < count; ++i) {
+		const char *newline = memchr(p, '\n', end - p);
+		const char *stop = (newline == NULL) ? end : newline + 1;
+
+		// FNV-1a.
+		uint64_t h = 14695981039346656037ULL;
+		for (const char *c = p; c < stop; ++c) {
+			h = (h ^ (unsigned char)*c) * 1099511628211ULL;
+		}
+		(*lines)[i] = (struct line){ .text = p, .len = stop - p, .hash = h };
+		p = stop;
+	}
+	return count;
+}
+
+static bool same_line(const struct diff *d, long i, long j) {
+	const struct line *a = &d->old[i], *b = &d->new[j];
+	return a->hash == b->hash && a->len == b->len && memcmp(a->text, b->text, a->len) == 0;
+}
+
+// Find where the shortest edit script turning old[a0..a1) into new[b0..b1)
+// can be split in two, by searching from both ends at once until the paths
+// meet. Both ranges must be non-empty. Returns false if there is no common
+// line at all.
+static bool bisect(struct diff *d, long a0, long a1, long b0, long b1, long *split_x, long *split_y) {
+	long n = a1 - a0, m = b1 - b0;
+	long max_d = (n + m + 1) / 2;
+	long offset = max_d;
+	long length = 2 * max_d;
+
+	// The backward search runs on the reversed lines. A value of -1 marks a
+	// diagonal not reached yet.
+	long *vf = d->forward, *vb = d->backward;
+	for (long i = 0; i < length + 2; ++i) {
+		vf[i] = -1;
+		vb[i] = -1;
+	}
+	vf[offset + 1] = 0;
+	vb[offset + 1] = 0;
+
+	long delta = n - m;
+	bool odd = delta & 1;
+
+	// Diagonals which ran off the edge of the grid aren't extended further.
+	long forward_start = 0, forward_end = 0, backward_start = 0, backward_end = 0;
+
+	for (long D = 0; D < max_d; ++D) {
+		for (long k = -D + forward_start; k <= D - forward_end; k += 2) {
+			long i = offset + k;
+			long x = (k == -D || (k != D && vf[i - 1] < vf[i + 1])) ? vf[i + 1] : vf[i - 1] + 1;
+			long y = x - k;
+			while (x < n && y < m && same_line(d, a0 + x, b0 + y)) {
+				x++;
+				y++;
+			}
+			vf[i] = x;
+			if (x > n) {
+				forward_end += 2;
+			} else if (y > m) {
+				forward_start += 2;
+			} else if (odd) {
+				long j = offset + delta - k;
+				if (j >= 0 && j < length && vb[j] != -1 && x >= n - vb[j]) {
+					*split_x = x;
+					*split_y = y;
+					return true;
+				}
+			}
+		}
+
+		for (long k = -D + backward_start; k <= D - backward_end; k += 2) {
+			long i = offset + k;
+			long x = (k == -D || (k != D && vb[i - 1] < vb[i + 1])) ? vb[i + 1] : vb[i - 1] + 1;
+			long y = x - k;
+			while (x < n && y < m && same_line(d, a1 - x - 1, b1 - y - 1)) {
+				x++;
+				y++;
+			}
+			vb[i] = x;
+			if (x > n) {
+				backward_end += 2;
+			} else if (y > m) {
+				backward_start += 2;
+			} else if (!odd) {
+				long j = offset + delta - k;
+				if (j >= 0 && j < length && vf[j] != -1 && vf[j] >= n - x) {
+					*split_x = vf[j];
+					*split_y = vf[j] - (j - offset);
+					return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+// Mark the lines which differ between old[a0..a1) and new[b0..b1).
+static void compare(struct diff *d, long a0, long a1, long b0, long b1) {
+	// Lines in common at either end needn't be searched.
+	while (a0 < a1 && b0 < b1 && same_line(d, a0, b0)) {
+		a0++;
+		b0++;
+	}
+	while (a0 < a1 && b0 < b1 && same_line(d, a1 - 1, b1 - 1)) {
+		a1--;
+		b1--;
+	}
+
+	long x, y;
+	if (a0 < a1 && b0 < b1 && bisect(d, a0, a1, b0, b1, &x, &y)) {
+		compare(d, a0, a0 + x, b0, b0 + y);
+		compare(d, a0 + x, a1, b0 + y, b1);
+		return;
+	}
+
+	// One side is empty, or there is nothing in common.
+	for (long i = a0; i < a1; ++i) {
+		d->removed[i] = true;
+	}
+	for (long j = b0; j < b1; ++j) {
+		d->added[j] = true;
+	}
+}
+
+static void write_escaped(FILE *out, const char *text, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		switch (text[i]) {
+			case '&': fputs("&amp;", out); break;
+			case '<': fputs("&lt;", out); break;
+			case '>': fputs("&gt;", out); break;
+			case '\n': break;
+			default: fputc(text[i], out); break;
+		}
+	}
+}
+
+static void write_line(FILE *out, const struct line *line, char prefix) {
+	const char *tag = (prefix == '-') ? "del" : (prefix == '+') ? "ins" : NULL;
+	if (tag != NULL) {
+		fprintf(out, "<%s>", tag);
+	}
+	fputc(prefix, out);
+	write_escaped(out, line->text, line->len);
+	if (tag != NULL) {
+		fprintf(out, "</%s>", tag);
+	}
+	fputc('\n', out);
+}
+
+// Write the hunk covering old[i0..i1) and new[j0..j1).
+static void write_hunk(FILE *out, const struct diff *d, size_t i0, size_t i1, size_t j0, size_t j1) {
+	// Like diff(1), an empty range is given by the line before it.
+	fprintf(out, "<span class=\"hunk\">@@ -%zu,%zu +%zu,%zu @@</span>\n",
+	        (i1 > i0) ? i0 + 1 : i0, i1 - i0, (j1 > j0) ? j0 + 1 : j0, j1 - j0);
+	size_t i = i0, j = j0;
+	while (i < i1 || j < j1) {
+		if (i < i1 && d->removed[i]) {
+			write_line(out, &d->old[i++], '-');
+		} else if (j < j1 && d->added[j]) {
+			write_line(out, &d->new[j++], '+');
+		} else {
+			write_line(out, &d->old[i++], ' ');
+			j++;
+		}
+	}
+}
+
+void render_diff(FILE *out, const char *old, size_t old_len, const char *new, size_t new_len) {
+	struct diff d = {0};
+	size_t n = split_lines(old, old_len, &d.old);
+	size_t m = split_lines(new, new_len, &d.new);
+	d.removed = calloc(n + 1, sizeof(*d.removed));
+	d.added = calloc(m + 1, sizeof(*d.added));
+
+	// Enough for the diagonals of the largest search.
+	d.forward = malloc((n + m + 4) * sizeof(*d.forward));
+	d.backward = malloc((n + m + 4) * sizeof(*d.backward));
+	if (d.removed == NULL || d.added == NULL || d.forward == NULL || d.backward == NULL) {
+		die("failed to allocate diff of %zu and %zu lines", n, m);
+	}
+	compare(&d, 0, (long)n, 0, (long)m);
+
+	// Group changes less than two contexts apart into hunks.
+	fputs("<pre class=\"diff\">\n", out);
+	size_t i = 0, j = 0;
+	while (i < n || j < m) {
+		if ((i < n && d.removed[i]) || (j < m && d.added[j])) {
+			size_t context = (i < CONTEXT) ? i : CONTEXT;
+			size_t i0 = i - context, j0 = j - context;
+			size_t unchanged = 0;
+			while ((i < n || j < m) && unchanged < 2 * CONTEXT) {
+				if (i < n && d.removed[i]) {
+					i++;
+					unchanged = 0;
+				} else if (j < m && d.added[j]) {
+					j++;
+					unchanged = 0;
+				} else {
+					i++;
+					j++;
+					unchanged++;
+				}
+			}
+			// Leave out trailing context beyond the limit.
+			size_t excess = (unchanged > CONTEXT) ? unchanged - CONTEXT : 0;
+			write_hunk(out, &d, i0, i - excess, j0, j - excess);
+			i -= excess;
+			j -= excess;
+		} else {
+			i++;
+			j++;
+		}
+	}
+	fputs("</pre>\n", out);
+
+	free(d.forward);
+	free(d.backward);
+	free(d.removed);
+	free(d.added);
+	free(d.old);
+	free(d.new);
+}
@@ -0,0 +1,425 @@
+#include "history.h"
+
+#include "die.h"        // die*
+#include "oidmap.h"     // struct oidmap, oidmap_*
+#include "treediff.h"   // diff_commit
+#include <errno.h>      // errno, ENOENT
+#include <fcntl.h>      // open, O_RDONLY
+#include <stdbool.h>    // bool
+#include <stdio.h>      // FILE, fopen, fwrite, snprintf
+#include <stdlib.h>     // malloc, calloc, realloc, free, qsort
+#include <string.h>     // memcmp, memcpy, strcmp, strlen, strdup
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close, getpid
+
+#define HISTORY_MAGIC "SWHIST01"
+
+//
+// On-disk layout of the header:
+//
+//     0  [8]  magic
+//     8  u32  number of commits
+//    12  u32  number of paths
+//    16  u32  number of changes
+//    20  u32  length of the strings
+//    24  [8]  padding
+//
+// A commit record is the commit id followed by its time as a signed 64-bit
+// integer. A change record is the number of the commit followed by the blob id.
+//
+
+#define HEADER_SIZE 32
+#define COMMIT_SIZE 28
+#define CHANGE_SIZE 24
+
+struct commit {
+	git_oid id;
+	git_time_t time;
+
+	// Position in the file being written.
+	uint32_t number;
+};
+
+struct change {
+	char *path;
+	uint32_t commit; // Index into `commits`.
+	git_oid blob;    // Zero if the file was deleted.
+};
+
+struct history {
+	char *path;
+
+	struct commit *commits;
+	size_t commit_count;
+	size_t commit_capacity;
+
+	struct change *changes;
+	size_t change_count;
+	size_t change_capacity;
+
+	// Maps the id of every recorded commit to its index plus one.
+	struct oidmap recorded;
+};
+
+struct history_file {
+	const unsigned char *map;
+	size_t size;
+
+	uint32_t commit_count;
+	uint32_t path_count;
+	uint32_t change_count;
+
+	const unsigned char *commits;
+	const unsigned char *paths_index;
+	const unsigned char *changes_index;
+	const unsigned char *changes;
+	const char *strings;
+	uint32_t strings_len;
+};
+
+static void put_le32(unsigned char *p, uint32_t v) {
+	for (int i = 0; i < 4; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+	for (int i = 0; i < 8; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static uint32_t add_commit(struct history *h, const git_oid *id, git_time_t time) {
+	if (h->commit_count == h->commit_capacity) {
+		h->commit_capacity = (h->commit_capacity == 0) ? 256 : h->commit_capacity * 2;
+		h->commits = realloc(h->commits, h->commit_capacity * sizeof(*h->commits));
+		if (h->commits == NULL) {
+			die("failed to grow history to %zu commits", h->commit_capacity);
+		}
+	}
+	struct commit *commit = &h->commits[h->commit_count];
+	git_oid_cpy(&commit->id, id);
+	commit->time = time;
+	*oidmap_put(&h->recorded, id, NULL) = (void *)(uintptr_t)(h->commit_count + 1);
+	return (uint32_t)h->commit_count++;
+}
+
+static void add_change(struct history *h, const char *path, uint32_t commit, const git_oid *blob) {
+	if (h->change_count == h->change_capacity) {
+		h->change_capacity = (h->change_capacity == 0) ? 1024 : h->change_capacity * 2;
+		h->changes = realloc(h->changes, h->change_capacity * sizeof(*h->changes));
+		if (h->changes == NULL) {
+			die("failed to grow history to %zu changes", h->change_capacity);
+		}
+	}
+	struct change *change = &h->changes[h->change_count++];
+	change->path = strdup(path);
+	if (change->path == NULL) {
+		die("failed to copy path");
+	}
+	change->commit = commit;
+	if (blob != NULL) {
+		git_oid_cpy(&change->blob, blob);
+	} else {
+		memset(&change->blob, 0, sizeof(change->blob));
+	}
+}
+
+struct history *history_load(const char *path) {
+	struct history *h = calloc(1, sizeof(*h));
+	if (h == NULL) {
+		die("failed to allocate history");
+	}
+	h->path = strdup(path);
+	if (h->path == NULL) {
+		die("failed to copy path");
+	}
+
+	if (access(path, F_OK) < 0) {
+		if (errno != ENOENT) {
+			die_errno("failed to access %s", path);
+		}
+		return h;
+	}
+
+	struct history_file *f = history_file_open(path);
+	for (uint32_t i = 0; i < f->commit_count; ++i) {
+		const unsigned char *p = f->commits + (size_t)i * COMMIT_SIZE;
+		git_oid id;
+		memcpy(id.id, p, GIT_OID_RAWSZ);
+		add_commit(h, &id, (git_time_t)get_le64(p + GIT_OID_RAWSZ));
+	}
+	for (uint32_t i = 0; i < f->path_count; ++i) {
+		const char *path = f->strings + get_le32(f->paths_index + 4 * (size_t)i);
+		uint32_t begin = get_le32(f->changes_index + 4 * (size_t)i);
+		uint32_t end = get_le32(f->changes_index + 4 * ((size_t)i + 1));
+		for (uint32_t j = begin; j < end; ++j) {
+			const unsigned char *p = f->changes + (size_t)j * CHANGE_SIZE;
+			uint32_t commit = get_le32(p);
+			if (commit >= h->commit_count) {
+				die("%s is corrupt", h->path);
+			}
+			git_oid blob;
+			memcpy(blob.id, p + 4, GIT_OID_RAWSZ);
+			add_change(h, path, commit, &blob);
+		}
+	}
+	history_file_close(f);
+	return h;
+}
+
+// Called for every file changed by the commit being added.
+static void record_change(const char *path, const git_oid *old, const git_oid *new, void *arg) {
+	struct history *h = arg;
+	add_change(h, path, (uint32_t)(h->commit_count - 1), new);
+}
+
+void history_add_commit(struct history *h, git_repository *repo, git_commit *commit) {
+	if (oidmap_get(&h->recorded, git_commit_id(commit)) != NULL) {
+		return;
+	}
+	add_commit(h, git_commit_id(commit), git_commit_time(commit));
+	diff_commit(repo, commit, record_change, h);
+}
+
+//
+// Writing the index
+//
+
+// Commits are numbered newest first.
+static int compare_commits(const void *a, const void *b) {
+	const struct commit *ca = *(const struct commit *const *)a, *cb = *(const struct commit *const *)b;
+	if (ca->time != cb->time) {
+		return (ca->time < cb->time) - (ca->time > cb->time);
+	}
+	return git_oid_cmp(&ca->id, &cb->id);
+}
+
+// qsort() has no argument for the comparison function.
+static const struct commit *sort_commits;
+
+static int compare_changes(const void *a, const void *b) {
+	const struct change *ca = a, *cb = b;
+	int cmp = strcmp(ca->path, cb->path);
+	if (cmp != 0) {
+		return cmp;
+	}
+	uint32_t x = sort_commits[ca->commit].number, y = sort_commits[cb->commit].number;
+	return (x > y) - (x < y);
+}
+
+void history_write(struct history *h) {
+	struct commit **order = malloc((h->commit_count + 1) * sizeof(*order));
+	if (order == NULL) {
+		die("failed to allocate history");
+	}
+	for (size_t i = 0; i < h->commit_count; ++i) {
+		order[i] = &h->commits[i];
+	}
+	if (h->commit_count > 0) {
+		qsort(order, h->commit_count, sizeof(*order), compare_commits);
+	}
+	for (size_t i = 0; i < h->commit_count; ++i) {
+		order[i]->number = (uint32_t)i;
+	}
+	sort_commits = h->commits;
+	if (h->change_count > 0) {
+		qsort(h->changes, h->change_count, sizeof(*h->changes), compare_changes);
+	}
+	sort_commits = NULL;
+
+	size_t temp_len = strlen(h->path) + 32;
+	char *temp = malloc(temp_len);
+	if (temp == NULL) {
+		die("failed to allocate path");
+	}
+	snprintf(temp, temp_len, "%s.%ld", h->path, (long)getpid());
+	FILE *out = fopen(temp, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", temp);
+	}
+
+	// Count the paths and the length of their strings.
+	uint32_t path_count = 0, strings_len = 0;
+	for (size_t i = 0; i < h->change_count; ++i) {
+		if (i == 0 || strcmp(h->changes[i - 1].path, h->changes[i].path) != 0) {
+			path_count += 1;
+			strings_len += (uint32_t)strlen(h->changes[i].path) + 1;
+		}
+	}
+
+	unsigned char header[HEADER_SIZE] = {0};
+	memcpy(header, HISTORY_MAGIC, 8);
+	put_le32(header + 8, (uint32_t)h->commit_count);
+	put_le32(header + 12, path_count);
+	put_le32(header + 16, (uint32_t)h->change_count);
+	put_le32(header + 20, strings_len);
+	fwrite(header, 1, sizeof(header), out);
+
+	for (size_t i = 0; i < h->commit_count; ++i) {
+		unsigned char record[COMMIT_SIZE];
+		memcpy(record, order[i]->id.id, GIT_OID_RAWSZ);
+		put_le64(record + GIT_OID_RAWSZ, (uint64_t)order[i]->time);
+		fwrite(record, 1, sizeof(record), out);
+	}
+
+	// The two indices are written in separate passes.
+	for (int pass = 0; pass < 2; ++pass) {
+		uint32_t offset = 0;
+		for (size_t i = 0; i < h->change_count; ++i) {
+			if (i == 0 || strcmp(h->changes[i - 1].path, h->changes[i].path) != 0) {
+				unsigned char buf[4];
+				put_le32(buf, (pass == 0) ? offset : (uint32_t)i);
+				fwrite(buf, 1, sizeof(buf), out);
+				offset += (uint32_t)strlen(h->changes[i].path) + 1;
+			}
+		}
+		unsigned char buf[4];
+		put_le32(buf, (pass == 0) ? offset : (uint32_t)h->change_count);
+		fwrite(buf, 1, sizeof(buf), out);
+	}
+
+	for (size_t i = 0; i < h->change_count; ++i) {
+		unsigned char record[CHANGE_SIZE];
+		put_le32(record, h->commits[h->changes[i].commit].number);
+		memcpy(record + 4, h->changes[i].blob.id, GIT_OID_RAWSZ);
+		fwrite(record, 1, sizeof(record), out);
+	}
+
+	for (size_t i = 0; i < h->change_count; ++i) {
+		if (i == 0 || strcmp(h->changes[i - 1].path, h->changes[i].path) != 0) {
+			fwrite(h->changes[i].path, 1, strlen(h->changes[i].path) + 1, out);
+		}
+	}
+
+	if (ferror(out) | (fclose(out) == EOF)) {
+		die_errno("failed to write %s", temp);
+	}
+	if (rename(temp, h->path) < 0) {
+		die_errno("failed to replace %s", h->path);
+	}
+	free(temp);
+	free(order);
+}
+
+void history_free(struct history *h) {
+	for (size_t i = 0; i < h->change_count; ++i) {
+		free(h->changes[i].path);
+	}
+	free(h->changes);
+	free(h->commits);
+	oidmap_destroy(&h->recorded);
+	free(h->path);
+	free(h);
+}
+
+//
+// Reading the index
+//
+
+struct history_file *history_file_open(const char *path) {
+	struct history_file *f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		die("failed to allocate history");
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		die_errno("failed to open %s", path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		die_errno("failed to stat %s", path);
+	}
+	f->size = (size_t)st.st_size;
+	if (f->size < HEADER_SIZE) {
+		die("%s is not a history index", path);
+	}
+	f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (f->map == MAP_FAILED) {
+		die_errno("failed to map %s", path);
+	}
+	close(fd);
+
+	if (memcmp(f->map, HISTORY_MAGIC, 8) != 0) {
+		die("%s is not a history index", path);
+	}
+	f->commit_count = get_le32(f->map + 8);
+	f->path_count = get_le32(f->map + 12);
+	f->change_count = get_le32(f->map + 16);
+	f->strings_len = get_le32(f->map + 20);
+
+	uint64_t expected = HEADER_SIZE + (uint64_t)f->commit_count * COMMIT_SIZE + 8 * ((uint64_t)f->path_count + 1) +
+	                    (uint64_t)f->change_count * CHANGE_SIZE + f->strings_len;
+	if (expected != f->size || (f->strings_len > 0 && f->map[f->size - 1] != '\0')) {
+		die("%s is corrupt", path);
+	}
+	const unsigned char *p = f->map + HEADER_SIZE;
+	f->commits = p;
+	p += (size_t)f->commit_count * COMMIT_SIZE;
+	f->paths_index = p;
+	p += 4 * ((size_t)f->path_count + 1);
+	f->changes_index = p;
+	p += 4 * ((size_t)f->path_count + 1);
+	f->changes = p;
+	p += (size_t)f->change_count * CHANGE_SIZE;
+	f->strings = (const char *)p;
+	return f;
+}
+
+uint32_t history_file_find(const struct history_file *f, const char *path, uint32_t *first) {
+	uint32_t lo = 0, hi = f->path_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		uint32_t offset = get_le32(f->paths_index + 4 * (size_t)mid);
+		if (offset >= f->strings_len) {
+			die("history index is corrupt");
+		}
+		int cmp = strcmp(f->strings + offset, path);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			*first = get_le32(f->changes_index + 4 * (size_t)mid);
+			return get_le32(f->changes_index + 4 * ((size_t)mid + 1)) - *first;
+		}
+	}
+	return 0;
+}
+
+void history_file_change(const struct history_file *f, uint32_t i, struct history_change *change) {
+	const unsigned char *p = f->changes + (size_t)i * CHANGE_SIZE;
+	uint32_t commit = get_le32(p);
+	if (commit >= f->commit_count) {
+		die("history index is corrupt");
+	}
+	const unsigned char *c = f->commits + (size_t)commit * COMMIT_SIZE;
+	change->commit = (const git_oid *)c;
+	change->time = (git_time_t)get_le64(c + GIT_OID_RAWSZ);
+
+	static const unsigned char zero[GIT_OID_RAWSZ];
+	change->blob = (memcmp(p + 4, zero, GIT_OID_RAWSZ) == 0) ? NULL : (const git_oid *)(p + 4);
+}
+
+void history_file_close(struct history_file *f) {
+	munmap((void *)f->map, f->size);
+	free(f);
+}
@@ -0,0 +1,75 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+//
+// This module defines the history index, which lists the commits changing
+// each file of the repository, so history pages and last-modified dates don't
+// need a walk of their own.
+//
+// The changes of a commit are found by comparing its tree to that of its first
+// parent, which is cheap since unchanged subtrees have the same id and are
+// skipped. This happens as the commit is walked for rendering anyway.
+//
+// The index is a single file. After a header, it holds:
+//
+//     commits        [commits]      id and time, newest first
+//     paths index    [paths + 1]    offsets into strings
+//     changes index  [paths + 1]    offsets into changes
+//     changes        [changes]      commit number and new blob id
+//     strings                       paths, sorted, each terminated by NUL
+//
+// The changes of path `i` are changes[changes_index[i] .. changes_index[i + 1]],
+// newest first, so the first one is the last modification. A change with a
+// zero blob id means the file was deleted. All integers are little-endian.
+//
+// The index is not thread-safe.
+//
+
+#include <git2.h>    // git_oid, git_commit, git_repository
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
+
+struct history;
+
+// Load the index at `path`, if there is one.
+// Panics on failure.
+struct history *history_load(const char *path);
+
+// Record the files changed by `commit` relative to its first parent. Commits
+// which were recorded before are ignored.
+// Panics on failure.
+void history_add_commit(struct history *h, git_repository *repo, git_commit *commit);
+
+// Write the index, replacing the file atomically.
+// Panics on failure.
+void history_write(struct history *h);
+
+// Free the index.
+void history_free(struct history *h);
+
+struct history_file;
+
+// A change recorded in the index.
+struct history_change {
+	const git_oid *commit;
+	git_time_t time;
+
+	// The new contents, or NULL if the file was deleted.
+	const git_oid *blob;
+};
+
+// Map the index at `path`.
+// Panics on failure.
+struct history_file *history_file_open(const char *path);
+
+// Look up the changes of `path`, a path in the repository. Returns the number
+// of changes, setting `first` to the number of the newest one.
+uint32_t history_file_find(const struct history_file *f, const char *path, uint32_t *first);
+
+// Get change number `i`.
+void history_file_change(const struct history_file *f, uint32_t i, struct history_change *change);
+
+// Unmap the index.
+void history_file_close(struct history_file *f);
+
+#endif
@@ -0,0 +1,274 @@
+#include "manifest.h"
+
+#include "die.h"        // die*
+#include <errno.h>      // errno, ENOENT
+#include <stdbool.h>    // bool
+#include <stdio.h>      // FILE, fopen, getline, fprintf
+#include <stdlib.h>     // malloc, realloc, free, qsort, strtoull
+#include <string.h>     // strcmp, strdup, strlen, strncmp, strspn
+#include <unistd.h>     // getpid
+
+struct entry {
+	char *path;
+	git_oid source;
+	git_oid hash;
+	uint64_t size;
+
+	// Insertion order, so the newest entry wins when paths collide.
+	size_t order;
+};
+
+struct list {
+	struct entry *entries;
+	size_t count;
+	size_t capacity;
+};
+
+struct manifest {
+	char *root;
+	size_t root_len;
+
+	// Every file as of the last write, sorted by path.
+	struct list current;
+
+	// Files written since then, in no particular order.
+	struct list added;
+};
+
+static char *join(const char *root, const char *name) {
+	size_t root_len = strlen(root), name_len = strlen(name);
+	char *path = malloc(root_len + 1 + name_len + 1);
+	if (path == NULL) {
+		die("failed to allocate path");
+	}
+	memcpy(path, root, root_len);
+	path[root_len] = '/';
+	memcpy(path + root_len + 1, name, name_len + 1);
+	return path;
+}
+
+static void append(struct list *list, const struct entry *entry) {
+	if (list->count == list->capacity) {
+		list->capacity = (list->capacity == 0) ? 1024 : list->capacity * 2;
+		list->entries = realloc(list->entries, list->capacity * sizeof(*list->entries));
+		if (list->entries == NULL) {
+			die("failed to grow manifest to %zu entries", list->capacity);
+		}
+	}
+	list->entries[list->count] = *entry;
+	list->entries[list->count].order = list->count;
+	list->count += 1;
+}
+
+static void clear(struct list *list, bool free_paths) {
+	if (free_paths) {
+		for (size_t i = 0; i < list->count; ++i) {
+			free(list->entries[i].path);
+		}
+	}
+	free(list->entries);
+	*list = (struct list){0};
+}
+
+// Parse "<hash> <size> <source> <path>". Returns false on malformed input.
+static bool parse_line(char *line, struct entry *entry) {
+	size_t len = strlen(line);
+	if (len > 0 && line[len - 1] == '\n') {
+		line[--len] = '\0';
+	}
+	if (len < 2 * GIT_OID_HEXSZ + 4 || line[GIT_OID_HEXSZ] != ' ') {
+		return false;
+	}
+	if (git_oid_fromstrn(&entry->hash, line, GIT_OID_HEXSZ) < 0) {
+		return false;
+	}
+
+	char *end;
+	errno = 0;
+	entry->size = strtoull(line + GIT_OID_HEXSZ + 1, &end, 10);
+	if (errno != 0 || *end != ' ' || strlen(end + 1) < GIT_OID_HEXSZ + 2 || end[GIT_OID_HEXSZ + 1] != ' ') {
+		return false;
+	}
+	if (git_oid_fromstrn(&entry->source, end + 1, GIT_OID_HEXSZ) < 0) {
+		return false;
+	}
+	entry->path = strdup(end + GIT_OID_HEXSZ + 2);
+	if (entry->path == NULL) {
+		die("failed to copy path");
+	}
+	return true;
+}
+
+struct manifest *manifest_load(const char *root) {
+	struct manifest *m = calloc(1, sizeof(*m));
+	if (m == NULL) {
+		die("failed to allocate manifest");
+	}
+	m->root = strdup(root);
+	if (m->root == NULL) {
+		die("failed to copy path");
+	}
+	m->root_len = strlen(root);
+	while (m->root_len > 1 && m->root[m->root_len - 1] == '/') {
+		m->root[--m->root_len] = '\0';
+	}
+
+	char *path = join(m->root, "manifest");
+	FILE *in = fopen(path, "r");
+	if (in == NULL) {
+		if (errno != ENOENT) {
+			die_errno("failed to open %s", path);
+		}
+		free(path);
+		return m;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+	size_t line_number = 0;
+	while (getline(&line, &line_size, in) >= 0) {
+		line_number += 1;
+		struct entry entry;
+		if (!parse_line(line, &entry)) {
+			die("%s:%zu: malformed manifest entry", path, line_number);
+		}
+		append(&m->current, &entry);
+	}
+	if (ferror(in)) {
+		die_errno("failed to read %s", path);
+	}
+	free(line);
+	fclose(in);
+	free(path);
+
+	return m;
+}
+
+void manifest_add(struct manifest *m, const char *path, const git_oid *source, const git_oid *hash, uint64_t size) {
+	// Paths are stored relative to the root.
+	if (strncmp(path, m->root, m->root_len) == 0 && path[m->root_len] == '/') {
+		path += m->root_len;
+		path += strspn(path, "/");
+	}
+
+	struct entry entry = { .size = size };
+	entry.path = strdup(path);
+	if (entry.path == NULL) {
+		die("failed to copy path");
+	}
+	git_oid_cpy(&entry.source, source);
+	git_oid_cpy(&entry.hash, hash);
+	append(&m->added, &entry);
+}
+
+static int compare_entries(const void *a, const void *b) {
+	const struct entry *ea = a, *eb = b;
+	int cmp = strcmp(ea->path, eb->path);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (ea->order > eb->order) - (ea->order < eb->order);
+}
+
+static void write_entry(FILE *out, const struct entry *entry) {
+	char hash[GIT_OID_HEXSZ + 1], source[GIT_OID_HEXSZ + 1];
+	git_oid_tostr(hash, sizeof(hash), &entry->hash);
+	git_oid_tostr(source, sizeof(source), &entry->source);
+	fprintf(out, "%s %llu %s %s\n", hash, (unsigned long long)entry->size, source, entry->path);
+}
+
+// Open a temporary file to be renamed to `path` by commit_file().
+static FILE *create_file(const char *path, char **temp) {
+	size_t len = strlen(path) + 32;
+	*temp = malloc(len);
+	if (*temp == NULL) {
+		die("failed to allocate path");
+	}
+	snprintf(*temp, len, "%s.%ld", path, (long)getpid());
+
+	FILE *out = fopen(*temp, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", *temp);
+	}
+	return out;
+}
+
+static void commit_file(FILE *out, char *temp, const char *path) {
+	if (ferror(out) | (fclose(out) == EOF)) {
+		die_errno("failed to write %s", temp);
+	}
+	if (rename(temp, path) < 0) {
+		die_errno("failed to replace %s", path);
+	}
+	free(temp);
+}
+
+void manifest_write(struct manifest *m) {
+	// Sort the new entries, keeping only the newest one for each path.
+	struct list *added = &m->added;
+	qsort(added->entries, added->count, sizeof(*added->entries), compare_entries);
+	size_t count = 0;
+	for (size_t i = 0; i < added->count; ++i) {
+		if (i + 1 < added->count && strcmp(added->entries[i].path, added->entries[i + 1].path) == 0) {
+			free(added->entries[i].path);
+			continue;
+		}
+		added->entries[count++] = added->entries[i];
+	}
+	added->count = count;
+
+	char *manifest_path = join(m->root, "manifest");
+	char *delta_path = join(m->root, "manifest.delta");
+	char *manifest_temp, *delta_temp;
+	FILE *manifest = create_file(manifest_path, &manifest_temp);
+	FILE *delta = create_file(delta_path, &delta_temp);
+
+	// Merge the two sorted lists. New entries replace old ones, and are part
+	// of the delta unless they are identical.
+	struct list merged = {0};
+	size_t i = 0, j = 0;
+	while (i < m->current.count || j < added->count) {
+		struct entry *old = (i < m->current.count) ? &m->current.entries[i] : NULL;
+		struct entry *new = (j < added->count) ? &added->entries[j] : NULL;
+		int cmp = (old == NULL) ? 1 : (new == NULL) ? -1 : strcmp(old->path, new->path);
+
+		if (cmp < 0) {
+			append(&merged, old);
+			i += 1;
+			continue;
+		}
+		if (cmp == 0) {
+			bool changed = !git_oid_equal(&old->hash, &new->hash) || old->size != new->size;
+			free(old->path);
+			i += 1;
+			if (!changed) {
+				append(&merged, new);
+				j += 1;
+				continue;
+			}
+		}
+		write_entry(delta, new);
+		append(&merged, new);
+		j += 1;
+	}
+	for (size_t k = 0; k < merged.count; ++k) {
+		write_entry(manifest, &merged.entries[k]);
+	}
+
+	commit_file(delta, delta_temp, delta_path);
+	commit_file(manifest, manifest_temp, manifest_path);
+	free(manifest_path);
+	free(delta_path);
+
+	// The paths now belong to the merged list.
+	clear(&m->current, false);
+	clear(added, false);
+	m->current = merged;
+}
+
+void manifest_free(struct manifest *m) {
+	clear(&m->current, true);
+	clear(&m->added, true);
+	free(m->root);
+	free(m);
+}
@@ -0,0 +1,105 @@
+#include "oidmap.h"
+
+#include "die.h"        // die
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint64_t
+#include <stdlib.h>     // calloc, free
+#include <string.h>     // memcpy
+
+// Object ids are already cryptographic hashes, so any eight bytes of them make
+// a perfectly good hash.
+static size_t hash_oid(const git_oid *oid) {
+	uint64_t h;
+	memcpy(&h, oid->id, sizeof(h));
+	return (size_t)h;
+}
+
+// Find the slot where `key` is or would be stored.
+// Assumes the map has at least one free slot.
+static struct oidmap_entry *find_slot(const struct oidmap *map, const git_oid *key) {
+	size_t mask = map->capacity - 1;
+	for (size_t i = hash_oid(key) & mask; ; i = (i + 1) & mask) {
+		struct oidmap_entry *entry = &map->entries[i];
+		if (!entry->used || git_oid_equal(&entry->key, key)) {
+			return entry;
+		}
+	}
+}
+
+static void grow(struct oidmap *map) {
+	struct oidmap old = *map;
+
+	map->capacity = (old.capacity == 0) ? 64 : old.capacity * 2;
+	map->entries = calloc(map->capacity, sizeof(*map->entries));
+	if (map->entries == NULL) {
+		die("failed to grow map to %zu entries", map->capacity);
+	}
+
+	for (size_t i = 0; i < old.capacity; ++i) {
+		if (old.entries[i].used) {
+			*find_slot(map, &old.entries[i].key) = old.entries[i];
+		}
+	}
+	free(old.entries);
+}
+
+void **oidmap_get(const struct oidmap *map, const git_oid *key) {
+	if (map->count == 0) {
+		return NULL;
+	}
+
+	struct oidmap_entry *entry = find_slot(map, key);
+	return entry->used ? &entry->value : NULL;
+}
+
+void **oidmap_put(struct oidmap *map, const git_oid *key, bool *inserted) {
+	// Keep the load factor below 3/4 so probe sequences stay short.
+	if ((map->count + 1) * 4 > map->capacity * 3) {
+		grow(map);
+	}
+
+	struct oidmap_entry *entry = find_slot(map, key);
+	if (inserted != NULL) {
+		*inserted = !entry->used;
+	}
+	if (!entry->used) {
+		entry->used = true;
+		git_oid_cpy(&entry->key, key);
+		entry->value = NULL;
+		map->count += 1;
+	}
+	return &entry->value;
+}
+
+void oidmap_remove(struct oidmap *map, const git_oid *key) {
+	if (map->count == 0) {
+		return;
+	}
+	struct oidmap_entry *entry = find_slot(map, key);
+	if (!entry->used) {
+		return;
+	}
+
+	// Rather than leaving a tombstone, shift later entries of the probe
+	// sequence back into the hole, unless that would move them before
+	// their home slot.
+	// See: <https://en.wikipedia.org/wiki/Linear_probing#Deletion>
+	size_t mask = map->capacity - 1;
+	size_t hole = entry - map->entries;
+	for (size_t i = (hole + 1) & mask; map->entries[i].used; i = (i + 1) & mask) {
+		size_t home = hash_oid(&map->entries[i].key) & mask;
+		bool stays = (hole <= i) ? (hole < home && home <= i) : (hole < home || home <= i);
+		if (!stays) {
+			map->entries[hole] = map->entries[i];
+			hole = i;
+		}
+	}
+	map->entries[hole].used = false;
+	map->count -= 1;
+}
+
+void oidmap_destroy(struct oidmap *map) {
+	free(map->entries);
+	map->entries = NULL;
+	map->capacity = map->count = 0;
+}
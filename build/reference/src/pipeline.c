@@ -0,0 +1,633 @@
+#include "pipeline.h"
+
+#include "blockcache.h"    // block_cache_*
+#include "bundle.h"        // bundle_*
+#include "creole.h"        // render_creole*
+#include "die.h"           // die*
+#include "diff.h"          // render_diff
+#include "linkgraph.h"     // link_graph_*
+#include "manifest.h"      // manifest_add
+#include "oidmap.h"        // struct oidmap, oidmap_*
+#include "pqueue.h"        // struct pqueue, pqueue_*
+#include "queue.h"         // struct queue, queue_*
+#include "search.h"        // search_*
+#include <errno.h>         // errno, EEXIST
+#include <pthread.h>       // pthread_*
+#include <stdbool.h>       // bool
+#include <stdint.h>        // uint64_t, SIZE_MAX
+#include <stdio.h>         // FILE, fopen, fwrite, open_memstream
+#include <stdlib.h>        // malloc, free
+#include <string.h>        // strlen, memcpy, strdup
+#include <time.h>          // clock_gettime
+#include <unistd.h>        // link, unlink
+#include <zlib.h>          // deflate*
+
+// Everything the writer knows about the output for a given blob.
+struct output {
+	// Path of the first file written with this content.
+	char *path;
+	bool written;
+
+	// Where the content is, when writing to a bundle.
+	struct bundle_entry entry;
+	struct bundle_entry gzip_entry;
+
+	// What the content is, when keeping a manifest.
+	git_oid hash;
+	uint64_t size;
+	git_oid gzip_hash;
+	uint64_t gzip_size;
+
+	// Targets of the links on the page, for link graphs. Kept so the
+	// links of unchanged pages needn't be collected again.
+	char *links;
+	size_t links_len;
+
+	// Link jobs which arrived before the file was written.
+	struct job *pending;
+};
+
+// A link graph whose files are still being added.
+struct open_graph {
+	struct link_graph *graph;
+	size_t added;
+	size_t expected; // SIZE_MAX until the end marker arrives.
+	struct open_graph *next;
+};
+
+// What a render worker did, for struct pipeline_stats. Only touched by the
+// worker until it has exited.
+struct worker {
+	struct pipeline *pipeline;
+	pthread_t thread;
+
+	size_t rendered;
+	uint64_t bytes;
+	double busy;
+	double first_start, last_end;
+	char *slowest_path;
+	double slowest;
+};
+
+struct pipeline {
+	struct pipeline_options options;
+
+	struct pqueue *render_queue;
+	struct queue *write_queue;
+
+	struct worker *render_workers;
+	pthread_t write_thread;
+
+	// Number of jobs submitted but not yet written, so pipeline_wait()
+	// knows when the pipeline has gone idle.
+	pthread_mutex_t lock;
+	pthread_cond_t idle;
+	size_t outstanding;
+
+	// One map per job kind, since a blob is written differently depending
+	// on whether it is rendered or copied. Only touched by the writer.
+	struct oidmap outputs[JOB_KIND_COUNT];
+
+	// Blocks of pages rendered so far, shared by the render workers. NULL if
+	// disabled.
+	struct block_cache *blocks;
+
+	// Link graphs which can't be written yet. Usually there is one, but
+	// files of the next commit may overtake those of the previous one.
+	// Only touched by the writer.
+	struct open_graph *graphs;
+};
+
+static void free_job(struct job *job) {
+	git_blob_free(job->blob);
+	git_blob_free(job->old_blob);
+	free(job->compressed);
+	free(job->terms);
+	free(job->links);
+	free(job->output);
+	free(job->path);
+	free(job);
+}
+
+// Called by the writer once it is done with a job.
+static void finish_job(struct pipeline *p, struct job *job) {
+	free_job(job);
+
+	pthread_mutex_lock(&p->lock);
+	if (--p->outstanding == 0) {
+		pthread_cond_broadcast(&p->idle);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+// Returns `path` with ".gz" appended.
+static char *gzip_path(const char *path) {
+	size_t len = strlen(path);
+	char *result = malloc(len + sizeof(".gz"));
+	if (result == NULL) {
+		die("failed to allocate path");
+	}
+	memcpy(result, path, len);
+	memcpy(result + len, ".gz", sizeof(".gz"));
+	return result;
+}
+
+// Compress the job's output into `job->compressed`.
+static void compress_output(struct job *job, int level) {
+	z_stream stream = {0};
+	// Adding 16 to the window bits makes zlib write a gzip header.
+	if (deflateInit2(&stream, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		die("failed to initialize compression for %s", job->path);
+	}
+
+	uLong bound = deflateBound(&stream, (uLong)job->output_len);
+	job->compressed = malloc(bound);
+	if (job->compressed == NULL) {
+		die("failed to allocate %lu bytes for compressing %s", bound, job->path);
+	}
+	stream.next_in = (Bytef *)job->output;
+	stream.avail_in = (uInt)job->output_len;
+	stream.next_out = (Bytef *)job->compressed;
+	stream.avail_out = (uInt)bound;
+	if (deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+		die("failed to compress %s", job->path);
+	}
+	job->compressed_len = stream.total_out;
+	deflateEnd(&stream);
+}
+
+// Hash output the way git would hash it as a blob.
+static void hash_output(git_oid *hash, const char *content, size_t content_len) {
+	if (git_odb_hash(hash, content, content_len, GIT_OBJECT_BLOB) < 0) {
+		die_git("hash output");
+	}
+}
+
+// Called by the renderer for every link on a page.
+static void collect_link(const char *target, size_t target_len, void *arg) {
+	FILE *links = arg;
+	fwrite(target, 1, target_len, links);
+	fputc('\0', links);
+}
+
+static void process_markup_file(const struct pipeline *p, struct job *job) {
+	const char *source = git_blob_rawcontent(job->blob);
+	size_t source_len = git_blob_rawsize(job->blob);
+
+	FILE *out = open_memstream(&job->output, &job->output_len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream for %s", job->path);
+	}
+	struct creole_options options = {
+		.cache = p->blocks,
+		.threads = (p->options.split_size > 0) ? p->options.jobs : 1,
+		.split_size = p->options.split_size,
+	};
+	FILE *links = NULL;
+	if (p->options.links) {
+		links = open_memstream(&job->links, &job->links_len);
+		if (links == NULL) {
+			die_errno("failed to open memory stream for %s", job->path);
+		}
+		options.link = collect_link;
+		options.arg = links;
+	}
+	render_creole_ext(out, source, source_len, &options);
+	if (links != NULL && fclose(links) == EOF) {
+		die_errno("failed to collect links of %s", job->path);
+	}
+	if (fclose(out) == EOF) {
+		die_errno("failed to render %s", job->path);
+	}
+
+	// Compressing here rather than in the writer spreads the work across
+	// the render workers. Like rendering, it happens once per blob.
+	if (p->options.gzip) {
+		compress_output(job, p->options.gzip_level);
+	}
+
+	if (p->options.search != NULL) {
+		job->terms_len = search_terms(job->output, job->output_len, &job->terms);
+	}
+
+	if (p->options.manifest != NULL) {
+		hash_output(&job->output_hash, job->output, job->output_len);
+		if (job->compressed != NULL) {
+			hash_output(&job->compressed_hash, job->compressed, job->compressed_len);
+		}
+	}
+
+	// The source isn't needed anymore, so don't hold on to it while
+	// waiting for the writer.
+	git_blob_free(job->blob);
+	job->blob = NULL;
+}
+
+static void process_diff_file(const struct pipeline *p, struct job *job) {
+	FILE *out = open_memstream(&job->output, &job->output_len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream for %s", job->path);
+	}
+	const char *old = "";
+	size_t old_len = 0;
+	if (job->old_blob != NULL) {
+		old = git_blob_rawcontent(job->old_blob);
+		old_len = git_blob_rawsize(job->old_blob);
+	}
+	render_diff(out, old, old_len, git_blob_rawcontent(job->blob), git_blob_rawsize(job->blob));
+	if (fclose(out) == EOF) {
+		die_errno("failed to render %s", job->path);
+	}
+
+	if (p->options.manifest != NULL) {
+		hash_output(&job->output_hash, job->output, job->output_len);
+	}
+
+	git_blob_free(job->blob);
+	git_blob_free(job->old_blob);
+	job->blob = NULL;
+	job->old_blob = NULL;
+}
+
+// How much work rendering `job` is, roughly.
+static uint64_t job_cost(const struct job *job) {
+	uint64_t cost = (uint64_t)git_blob_rawsize(job->blob);
+	if (job->old_blob != NULL) {
+		cost += (uint64_t)git_blob_rawsize(job->old_blob);
+	}
+	return cost;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static void *render_worker(void *arg) {
+	struct worker *worker = arg;
+	struct pipeline *p = worker->pipeline;
+	struct job *job;
+	while ((job = pqueue_pop(p->render_queue)) != NULL) {
+		uint64_t cost = job_cost(job);
+		double start = now();
+		if (job->kind == JOB_DIFF) {
+			process_diff_file(p, job);
+		} else {
+			process_markup_file(p, job);
+		}
+		double end = now();
+
+		if (worker->rendered == 0) {
+			worker->first_start = start;
+		}
+		worker->last_end = end;
+		worker->rendered += 1;
+		worker->bytes += cost;
+		worker->busy += end - start;
+		if (end - start > worker->slowest || worker->slowest_path == NULL) {
+			free(worker->slowest_path);
+			worker->slowest_path = strdup(job->path);
+			worker->slowest = end - start;
+		}
+
+		queue_push(p->write_queue, job);
+	}
+	return NULL;
+}
+
+static void write_file(const char *path, const char *content, size_t content_len) {
+	FILE *out = fopen(path, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", path);
+	}
+	if (fwrite(content, 1, content_len, out) < content_len) {
+		die_errno("failed to write content to %s", path);
+	}
+	if (fclose(out) == EOF) {
+		die_errno("failed to close %s", path);
+	}
+}
+
+// Like link(2) except it replaces `new_path` if it already exists, as is the
+// case when rendering into an existing output directory.
+static void xlink(const char *old_path, const char *new_path) {
+	if (link(old_path, new_path) < 0) {
+		if (errno == EEXIST && unlink(new_path) == 0 && link(old_path, new_path) == 0) {
+			return;
+		}
+		die_errno("failed to link '%s' => '%s'", new_path, old_path);
+	}
+}
+
+// Returns the record of `graph`, creating it if needed.
+static struct open_graph *find_graph(struct pipeline *p, struct link_graph *graph) {
+	for (struct open_graph *g = p->graphs; g != NULL; g = g->next) {
+		if (g->graph == graph) {
+			return g;
+		}
+	}
+	struct open_graph *g = calloc(1, sizeof(*g));
+	if (g == NULL) {
+		die("failed to allocate link graph record");
+	}
+	g->graph = graph;
+	g->expected = SIZE_MAX;
+	g->next = p->graphs;
+	p->graphs = g;
+	return g;
+}
+
+// Write the graph if all of its files have been added.
+static void maybe_write_graph(struct pipeline *p, struct open_graph *g) {
+	if (g->added != g->expected) {
+		return;
+	}
+	for (struct open_graph **it = &p->graphs; *it != NULL; it = &(*it)->next) {
+		if (*it == g) {
+			*it = g->next;
+			break;
+		}
+	}
+	link_graph_write(g->graph);
+	free(g);
+}
+
+// Add the file of `job` to its link graph, if any.
+static void add_to_graph(struct pipeline *p, const struct output *output, const struct job *job) {
+	if (job->graph == NULL) {
+		return;
+	}
+	struct open_graph *g = find_graph(p, job->graph);
+	bool is_page = job->kind == JOB_MARKUP;
+	link_graph_add(g->graph, job->path, is_page, is_page ? output->links : NULL, is_page ? output->links_len : 0);
+	g->added += 1;
+	maybe_write_graph(p, g);
+}
+
+static void process_link(struct pipeline *p, const struct output *output, struct job *job) {
+	printf("Linking: %s\n", job->path);
+	bool gzip = p->options.gzip && job->kind == JOB_MARKUP;
+	char *job_gzip_path = gzip ? gzip_path(job->path) : NULL;
+	if (p->options.bundle != NULL) {
+		bundle_add(p->options.bundle, job->path, &output->entry);
+		if (gzip) {
+			bundle_add(p->options.bundle, job_gzip_path, &output->gzip_entry);
+		}
+	} else {
+		xlink(output->path, job->path);
+		if (gzip) {
+			char *output_gzip_path = gzip_path(output->path);
+			xlink(output_gzip_path, job_gzip_path);
+			free(output_gzip_path);
+		}
+	}
+	if (p->options.manifest != NULL) {
+		manifest_add(p->options.manifest, job->path, &job->oid, &output->hash, output->size);
+		if (gzip) {
+			manifest_add(p->options.manifest, job_gzip_path, &job->oid, &output->gzip_hash, output->gzip_size);
+		}
+	}
+	free(job_gzip_path);
+	add_to_graph(p, output, job);
+	finish_job(p, job);
+}
+
+// Add content to the bundle as `path`, unless an earlier run already added
+// the same content.
+static void bundle_content(struct pipeline *p, struct bundle_entry *entry, const git_oid *oid, unsigned kind, const char *path, const char *content, size_t content_len) {
+	struct bundle *b = p->options.bundle;
+	if (!bundle_find_content(b, oid, kind, entry)) {
+		bundle_append(b, oid, kind, content, content_len, entry);
+	}
+	bundle_add(b, path, entry);
+}
+
+static void handle_write(struct pipeline *p, struct job *job) {
+	if (job->graph_end) {
+		struct open_graph *g = find_graph(p, job->graph);
+		g->expected = job->graph_files;
+		maybe_write_graph(p, g);
+		finish_job(p, job);
+		return;
+	}
+
+	void **slot = oidmap_put(&p->outputs[job->kind], &job->oid, NULL);
+	if (*slot == NULL) {
+		struct output *output = calloc(1, sizeof(*output));
+		if (output == NULL) {
+			die("failed to allocate output record");
+		}
+		*slot = output;
+	}
+	struct output *output = *slot;
+
+	if (job->output == NULL && job->blob == NULL) {
+		// This is a link job. The original may still be in the render stage.
+		if (output->written) {
+			process_link(p, output, job);
+		} else {
+			job->next = output->pending;
+			output->pending = job;
+		}
+		return;
+	}
+
+	const char *content;
+	size_t content_len;
+	if (job->kind == JOB_MARKUP || job->kind == JOB_DIFF) {
+		printf("Generating: %s\n", job->path);
+		content = job->output;
+		content_len = job->output_len;
+		git_oid_cpy(&output->hash, &job->output_hash);
+	} else {
+		printf("Copying: %s\n", job->path);
+		content = git_blob_rawcontent(job->blob);
+		content_len = git_blob_rawsize(job->blob);
+		// A copy is the blob itself, so it hashes to the blob's id.
+		git_oid_cpy(&output->hash, &job->oid);
+	}
+	output->size = content_len;
+	if (p->options.bundle != NULL) {
+		bundle_content(p, &output->entry, &job->oid, job->kind, job->path, content, content_len);
+	} else {
+		write_file(job->path, content, content_len);
+	}
+	if (job->compressed != NULL) {
+		char *path = gzip_path(job->path);
+		if (p->options.bundle != NULL) {
+			bundle_content(p, &output->gzip_entry, &job->oid, OUTPUT_MARKUP_GZIP, path, job->compressed, job->compressed_len);
+		} else {
+			write_file(path, job->compressed, job->compressed_len);
+		}
+		git_oid_cpy(&output->gzip_hash, &job->compressed_hash);
+		output->gzip_size = job->compressed_len;
+		if (p->options.manifest != NULL) {
+			manifest_add(p->options.manifest, path, &job->oid, &output->gzip_hash, output->gzip_size);
+		}
+		free(path);
+	}
+	if (p->options.manifest != NULL) {
+		manifest_add(p->options.manifest, job->path, &job->oid, &output->hash, output->size);
+	}
+	if (job->terms != NULL) {
+		search_add(p->options.search, &job->oid, job->terms, job->terms_len);
+		job->terms = NULL;
+	}
+	if (job->links != NULL) {
+		output->links = job->links;
+		output->links_len = job->links_len;
+		job->links = NULL;
+	}
+
+	// Keep the path around so later jobs can link to it.
+	output->path = job->path;
+	output->written = true;
+	add_to_graph(p, output, job);
+	job->path = NULL;
+	finish_job(p, job);
+
+	while (output->pending != NULL) {
+		struct job *pending = output->pending;
+		output->pending = pending->next;
+		process_link(p, output, pending);
+	}
+}
+
+static void *write_worker(void *arg) {
+	struct pipeline *p = arg;
+	struct job *job;
+	while ((job = queue_pop(p->write_queue)) != NULL) {
+		handle_write(p, job);
+	}
+	return NULL;
+}
+
+struct pipeline *pipeline_start(const struct pipeline_options *options) {
+	struct pipeline *p = calloc(1, sizeof(*p));
+	if (p == NULL) {
+		die("failed to allocate pipeline");
+	}
+	p->options = *options;
+	if (p->options.jobs == 0) {
+		p->options.jobs = 1;
+	}
+
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->idle, NULL);
+
+	if (p->options.block_cache_size > 0) {
+		p->blocks = block_cache_create(p->options.block_cache_size);
+		if (p->blocks == NULL) {
+			die("failed to allocate block cache");
+		}
+	}
+
+	p->render_queue = pqueue_create(p->options.queue_depth);
+	p->write_queue = queue_create(p->options.queue_depth);
+
+	p->render_workers = calloc(p->options.jobs, sizeof(*p->render_workers));
+	if (p->render_workers == NULL) {
+		die("failed to allocate %u render threads", p->options.jobs);
+	}
+	for (unsigned i = 0; i < p->options.jobs; ++i) {
+		struct worker *worker = &p->render_workers[i];
+		worker->pipeline = p;
+		if ((errno = pthread_create(&worker->thread, NULL, render_worker, worker)) != 0) {
+			die_errno("failed to start render thread");
+		}
+	}
+	if ((errno = pthread_create(&p->write_thread, NULL, write_worker, p)) != 0) {
+		die_errno("failed to start write thread");
+	}
+
+	return p;
+}
+
+void pipeline_submit(struct pipeline *p, struct job *job) {
+	pthread_mutex_lock(&p->lock);
+	p->outstanding += 1;
+	pthread_mutex_unlock(&p->lock);
+
+	// Only markup and diffs need to pass through the render stage.
+	if (job->kind != JOB_COPY && job->blob != NULL) {
+		pqueue_push(p->render_queue, job, job_cost(job));
+	} else {
+		queue_push(p->write_queue, job);
+	}
+}
+
+void pipeline_wait(struct pipeline *p) {
+	pthread_mutex_lock(&p->lock);
+	while (p->outstanding > 0) {
+		pthread_cond_wait(&p->idle, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+void pipeline_finish(struct pipeline *p) {
+	// Each render worker exits when it sees a NULL job. Only once they are
+	// all gone can we be sure nothing more will be handed to the writer.
+	for (unsigned i = 0; i < p->options.jobs; ++i) {
+		pqueue_push(p->render_queue, NULL, 0);
+	}
+	for (unsigned i = 0; i < p->options.jobs; ++i) {
+		pthread_join(p->render_workers[i].thread, NULL);
+	}
+	queue_push(p->write_queue, NULL);
+	pthread_join(p->write_thread, NULL);
+
+	struct pipeline_stats stats = {0};
+	double first_start = 0, last_end = 0;
+	for (unsigned i = 0; i < p->options.jobs; ++i) {
+		struct worker *worker = &p->render_workers[i];
+		if (worker->rendered == 0) {
+			continue;
+		}
+		if (stats.rendered == 0 || worker->first_start < first_start) {
+			first_start = worker->first_start;
+		}
+		if (stats.rendered == 0 || worker->last_end > last_end) {
+			last_end = worker->last_end;
+		}
+		stats.rendered += worker->rendered;
+		stats.bytes += worker->bytes;
+		stats.busy += worker->busy;
+		if (stats.slowest_path == NULL || worker->slowest > stats.slowest) {
+			free(stats.slowest_path);
+			stats.slowest_path = worker->slowest_path;
+			stats.slowest = worker->slowest;
+		} else {
+			free(worker->slowest_path);
+		}
+	}
+	stats.elapsed = last_end - first_start;
+	if (p->options.stats != NULL) {
+		*p->options.stats = stats;
+	} else {
+		free(stats.slowest_path);
+	}
+
+	for (unsigned k = 0; k < JOB_KIND_COUNT; ++k) {
+		struct oidmap *outputs = &p->outputs[k];
+		for (size_t i = 0; i < outputs->capacity; ++i) {
+			if (outputs->entries[i].used) {
+				struct output *output = outputs->entries[i].value;
+				free(output->links);
+				free(output->path);
+				free(output);
+			}
+		}
+		oidmap_destroy(outputs);
+	}
+
+	if (p->blocks != NULL) {
+		block_cache_destroy(p->blocks);
+	}
+	pqueue_destroy(p->render_queue);
+	queue_destroy(p->write_queue);
+	pthread_mutex_destroy(&p->lock);
+	pthread_cond_destroy(&p->idle);
+	free(p->render_workers);
+	free(p);
+}
@@ -0,0 +1,123 @@
+#include "pqueue.h"
+
+#include "die.h"            // die
+#include <assert.h>         // assert
+#include <pthread.h>        // pthread_*
+#include <stdbool.h>        // bool
+#include <stdlib.h>         // malloc, free
+
+struct entry {
+	void *item;
+	uint64_t priority;
+	uint64_t sequence; // Breaks ties in favor of older items.
+};
+
+// A binary max-heap behind a single lock. Unlike the queue between the render
+// workers and the writer, the heap has to be reordered on every push and pop,
+// so there is no lock-free fast path; jobs are big enough for that not to
+// matter.
+struct pqueue {
+	struct entry *heap;
+	size_t count;
+	size_t capacity;
+	uint64_t next_sequence;
+
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+};
+
+struct pqueue *pqueue_create(size_t capacity) {
+	assert(capacity > 0);
+
+	struct pqueue *q = malloc(sizeof(*q));
+	if (q == NULL) {
+		die("failed to allocate priority queue");
+	}
+	q->heap = malloc(capacity * sizeof(*q->heap));
+	if (q->heap == NULL) {
+		die("failed to allocate priority queue of %zu items", capacity);
+	}
+	q->count = 0;
+	q->capacity = capacity;
+	q->next_sequence = 0;
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+
+	return q;
+}
+
+static bool before(const struct entry *a, const struct entry *b) {
+	if ((a->item == NULL) != (b->item == NULL)) {
+		return b->item == NULL;
+	}
+	if (a->priority != b->priority) {
+		return a->priority > b->priority;
+	}
+	return a->sequence < b->sequence;
+}
+
+static void swap(struct entry *a, struct entry *b) {
+	struct entry t = *a;
+	*a = *b;
+	*b = t;
+}
+
+void pqueue_push(struct pqueue *q, void *item, uint64_t priority) {
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->capacity) {
+		pthread_cond_wait(&q->not_full, &q->lock);
+	}
+
+	// Sift up.
+	size_t i = q->count++;
+	q->heap[i] = (struct entry){ .item = item, .priority = priority, .sequence = q->next_sequence++ };
+	while (i > 0 && before(&q->heap[i], &q->heap[(i - 1) / 2])) {
+		swap(&q->heap[i], &q->heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+
+	pthread_cond_signal(&q->not_empty);
+	pthread_mutex_unlock(&q->lock);
+}
+
+void *pqueue_pop(struct pqueue *q) {
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0) {
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	}
+	void *item = q->heap[0].item;
+
+	// Sift down.
+	q->heap[0] = q->heap[--q->count];
+	size_t i = 0;
+	while (true) {
+		size_t first = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < q->count && before(&q->heap[left], &q->heap[first])) {
+			first = left;
+		}
+		if (right < q->count && before(&q->heap[right], &q->heap[first])) {
+			first = right;
+		}
+		if (first == i) {
+			break;
+		}
+		swap(&q->heap[i], &q->heap[first]);
+		i = first;
+	}
+
+	pthread_cond_signal(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+	return item;
+}
+
+void pqueue_destroy(struct pqueue *q) {
+	assert(q != NULL);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	free(q->heap);
+	free(q);
+}
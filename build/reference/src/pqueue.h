@@ -0,0 +1,31 @@
+#ifndef PQUEUE_H
+#define PQUEUE_H
+
+//
+// This module defines a bounded, blocking priority queue of pointers. It is
+// used to hand render jobs to the workers biggest first.
+//
+// Items of equal priority come out in the order they were pushed. NULL items
+// are used to stop consumers; they have the lowest priority of all, so they
+// only come out once the queue is otherwise empty.
+//
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+struct pqueue;
+
+// Create a queue which can hold `capacity` items.
+// Panics on failure to allocate.
+struct pqueue *pqueue_create(size_t capacity);
+
+// Push an item, blocking while the queue is full.
+void pqueue_push(struct pqueue *q, void *item, uint64_t priority);
+
+// Pop the item with the highest priority, blocking while the queue is empty.
+void *pqueue_pop(struct pqueue *q);
+
+// Free the queue. It is an error to destroy a queue which is still in use.
+void pqueue_destroy(struct pqueue *q);
+
+#endif
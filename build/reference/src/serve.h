@@ -0,0 +1,50 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+//
+// This module defines a small HTTP/1.1 server which renders pages straight
+// from the git repository on request, instead of rendering every commit ahead
+// of time.
+//
+// A request for /<revision>/<path> is resolved like this:
+//
+// - <revision> is anything git understands, or "latest".
+// - If <path> ends in ".html" and the tree has a corresponding ".txt" file,
+//   that file is rendered, just like in the static output.
+// - Otherwise the blob at <path> is served as-is.
+//
+// Rendered pages are cached by blob id, and every response carries an ETag
+// derived from the blob id, so clients can revalidate without any rendering.
+//
+// Alternatively, pages are served from a bundle (see bundle.h) which was
+// rendered ahead of time. Then <revision> must be a full commit id or
+// "latest", and the server sees the bundle as it was when it was opened.
+//
+
+#include "bundle.h"       // struct bundle_reader
+#include <git2.h>         // git_repository
+#include <stddef.h>       // size_t
+#include <stdnoreturn.h>  // noreturn
+
+struct serve_options {
+	// Where to listen.
+	const char *address;
+	const char *port;
+
+	// The revision served as /latest/.
+	const char *latest;
+
+	// Maximum number of bytes of rendered pages to keep in memory.
+	size_t cache_size;
+};
+
+// Serve requests forever.
+// Panics if the server cannot be started.
+noreturn void serve(struct git_repository *repo, const struct serve_options *options);
+
+// Serve requests from `bundle` forever. Only the address and port of
+// `options` are used.
+// Panics if the server cannot be started.
+noreturn void serve_bundle(struct bundle_reader *bundle, const struct serve_options *options);
+
+#endif
@@ -0,0 +1,1256 @@
+#include "arena.h"
+#include "bundle.h"
+#include "die.h"
+#include "history.h"
+#include "linkgraph.h"
+#include "manifest.h"
+#include "oidmap.h"
+#include "pipeline.h"
+#include "search.h"
+#include "serve.h"
+#include "strutil.h"
+#include "treediff.h"
+
+// #include <assert.h>
+#include <errno.h>     // errno, EEXIST
+#include <fcntl.h>     // open, O_RDONLY
+#include <git2.h>      // git_*
+#include <getopt.h>    // getopt_long
+#include <limits.h>    // ULONG_MAX
+#include <stdnoreturn.h> // noreturn
+#include <unistd.h>    // symlink, sysconf, read, close
+#include <stdbool.h>   // false
+#include <stdint.h>    // uintptr_t, SIZE_MAX
+#include <stdio.h>
+#include <stdlib.h>    // EXIT_SUCCESS, strtoul
+#include <string.h>    // strdup, strstr, strspn
+#include <sys/stat.h>  // mkdir, mkfifo
+#include <sys/types.h> // mode_t
+#include <time.h>      // struct tm, timegm, gmtime_r, strftime
+
+// The revision rendered when none are given on the command line.
+#define REF "refs/heads/master"
+
+// How many jobs may be waiting between two stages of the pipeline.
+#define QUEUE_DEPTH 64
+
+// Default zlib compression level for --gzip.
+#define GZIP_LEVEL 9
+
+// Default number of bytes of rendered blocks kept in memory while rendering.
+#define BLOCK_CACHE_SIZE (32 << 20)
+
+// Default size above which a page is rendered in pieces by several threads.
+#define SPLIT_SIZE (4 << 20)
+
+// Default number of bytes of rendered pages kept in memory by the server.
+#define SERVE_CACHE_SIZE (64 << 20)
+
+void xmkdir(const char *path, mode_t mode, bool exist_ok) {
+	if (mkdir(path, mode) < 0) {
+		if (exist_ok && errno == EEXIST) {
+			return;
+		} else {
+			die_errno("failed to mkdir %s", path);
+		}
+	}
+}
+
+void xsymlink(const char *source_path, const char *target_path)
+{
+	if (symlink(source_path, target_path) < 0) {
+		die_errno("failed to link '%s' => '%s'", target_path, source_path);
+	}
+}
+
+void process_dir(const char *path) {
+	// The directory may be left over from an earlier run, e.g. when the
+	// daemon is restarted.
+	xmkdir(path, 0755, true);
+}
+
+// These bits are remembered for every blob seen by the walk stage.
+#define SEEN_BINARY  1 // The blob is binary, so it is never rendered.
+#define SEEN_MARKUP  2 // A job rendering the blob has been submitted.
+#define SEEN_COPY    4 // A job copying the blob has been submitted.
+
+// State of the walk stage, which feeds the rendering pipeline.
+struct walk {
+	struct git_repository *repo;
+	struct pipeline *pipeline;
+	const char *out_path;
+
+	// If not NULL, output goes here instead of into `out_path`.
+	struct bundle *bundle;
+
+	// If not NULL, updated every time a commit is published.
+	struct manifest *manifest;
+	struct search_index *search;
+
+	// If true, a link graph is written for every commit. `graph` is the
+	// graph of the commit being walked, and `graph_files` the number of
+	// jobs submitted for it.
+	bool links;
+	struct link_graph *graph;
+	size_t graph_files;
+
+	// If not NULL, the files changed by every walked commit are recorded
+	// here, and the index is written when a commit is published.
+	struct history *history;
+
+	// If true, the changes to every page made by a commit are rendered
+	// next to the page.
+	bool diff;
+
+	// Maps the ids of diffs (see diff_id()) to SEEN_* flags.
+	struct oidmap diffs_seen;
+
+	// Which commits to render. See usage().
+	const char **revisions;
+	size_t revision_count;
+	unsigned long max_commits;
+	git_time_t since;
+	bool skip_unchanged;
+
+	// The newest commit of each revision as of the last walk. These are
+	// hidden from the next walk, so only new commits are rendered.
+	git_oid *tips;
+	bool *have_tips;
+
+	// Maps blob ids to SEEN_* flags.
+	struct oidmap seen;
+};
+
+char *xstrdup(const char *s) {
+	char *copy = strdup(s);
+	if (copy == NULL) {
+		die("failed to copy string");
+	}
+	return copy;
+}
+
+// Hand `job` to the pipeline, adding it to the link graph of the commit.
+void submit_job(struct walk *w, struct job *job) {
+	if (w->graph != NULL) {
+		job->graph = w->graph;
+		w->graph_files += 1;
+	}
+	pipeline_submit(w->pipeline, job);
+}
+
+void process_blob(struct arena *a, struct walk *w, const git_oid *oid, const char *path) {
+	// Only load blobs the first time we see them. After that, we already
+	// know everything we need and the output can be linked instead.
+	bool inserted;
+	void **slot = oidmap_put(&w->seen, oid, &inserted);
+	uintptr_t flags = (uintptr_t)*slot;
+	struct git_blob *blob = NULL;
+	if (inserted) {
+		if (git_blob_lookup(&blob, w->repo, oid) < 0) {
+			die_git("get source for blob %s", git_oid_tostr_s(oid));
+		}
+		if (git_blob_is_binary(blob)) {
+			flags |= SEEN_BINARY;
+		}
+	}
+
+	struct job *job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		die("failed to allocate job");
+	}
+	git_oid_cpy(&job->oid, oid);
+	uintptr_t submitted;
+	if (endswith(path, ".txt") && !(flags & SEEN_BINARY)) {
+		job->kind = JOB_MARKUP;
+		job->path = xstrdup(replace_suffix(a, path, ".txt", ".html"));
+		submitted = SEEN_MARKUP;
+	} else {
+		job->kind = JOB_COPY;
+		job->path = xstrdup(path);
+		submitted = SEEN_COPY;
+	}
+
+	if (!(flags & submitted)) {
+		if (blob == NULL && git_blob_lookup(&blob, w->repo, oid) < 0) {
+			die_git("get source for blob %s", git_oid_tostr_s(oid));
+		}
+		job->blob = blob;
+		flags |= submitted;
+	}
+	*slot = (void *)flags;
+
+	submit_job(w, job);
+}
+
+// Identify the diff from `old` (which may be NULL) to `new` by hashing the two
+// ids together.
+void diff_id(git_oid *id, const git_oid *old, const git_oid *new) {
+	unsigned char ids[2 * GIT_OID_RAWSZ] = {0};
+	if (old != NULL) {
+		memcpy(ids, old->id, GIT_OID_RAWSZ);
+	}
+	memcpy(ids + GIT_OID_RAWSZ, new->id, GIT_OID_RAWSZ);
+	if (git_odb_hash(id, ids, sizeof(ids), GIT_OBJECT_BLOB) < 0) {
+		die_git("hash diff");
+	}
+}
+
+// State of render_commit() while it renders the changes of a commit.
+struct diff_walk {
+	struct arena *a;
+	struct walk *w;
+	const char *prefix;
+};
+
+// Called for every file changed by the commit. Pages get a diff next to
+// them, e.g. "page.diff.html" for "page.txt".
+void process_change(const char *path, const git_oid *old, const git_oid *new, void *arg) {
+	struct diff_walk *dw = arg;
+	struct walk *w = dw->w;
+	if (new == NULL || !endswith(path, ".txt")) {
+		return;
+	}
+
+	git_oid id;
+	diff_id(&id, old, new);
+	bool inserted;
+	void **slot = oidmap_put(&w->diffs_seen, &id, &inserted);
+	uintptr_t flags = (uintptr_t)*slot;
+	if (flags & SEEN_BINARY) {
+		return;
+	}
+
+	struct job *job = calloc(1, sizeof(*job));
+	if (job == NULL) {
+		die("failed to allocate job");
+	}
+	job->kind = JOB_DIFF;
+	git_oid_cpy(&job->oid, &id);
+
+	// As with pages, each diff is only rendered once. Later jobs are
+	// linked to the first.
+	if (inserted) {
+		if (git_blob_lookup(&job->blob, w->repo, new) < 0 ||
+		    (old != NULL && git_blob_lookup(&job->old_blob, w->repo, old) < 0)) {
+			die_git("get source for diff of %s", path);
+		}
+		if (git_blob_is_binary(job->blob) || (job->old_blob != NULL && git_blob_is_binary(job->old_blob))) {
+			*slot = (void *)SEEN_BINARY;
+			git_blob_free(job->blob);
+			git_blob_free(job->old_blob);
+			free(job);
+			return;
+		}
+		*slot = (void *)SEEN_MARKUP;
+	}
+
+	struct arena snapshot = *dw->a;
+	job->path = xstrdup(joinpath(dw->a, dw->prefix, replace_suffix(dw->a, path, ".txt", ".diff.html")));
+	*dw->a = snapshot;
+
+	submit_job(w, job);
+}
+
+void list_tree(struct arena *a, struct walk *w, struct git_tree *tree, const char *prefix) {
+	// Grab a snapshot of the arena.
+	// All memory allocated within the arena in this subcalltree will be freed.
+	// This is effectively the same as allocating a new arena for each call to list_tree.
+	struct arena snapshot = *a;
+
+	size_t tree_count = git_tree_entrycount(tree);
+	for (size_t i = 0; i < tree_count; ++i) {
+		// Read the entry.
+		const struct git_tree_entry *entry;
+		if ((entry = git_tree_entry_byindex(tree, i)) == NULL) {
+			die("read tree item");
+		}
+
+		// Construct path to entry.
+		const char *entry_out_path = joinpath(a, prefix, git_tree_entry_name(entry));
+
+		const git_oid *oid = git_tree_entry_id(entry);
+		switch (git_tree_entry_type(entry)) {
+			case GIT_OBJECT_BLOB: {
+				process_blob(a, w, oid, entry_out_path);
+			} break;
+			case GIT_OBJECT_TREE: {
+				struct git_tree *subtree;
+				if (git_tree_lookup(&subtree, w->repo, oid) < 0) {
+					die_git("read tree %s", git_oid_tostr_s(oid));
+				}
+				// The directory must exist before any of its files reach the writer.
+				if (w->bundle == NULL) {
+					process_dir(entry_out_path);
+				}
+				list_tree(a, w, subtree, entry_out_path);
+				git_tree_free(subtree);
+			} break;
+			default: {
+				// Ignore whatever weird thing this is (e.g. submodules).
+			} break;
+		}
+	}
+
+	// Restore snapshot.
+	*a = snapshot;
+}
+
+// Resolve `spec` (a ref name, sha or anything else git understands) to a commit.
+void resolve_commit(git_oid *out, git_repository *repo, const char *spec) {
+	git_object *obj, *commit;
+	if (git_revparse_single(&obj, repo, spec) < 0) {
+		die_git("resolve %s", spec);
+	}
+	if (git_object_peel(&commit, obj, GIT_OBJECT_COMMIT) < 0) {
+		die_git("resolve %s to a commit", spec);
+	}
+	git_oid_cpy(out, git_object_id(commit));
+	git_object_free(commit);
+	git_object_free(obj);
+}
+
+// Returns true if `spec` is git's way of saying "no commit", as in the old
+// revision of a newly created branch.
+bool is_null_spec(const char *spec, size_t len) {
+	return len == GIT_OID_HEXSZ && strspn(spec, "0") == len;
+}
+
+// Add the commits described by `spec` to the walk. This is either a single
+// revision, meaning all of its history, or a range "old..new", meaning the
+// commits reachable from new but not old. The latter is what a post-receive
+// hook gets on stdin.
+//
+// Returns false if `spec` names no commits, in which case `tip` is untouched.
+// Otherwise `tip` is set to the newest commit in `spec`.
+bool push_revision(git_revwalk *walker, git_repository *repo, const char *spec, git_oid *tip) {
+	const char *dots = strstr(spec, "..");
+	const char *new_spec = (dots == NULL) ? spec : dots + 2;
+	if (is_null_spec(new_spec, strlen(new_spec))) {
+		// The branch was deleted. There is nothing to render.
+		return false;
+	}
+
+	if (dots != NULL && !is_null_spec(spec, dots - spec)) {
+		char *old_spec = strndup(spec, dots - spec);
+		if (old_spec == NULL) {
+			die("failed to copy string");
+		}
+		git_oid old;
+		resolve_commit(&old, repo, old_spec);
+		if (git_revwalk_hide(walker, &old) < 0) {
+			die_git("hide %s", old_spec);
+		}
+		free(old_spec);
+	}
+
+	resolve_commit(tip, repo, new_spec);
+	if (git_revwalk_push(walker, tip) < 0) {
+		die_git("push %s", new_spec);
+	}
+	return true;
+}
+
+// Returns true if `commit` has the same tree as its first parent, so its
+// output would be identical to the parent's. In that case `parent` is set.
+bool same_tree_as_parent(git_commit *commit, git_oid *parent) {
+	if (git_commit_parentcount(commit) == 0) {
+		return false;
+	}
+
+	git_commit *p;
+	if (git_commit_parent(&p, commit, 0) < 0) {
+		die_git("find parent of %s", git_oid_tostr_s(git_commit_id(commit)));
+	}
+	bool same = git_oid_equal(git_commit_tree_id(commit), git_commit_tree_id(p));
+	git_oid_cpy(parent, git_commit_id(p));
+	git_commit_free(p);
+	return same;
+}
+
+unsigned long parse_count(const char *arg, const char *what, unsigned long max) {
+	char *end;
+	errno = 0;
+	unsigned long n = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || errno != 0 || n == 0 || n > max) {
+		die("invalid %s: %s", what, arg);
+	}
+	return n;
+}
+
+// Parse a number of bytes, optionally suffixed by K, M or G.
+size_t parse_size(const char *arg, const char *what) {
+	char *end;
+	errno = 0;
+	unsigned long long n = strtoull(arg, &end, 10);
+	size_t unit = 1;
+	switch (*end) {
+		case 'K': unit = (size_t)1 << 10; end++; break;
+		case 'M': unit = (size_t)1 << 20; end++; break;
+		case 'G': unit = (size_t)1 << 30; end++; break;
+	}
+	if (*arg == '\0' || *end != '\0' || errno != 0 || n > SIZE_MAX / unit) {
+		die("invalid %s: %s", what, arg);
+	}
+	return (size_t)n * unit;
+}
+
+// Parse either a date "YYYY-MM-DD" (UTC) or seconds since the epoch.
+git_time_t parse_date(const char *arg) {
+	struct tm tm = {0};
+	int n = 0;
+	if (sscanf(arg, "%d-%d-%d%n", &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &n) == 3 && arg[n] == '\0') {
+		tm.tm_year -= 1900;
+		tm.tm_mon -= 1;
+		return timegm(&tm);
+	}
+
+	char *end;
+	long long seconds = strtoll(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0') {
+		die("invalid date: %s", arg);
+	}
+	return seconds;
+}
+
+// Make the symbolic link "latest" point at `commit`.
+//
+// The new link is created under a temporary name and renamed over the old
+// one, so readers always see either the old or the new commit.
+void publish_latest(struct arena *a, const char *out_path, const git_oid *commit) {
+	struct arena snapshot = *a;
+
+	const char *source = git_oid_tostr_s(commit);
+	const char *target = joinpath(a, out_path, "latest");
+	char *temp;
+	aprintf(a, &temp, "%s.%ld", target, (long)getpid());
+
+	unlink(temp); // Left behind by a crash, perhaps.
+	xsymlink(source, temp);
+	if (rename(temp, target) < 0) {
+		die_errno("failed to replace %s", target);
+	}
+
+	*a = snapshot;
+}
+
+// Make `commit` the one served as "latest", either in the bundle or in the
+// output directory.
+void publish(struct arena *a, struct walk *w, const git_oid *commit) {
+	if (w->bundle != NULL) {
+		bundle_set_latest(w->bundle, commit);
+		bundle_flush(w->bundle);
+	} else {
+		// Write the manifest and index first, so they are complete by
+		// the time anybody notices the new commit.
+		if (w->manifest != NULL) {
+			manifest_write(w->manifest);
+		}
+		if (w->search != NULL) {
+			search_flush(w->search);
+		}
+		if (w->history != NULL) {
+			history_write(w->history);
+		}
+		publish_latest(a, w->out_path, commit);
+	}
+}
+
+// Render a single commit. Returns false if the walk should stop here.
+bool render_commit(struct arena *a, struct walk *w, const git_oid *commit_oid) {
+	const char *commit_sha = git_oid_tostr_s(commit_oid);
+
+	git_commit *commit = NULL;
+	if (git_commit_lookup(&commit, w->repo, commit_oid) < 0) {
+		die_git("find commit %s", commit_sha);
+	}
+
+	// Since the walk is sorted by time, everything after this is older too.
+	if (w->since != 0 && git_commit_time(commit) < w->since) {
+		git_commit_free(commit);
+		return false;
+	}
+
+	// This is the walk history pages would need, so record the changes
+	// while we're at it.
+	if (w->history != NULL) {
+		history_add_commit(w->history, w->repo, commit);
+	}
+
+	// Commits which don't change anything (e.g. merges with nothing to
+	// resolve or empty commits) share their parent's output. Bundles have
+	// no symbolic links, but all of the content is shared anyway.
+	git_oid parent_oid;
+	if (w->skip_unchanged && w->bundle == NULL && same_tree_as_parent(commit, &parent_oid)) {
+		char parent_sha[GIT_OID_HEXSZ + 1];
+		git_oid_tostr(parent_sha, sizeof(parent_sha), &parent_oid);
+		const char *prefix = joinpath(a, w->out_path, commit_sha);
+		printf("Linking: %s\n", prefix);
+		if (symlink(parent_sha, prefix) < 0 && errno != EEXIST) {
+			die_errno("failed to link '%s' => '%s'", prefix, parent_sha);
+		}
+		if (w->links) {
+			const char *graph_path = joinpath(a, joinpath(a, w->out_path, "links"), commit_sha);
+			if (symlink(parent_sha, graph_path) < 0 && errno != EEXIST) {
+				die_errno("failed to link '%s' => '%s'", graph_path, parent_sha);
+			}
+		}
+		git_commit_free(commit);
+		return true;
+	}
+
+	struct git_tree *tree;
+	if (git_commit_tree(&tree, commit) < 0) {
+		die_git("get tree for commit %s", commit_sha);
+	}
+
+	const char *prefix;
+	if (w->bundle != NULL) {
+		prefix = commit_sha;
+	} else {
+		prefix = joinpath(a, w->out_path, commit_sha);
+		xmkdir(prefix, 0755, true);
+	}
+	if (w->links) {
+		w->graph = link_graph_create(prefix, joinpath(a, joinpath(a, w->out_path, "links"), commit_sha));
+		w->graph_files = 0;
+	}
+	list_tree(a, w, tree, prefix);
+	if (w->diff) {
+		struct diff_walk dw = { .a = a, .w = w, .prefix = prefix };
+		diff_commit(w->repo, commit, process_change, &dw);
+	}
+	if (w->graph != NULL) {
+		// The writer writes the graph once it has seen all of the files.
+		struct job *end = calloc(1, sizeof(*end));
+		if (end == NULL) {
+			die("failed to allocate job");
+		}
+		end->graph = w->graph;
+		end->graph_end = true;
+		end->graph_files = w->graph_files;
+		pipeline_submit(w->pipeline, end);
+		w->graph = NULL;
+	}
+
+	git_commit_free(commit);
+	git_tree_free(tree);
+	return true;
+}
+
+// Render every commit selected by the options in `w`, except those rendered by
+// an earlier call, and wait for the output to be written.
+//
+// Returns false if there is nothing to publish. Otherwise `latest` is set to
+// the newest commit of the first revision.
+bool render_revisions(struct arena *a, struct walk *w, git_oid *latest) {
+	// Create a revision walker to iterate the requested commits, newest first.
+	git_revwalk *walker = NULL;
+	if (git_revwalk_new(&walker, w->repo) < 0) {
+		die_git("create revision walker");
+	}
+	git_revwalk_sorting(walker, GIT_SORT_TIME);
+
+	bool have_latest = false;
+	for (size_t i = 0; i < w->revision_count; ++i) {
+		if (w->have_tips[i] && git_revwalk_hide(walker, &w->tips[i]) < 0) {
+			die_git("hide %s", git_oid_tostr_s(&w->tips[i]));
+		}
+	}
+	for (size_t i = 0; i < w->revision_count; ++i) {
+		git_oid tip;
+		if (!push_revision(walker, w->repo, w->revisions[i], &tip)) {
+			continue;
+		}
+		if (!have_latest) {
+			git_oid_cpy(latest, &tip);
+			have_latest = true;
+		}
+		git_oid_cpy(&w->tips[i], &tip);
+		w->have_tips[i] = true;
+	}
+
+	git_oid commit_oid;
+	unsigned long commit_count = 0;
+	while (git_revwalk_next(&commit_oid, walker) == 0) {
+		if (w->max_commits != 0 && commit_count++ >= w->max_commits) {
+			break;
+		}
+
+		bool more = render_commit(a, w, &commit_oid);
+		a->used = 0; // reset arena after each iteration
+		if (!more) {
+			break;
+		}
+	}
+	git_revwalk_free(walker);
+
+	// Wait for the remaining jobs to be written before publishing.
+	pipeline_wait(w->pipeline);
+
+	return have_latest;
+}
+
+// Keep the repository, caches and worker threads around, and render whatever
+// is new every time something is written to the FIFO at `fifo_path`. A
+// post-receive hook can simply do `echo >fifo`.
+noreturn void run_daemon(struct arena *a, struct walk *w, const char *fifo_path) {
+	if (mkfifo(fifo_path, 0600) < 0 && errno != EEXIST) {
+		die_errno("failed to create FIFO %s", fifo_path);
+	}
+
+	printf("Waiting for notifications on %s\n", fifo_path);
+	fflush(stdout);
+
+	while (true) {
+		// Opening blocks until somebody opens the other end for writing.
+		int fd = open(fifo_path, O_RDONLY);
+		if (fd < 0) {
+			die_errno("failed to open FIFO %s", fifo_path);
+		}
+
+		// Several notifications may arrive while we are rendering. Just
+		// drain them all; one walk picks up all of the new commits.
+		char buffer[512];
+		ssize_t nread;
+		while ((nread = read(fd, buffer, sizeof(buffer))) > 0 || (nread < 0 && errno == EINTR)) {
+			// Drain.
+		}
+		if (nread < 0) {
+			die_errno("failed to read FIFO %s", fifo_path);
+		}
+		close(fd);
+
+		git_oid latest;
+		if (render_revisions(a, w, &latest)) {
+			publish(a, w, &latest);
+		}
+		fflush(stdout);
+	}
+}
+
+// Initialize libgit and open the repository at `git_path`.
+struct git_repository *open_repository(const char *git_path) {
+        // Initialize libgit. Note that calling git_libgit2_shutdown is not
+        // necessary, as per this snippet from the documentation:
+        //
+        // > Usually you don’t need to call the shutdown function as the operating
+        // > system will take care of reclaiming resources, but if your
+        // > application uses libgit2 in some areas which are not usually active,
+        // > you can use
+	//
+	// That's good news!
+        if (git_libgit2_init() < 0) {
+		die_git("initialize libgit");
+	}
+
+	// Do not search outside the git repository. GIT_CONFIG_LEVEL_APP is the highest level currently.
+	// for (int i = 1; i <= GIT_CONFIG_LEVEL_APP; i++) {
+	// 	if (git_libgit2_opts(GIT_OPT_SET_SEARCH_PATH, i, "") < 0) {
+	// 		die_git("set search path");
+	// 	}
+	// }
+
+	// Don't require the repository to be owned by the current user.
+	git_libgit2_opts(GIT_OPT_SET_OWNER_VALIDATION, 0);
+
+	struct git_repository *repo;
+	if (git_repository_open_ext(&repo, git_path, GIT_REPOSITORY_OPEN_NO_SEARCH, NULL) < 0) {
+		die_git("open repository");
+	}
+	return repo;
+}
+
+// Report what the render workers did, and how well they kept each other
+// busy: with perfect parallelism, every worker renders from the first page
+// to the last.
+void print_stats(struct pipeline_stats *stats, unsigned jobs) {
+	double efficiency = 1;
+	if (stats->elapsed > 0) {
+		efficiency = stats->busy / (stats->elapsed * jobs);
+	}
+	printf("Rendered %zu files (%.1f MiB) in %.3fs on %u threads, %.3fs busy: %.0f%% parallel efficiency\n",
+	       stats->rendered, (double)stats->bytes / (1 << 20), stats->elapsed, jobs, stats->busy, efficiency * 100);
+	if (stats->slowest_path != NULL) {
+		printf("Slowest: %s (%.3fs)\n", stats->slowest_path, stats->slowest);
+	}
+	free(stats->slowest_path);
+}
+
+void usage(const char *argv0) {
+	die("Usage: %s [-j jobs] [-r revision]... [-n max-commits] [--since date] [--skip-unchanged] [--daemon fifo] [--bundle] [--gzip[=level]] [--manifest] [--search] [--links] [--history] [--diff] [--block-cache bytes] [--split-size bytes] [--stats] git-path out-path\n"
+	    "       %s serve [-a address] [-p port] [-r revision] [--cache-size bytes] git-path\n"
+	    "       %s serve [-a address] [-p port] --bundle bundle-path\n"
+	    "       %s search [-r revision] git-path out-path word...\n"
+	    "       %s links [-r commit] out-path [page]\n"
+	    "       %s history out-path path", argv0, argv0, argv0, argv0, argv0, argv0);
+}
+
+// Entry point of `simplewiki serve`.
+int main_serve(int argc, char *argv[], const char *argv0) {
+	struct serve_options options = {
+		.address = "127.0.0.1",
+		.port = "8080",
+		.latest = REF,
+		.cache_size = SERVE_CACHE_SIZE,
+	};
+
+	bool bundle = false;
+
+	enum {
+		OPT_CACHE_SIZE = 256,
+		OPT_BUNDLE,
+	};
+	static const struct option long_options[] = {
+		{ "address",    required_argument, NULL, 'a' },
+		{ "port",       required_argument, NULL, 'p' },
+		{ "ref",        required_argument, NULL, 'r' },
+		{ "cache-size", required_argument, NULL, OPT_CACHE_SIZE },
+		{ "bundle",     no_argument,       NULL, OPT_BUNDLE },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "a:p:r:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'a': {
+				options.address = optarg;
+			} break;
+			case 'p': {
+				options.port = optarg;
+			} break;
+			case 'r': {
+				options.latest = optarg;
+			} break;
+			case OPT_CACHE_SIZE: {
+				options.cache_size = parse_size(optarg, "cache size");
+			} break;
+			case OPT_BUNDLE: {
+				bundle = true;
+			} break;
+			default: {
+				usage(argv0);
+			} break;
+		}
+	}
+	if (argc - optind != 1) {
+		usage(argv0);
+	}
+
+	if (bundle) {
+		serve_bundle(bundle_reader_open(argv[optind]), &options);
+	}
+
+	struct git_repository *repo = open_repository(argv[optind]);
+	serve(repo, &options);
+}
+
+// A page of the commit being searched. Pages with the same content share a
+// blob, so they are chained.
+struct page {
+	char *path;
+	struct page *next;
+};
+
+// Remember the blob of every page in `tree`.
+void collect_pages(struct arena *a, struct git_repository *repo, struct git_tree *tree, const char *prefix, struct oidmap *pages) {
+	struct arena snapshot = *a;
+
+	size_t tree_count = git_tree_entrycount(tree);
+	for (size_t i = 0; i < tree_count; ++i) {
+		const struct git_tree_entry *entry = git_tree_entry_byindex(tree, i);
+		const char *path = joinpath(a, prefix, git_tree_entry_name(entry));
+		const git_oid *oid = git_tree_entry_id(entry);
+		switch (git_tree_entry_type(entry)) {
+			case GIT_OBJECT_BLOB: {
+				if (!endswith(path, ".txt")) {
+					break;
+				}
+				struct page *page = calloc(1, sizeof(*page));
+				if (page == NULL) {
+					die("failed to allocate page");
+				}
+				page->path = xstrdup(replace_suffix(a, path, ".txt", ".html"));
+				void **slot = oidmap_put(pages, oid, NULL);
+				page->next = *slot;
+				*slot = page;
+			} break;
+			case GIT_OBJECT_TREE: {
+				struct git_tree *subtree;
+				if (git_tree_lookup(&subtree, repo, oid) < 0) {
+					die_git("read tree %s", git_oid_tostr_s(oid));
+				}
+				collect_pages(a, repo, subtree, path, pages);
+				git_tree_free(subtree);
+			} break;
+			default: {
+			} break;
+		}
+	}
+
+	*a = snapshot;
+}
+
+struct search_results {
+	struct oidmap *pages;
+	char **paths;
+	size_t count;
+	size_t capacity;
+};
+
+void add_search_result(const git_oid *blob, void *arg) {
+	struct search_results *results = arg;
+	void **slot = oidmap_get(results->pages, blob);
+	if (slot == NULL) {
+		// The page is not in the searched commit.
+		return;
+	}
+	for (struct page *page = *slot; page != NULL; page = page->next) {
+		if (results->count == results->capacity) {
+			results->capacity = (results->capacity == 0) ? 64 : results->capacity * 2;
+			results->paths = realloc(results->paths, results->capacity * sizeof(*results->paths));
+			if (results->paths == NULL) {
+				die("failed to allocate search results");
+			}
+		}
+		results->paths[results->count++] = page->path;
+	}
+}
+
+int compare_strings(const void *a, const void *b) {
+	return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Entry point of `simplewiki search`.
+int main_search(int argc, char *argv[], const char *argv0) {
+	const char *revision = NULL;
+
+	static const struct option long_options[] = {
+		{ "ref", required_argument, NULL, 'r' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "r:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'r': {
+				revision = optarg;
+			} break;
+			default: {
+				usage(argv0);
+			} break;
+		}
+	}
+	if (argc - optind < 3) {
+		usage(argv0);
+	}
+	const char *out_path = argv[optind + 1];
+
+	struct arena a = arena_create(2048);
+	struct git_repository *repo = open_repository(argv[optind]);
+
+	// Search the published commit, unless told otherwise.
+	git_oid commit_oid;
+	char latest[GIT_OID_HEXSZ + 1];
+	ssize_t latest_len = readlink(joinpath(&a, out_path, "latest"), latest, GIT_OID_HEXSZ);
+	if (revision == NULL && latest_len == GIT_OID_HEXSZ) {
+		latest[GIT_OID_HEXSZ] = '\0';
+		revision = latest;
+	}
+	resolve_commit(&commit_oid, repo, (revision != NULL) ? revision : REF);
+
+	git_commit *commit;
+	struct git_tree *tree;
+	if (git_commit_lookup(&commit, repo, &commit_oid) < 0 || git_commit_tree(&tree, commit) < 0) {
+		die_git("get tree for commit %s", git_oid_tostr_s(&commit_oid));
+	}
+	struct oidmap pages = {0};
+	collect_pages(&a, repo, tree, git_oid_tostr_s(&commit_oid), &pages);
+
+	struct search_results results = { .pages = &pages };
+	search_find(joinpath(&a, out_path, "search"), argv + optind + 2, argc - optind - 2, add_search_result, &results);
+	if (results.count > 0) {
+		qsort(results.paths, results.count, sizeof(*results.paths), compare_strings);
+	}
+	for (size_t i = 0; i < results.count; ++i) {
+		puts(results.paths[i]);
+	}
+
+#ifndef NDEBUG
+	for (size_t i = 0; i < pages.capacity; ++i) {
+		if (pages.entries[i].used) {
+			for (struct page *page = pages.entries[i].value, *next; page != NULL; page = next) {
+				next = page->next;
+				free(page->path);
+				free(page);
+			}
+		}
+	}
+	oidmap_destroy(&pages);
+	free(results.paths);
+	git_tree_free(tree);
+	git_commit_free(commit);
+	arena_destroy(&a);
+#endif
+	return EXIT_SUCCESS;
+}
+
+// Print the `i`th string of the link graph on a line of its own.
+void put_link_string(const struct link_file *f, uint32_t i) {
+	size_t len;
+	const char *s = link_file_string(f, i, &len);
+	printf("%.*s\n", (int)len, s);
+}
+
+// Entry point of `simplewiki links`.
+int main_links(int argc, char *argv[], const char *argv0) {
+	const char *commit = NULL;
+
+	static const struct option long_options[] = {
+		{ "ref", required_argument, NULL, 'r' },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "r:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'r': {
+				commit = optarg;
+			} break;
+			default: {
+				usage(argv0);
+			} break;
+		}
+	}
+	if (argc - optind != 1 && argc - optind != 2) {
+		usage(argv0);
+	}
+	const char *out_path = argv[optind];
+	const char *page_path = (argc - optind == 2) ? argv[optind + 1] : NULL;
+
+	// Query the published commit, unless told otherwise.
+	struct arena a = arena_create(2048);
+	char latest[GIT_OID_HEXSZ + 1];
+	if (commit == NULL) {
+		if (readlink(joinpath(&a, out_path, "latest"), latest, GIT_OID_HEXSZ) != GIT_OID_HEXSZ) {
+			die_errno("failed to read %s", joinpath(&a, out_path, "latest"));
+		}
+		latest[GIT_OID_HEXSZ] = '\0';
+		commit = latest;
+	}
+	struct link_file *f = link_file_open(joinpath(&a, joinpath(&a, out_path, "links"), commit));
+
+	if (page_path == NULL) {
+		// List every broken link as "page target".
+		for (uint32_t page = 0; page < link_file_pages(f); ++page) {
+			for (uint32_t i = 0; i < link_file_count(f, LINKS_BROKEN, page); ++i) {
+				size_t len;
+				const char *s = link_file_string(f, page, &len);
+				printf("%.*s ", (int)len, s);
+				put_link_string(f, link_file_get(f, LINKS_BROKEN, page, i));
+			}
+		}
+	} else {
+		uint32_t page;
+		if (!link_file_find(f, page_path, &page)) {
+			die("no such page: %s", page_path);
+		}
+		static const char *const headings[] = {
+			[LINKS_OUT] = "Links:",
+			[LINKS_IN] = "Backlinks:",
+			[LINKS_BROKEN] = "Broken links:",
+		};
+		for (enum link_kind kind = LINKS_OUT; kind <= LINKS_BROKEN; ++kind) {
+			uint32_t count = link_file_count(f, kind, page);
+			if (count == 0) {
+				continue;
+			}
+			puts(headings[kind]);
+			for (uint32_t i = 0; i < count; ++i) {
+				putchar('\t');
+				put_link_string(f, link_file_get(f, kind, page, i));
+			}
+		}
+	}
+
+#ifndef NDEBUG
+	link_file_close(f);
+	arena_destroy(&a);
+#endif
+	return EXIT_SUCCESS;
+}
+
+// Entry point of `simplewiki history`.
+int main_history(int argc, char *argv[], const char *argv0) {
+	if (argc != 3) {
+		usage(argv0);
+	}
+	const char *out_path = argv[1];
+	const char *path = argv[2];
+
+	struct arena a = arena_create(2048);
+	struct history_file *f = history_file_open(joinpath(&a, out_path, "history"));
+
+	// Pages may be given by the name of the rendered file.
+	uint32_t first;
+	uint32_t count = history_file_find(f, path, &first);
+	if (count == 0 && endswith(path, ".html")) {
+		count = history_file_find(f, replace_suffix(&a, path, ".html", ".txt"), &first);
+	}
+	if (count == 0) {
+		die("no history for %s", path);
+	}
+
+	// Newest first, so the first line is the last modification.
+	for (uint32_t i = first; i < first + count; ++i) {
+		struct history_change change;
+		history_file_change(f, i, &change);
+
+		char commit[GIT_OID_HEXSZ + 1], blob[GIT_OID_HEXSZ + 1];
+		git_oid_tostr(commit, sizeof(commit), change.commit);
+		if (change.blob != NULL) {
+			git_oid_tostr(blob, sizeof(blob), change.blob);
+		} else {
+			strcpy(blob, "deleted");
+		}
+		time_t time = (time_t)change.time;
+		struct tm tm;
+		char date[32];
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime_r(&time, &tm));
+		printf("%s %s %s\n", commit, date, blob);
+	}
+
+#ifndef NDEBUG
+	history_file_close(f);
+	arena_destroy(&a);
+#endif
+	return EXIT_SUCCESS;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "serve") == 0) {
+		return main_serve(argc - 1, argv + 1, argv[0]);
+	}
+	if (argc > 1 && strcmp(argv[1], "search") == 0) {
+		return main_search(argc - 1, argv + 1, argv[0]);
+	}
+	if (argc > 1 && strcmp(argv[1], "links") == 0) {
+		return main_links(argc - 1, argv + 1, argv[0]);
+	}
+	if (argc > 1 && strcmp(argv[1], "history") == 0) {
+		return main_history(argc - 1, argv + 1, argv[0]);
+	}
+
+	struct pipeline_options pipeline_options = {
+		.jobs = (unsigned)sysconf(_SC_NPROCESSORS_ONLN),
+		.queue_depth = QUEUE_DEPTH,
+		.gzip_level = GZIP_LEVEL,
+		.block_cache_size = BLOCK_CACHE_SIZE,
+		.split_size = SPLIT_SIZE,
+	};
+	struct walk w = {0};
+	const char *fifo_path = NULL;
+	bool bundle = false;
+	bool manifest = false;
+	bool search = false;
+	bool links = false;
+	bool history = false;
+	struct pipeline_stats stats = {0};
+
+	w.revisions = calloc(argc, sizeof(*w.revisions));
+	if (w.revisions == NULL) {
+		die("failed to allocate revision list");
+	}
+
+	enum {
+		OPT_SINCE = 256,
+		OPT_SKIP_UNCHANGED,
+		OPT_DAEMON,
+		OPT_BUNDLE,
+		OPT_GZIP,
+		OPT_MANIFEST,
+		OPT_SEARCH,
+		OPT_LINKS,
+		OPT_HISTORY,
+		OPT_DIFF,
+		OPT_BLOCK_CACHE,
+		OPT_SPLIT_SIZE,
+		OPT_STATS,
+	};
+	static const struct option long_options[] = {
+		{ "jobs",           required_argument, NULL, 'j' },
+		{ "ref",            required_argument, NULL, 'r' },
+		{ "max-commits",    required_argument, NULL, 'n' },
+		{ "since",          required_argument, NULL, OPT_SINCE },
+		{ "skip-unchanged", no_argument,       NULL, OPT_SKIP_UNCHANGED },
+		{ "daemon",         required_argument, NULL, OPT_DAEMON },
+		{ "bundle",         no_argument,       NULL, OPT_BUNDLE },
+		{ "gzip",           optional_argument, NULL, OPT_GZIP },
+		{ "manifest",       no_argument,       NULL, OPT_MANIFEST },
+		{ "search",         no_argument,       NULL, OPT_SEARCH },
+		{ "links",          no_argument,       NULL, OPT_LINKS },
+		{ "history",        no_argument,       NULL, OPT_HISTORY },
+		{ "diff",           no_argument,       NULL, OPT_DIFF },
+		{ "block-cache",    required_argument, NULL, OPT_BLOCK_CACHE },
+		{ "split-size",     required_argument, NULL, OPT_SPLIT_SIZE },
+		{ "stats",          no_argument,       NULL, OPT_STATS },
+		{ NULL, 0, NULL, 0 },
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "j:r:n:", long_options, NULL)) != -1) {
+		switch (opt) {
+			case 'j': {
+				pipeline_options.jobs = (unsigned)parse_count(optarg, "number of jobs", 1024);
+			} break;
+			case 'r': {
+				w.revisions[w.revision_count++] = optarg;
+			} break;
+			case 'n': {
+				w.max_commits = parse_count(optarg, "number of commits", ULONG_MAX);
+			} break;
+			case OPT_SINCE: {
+				w.since = parse_date(optarg);
+			} break;
+			case OPT_SKIP_UNCHANGED: {
+				w.skip_unchanged = true;
+			} break;
+			case OPT_DAEMON: {
+				fifo_path = optarg;
+			} break;
+			case OPT_BUNDLE: {
+				bundle = true;
+			} break;
+			case OPT_GZIP: {
+				pipeline_options.gzip = true;
+				if (optarg != NULL) {
+					// Level 0 is valid for zlib, but parse_count() rejects it,
+					// and storing uncompressed copies is pointless anyway.
+					pipeline_options.gzip_level = (int)parse_count(optarg, "compression level", 9);
+				}
+			} break;
+			case OPT_MANIFEST: {
+				manifest = true;
+			} break;
+			case OPT_SEARCH: {
+				search = true;
+			} break;
+			case OPT_LINKS: {
+				links = true;
+			} break;
+			case OPT_HISTORY: {
+				history = true;
+			} break;
+			case OPT_DIFF: {
+				w.diff = true;
+			} break;
+			case OPT_BLOCK_CACHE: {
+				pipeline_options.block_cache_size = parse_size(optarg, "block cache size");
+			} break;
+			case OPT_SPLIT_SIZE: {
+				pipeline_options.split_size = parse_size(optarg, "split size");
+			} break;
+			case OPT_STATS: {
+				pipeline_options.stats = &stats;
+			} break;
+			default: {
+				usage(argv[0]);
+			} break;
+		}
+	}
+	if (argc - optind != 2) {
+		usage(argv[0]);
+	}
+	char *git_path = argv[optind];
+	char *out_path = argv[optind + 1];
+	if (w.revision_count == 0) {
+		w.revisions[w.revision_count++] = REF;
+	}
+	if (bundle && (manifest || search || links || history)) {
+		die("--manifest, --search, --links and --history cannot be used with --bundle");
+	}
+
+	struct git_repository *repo = open_repository(git_path);
+
+	// Create the initial output directory, or the bundle.
+	if (bundle) {
+		w.bundle = bundle_open(out_path);
+		pipeline_options.bundle = w.bundle;
+	} else {
+		xmkdir(out_path, 0755, true);
+		if (manifest) {
+			w.manifest = manifest_load(out_path);
+			pipeline_options.manifest = w.manifest;
+		}
+		if (search) {
+			struct arena a = arena_create(2048);
+			w.search = search_open(joinpath(&a, out_path, "search"));
+			pipeline_options.search = w.search;
+			arena_destroy(&a);
+		}
+		if (links) {
+			struct arena a = arena_create(2048);
+			xmkdir(joinpath(&a, out_path, "links"), 0755, true);
+			arena_destroy(&a);
+			w.links = true;
+			pipeline_options.links = true;
+		}
+		if (history) {
+			struct arena a = arena_create(2048);
+			w.history = history_load(joinpath(&a, out_path, "history"));
+			arena_destroy(&a);
+		}
+	}
+
+	w.repo = repo;
+	w.out_path = out_path;
+	w.pipeline = pipeline_start(&pipeline_options);
+	w.tips = calloc(w.revision_count, sizeof(*w.tips));
+	w.have_tips = calloc(w.revision_count, sizeof(*w.have_tips));
+	if (w.tips == NULL || w.have_tips == NULL) {
+		die("failed to allocate revision list");
+	}
+
+	struct arena a = arena_create(2048);
+	git_oid latest;
+	if (render_revisions(&a, &w, &latest)) {
+		publish(&a, &w, &latest);
+	}
+
+	if (fifo_path != NULL) {
+		fflush(stdout);
+		run_daemon(&a, &w, fifo_path);
+	}
+
+	pipeline_finish(w.pipeline);
+	if (pipeline_options.stats != NULL) {
+		print_stats(&stats, pipeline_options.jobs);
+	}
+	if (w.bundle != NULL) {
+		bundle_close(w.bundle);
+	}
+	if (w.manifest != NULL) {
+		manifest_free(w.manifest);
+	}
+	if (w.search != NULL) {
+		// Waits for merging to finish.
+		search_close(w.search);
+	}
+	if (w.history != NULL) {
+		history_free(w.history);
+	}
+
+#ifndef NDEBUG
+	oidmap_destroy(&w.seen);
+	oidmap_destroy(&w.diffs_seen);
+	arena_destroy(&a);
+	free(w.revisions);
+	free(w.tips);
+	free(w.have_tips);
+#endif
+
+#ifndef NDEBUG
+	git_libgit2_shutdown();
+#endif
+        return EXIT_SUCCESS;
+}
@@ -0,0 +1,23 @@
+#ifndef TREEDIFF_H
+#define TREEDIFF_H
+
+//
+// This module defines the comparison of a commit's tree to that of its first
+// parent. It is cheap, since unchanged subtrees have the same id and are
+// skipped without being read.
+//
+
+#include <git2.h>    // git_oid, git_commit, git_repository
+
+// Called for every file changed by a commit, with its path in the repository
+// and the blob ids before and after. `old` is NULL if the file was added and
+// `new` is NULL if it was deleted.
+typedef void tree_change_fn(const char *path, const git_oid *old, const git_oid *new, void *arg);
+
+// Call `changed` for every file changed by `commit` relative to its first
+// parent, or for every file if it has no parents. Files are visited in the
+// order of the tree.
+// Panics on failure.
+void diff_commit(git_repository *repo, git_commit *commit, tree_change_fn *changed, void *arg);
+
+#endif
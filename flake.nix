@@ -18,8 +18,10 @@
 
           src = ./.;
 
-          nativeBuildInputs = with pkgs; [ pkg-config ];
-          buildInputs = with pkgs; [ libgit2 ];
+          # The release build is trained on a generated repository, and
+          # clang's profiles have to be merged before they can be used.
+          nativeBuildInputs = with pkgs; [ pkg-config git llvmPackages_14.llvm ];
+          buildInputs = with pkgs; [ libgit2 zlib ];
 
           installPhase = ''
             mkdir -p $out
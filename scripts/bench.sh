@@ -0,0 +1,23 @@
+#!/bin/sh
+#
+# Time each build of simplewiki given after the repository $1, rendering the
+# whole repository from scratch.
+#
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 repo-path build-dir..." >&2
+	exit 1
+fi
+repo=$1
+shift
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+for build in "$@"; do
+	rm -rf "$out/site"
+	echo "$build/simplewiki:"
+	# Only the timings are interesting.
+	{ time -p "$build/simplewiki" --stats "$repo" "$out/site" | grep -v '^Generating\|^Linking\|^Copying' ; } 2>&1
+done
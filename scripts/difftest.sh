@@ -0,0 +1,21 @@
+#!/bin/sh
+#
+# Compare the renderer with the reference renderer, using the creole_diff at
+# $2, on every version of every page in the repository $1. Any further
+# arguments are passed on to creole_diff, e.g. to add generated inputs.
+#
+set -e
+
+if [ $# -lt 2 ]; then
+	echo "usage: $0 repo-path creole-diff [option...]" >&2
+	exit 1
+fi
+repo=$1
+diff=$2
+shift 2
+
+git -C "$repo" rev-list --objects --all |
+	awk '$2 ~ /\.txt$/ { print $1 }' |
+	sort -u |
+	git -C "$repo" cat-file --batch |
+	"$diff" -b "$@"
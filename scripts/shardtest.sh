@@ -0,0 +1,25 @@
+#!/bin/sh
+#
+# Render the repository $1 with the simplewiki at $2, once whole and once in
+# two shards which are then merged, and check that both give the same output.
+#
+set -e
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 repo-path simplewiki" >&2
+	exit 1
+fi
+repo=$1
+simplewiki=$2
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+"$simplewiki" --manifest --links "$repo" "$out/whole" >/dev/null
+"$simplewiki" --manifest --links --shard 0/2 "$repo" "$out/shard0" >/dev/null
+"$simplewiki" --manifest --links --shard 1/2 "$repo" "$out/shard1" >/dev/null
+"$simplewiki" merge "$out/merged" "$out/shard0" "$out/shard1" >/dev/null
+
+# Only the staging directory, which merging has no use for, may differ.
+diff -r -x .staging "$out/whole" "$out/merged"
+echo "Sharded output is the same"
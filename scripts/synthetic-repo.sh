@@ -0,0 +1,84 @@
+#!/bin/sh
+#
+# Create a bare repository at $1 with $2 commits of generated wiki pages, for
+# training and benchmarking. Pages link to each other and use most of the
+# markup; each commit edits a few of them and appends to a changelog page.
+# The result only depends on the arguments.
+#
+set -e
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 repo-path commits" >&2
+	exit 1
+fi
+repo=$1
+commits=$2
+reference=$(cd "$(dirname "$0")/.." && pwd)/references/creole1.0test.txt
+
+work=$(mktemp -d)
+trap 'rm -rf "$work"' EXIT
+
+git init -q "$work"
+cd "$work"
+git config user.name "simplewiki"
+git config user.email "simplewiki@localhost"
+mkdir -p pages
+
+# Write page $1 as of commit $2.
+page() {
+	awk -v page="$1" -v commit="$2" '
+	function word(n) {
+		return words[n % nwords + 1]
+	}
+	BEGIN {
+		nwords = split("lorem ipsum dolor sit amet consectetur adipiscing elit sed do eiusmod tempor", words, " ")
+		printf "= Page %d =\n\n", page
+		for (s = 0; s < 12; s++) {
+			# Only some sections change from one revision to the next.
+			version = (s % 4 == page % 4) ? commit : 0
+			printf "== Section %d ==\n\n", s
+			for (l = 0; l < 6; l++) {
+				line = ""
+				for (w = 0; w < 12; w++) {
+					line = line word(page + s * 3 + l * 5 + w + version) " "
+				}
+				printf "%s//%s// **%s** [[page%d.html|page %d]]\n", line, word(l), word(s), (page + s + l) % 50, (page + s + l) % 50
+			}
+			printf "\n* item %d of [[page%d.html]]\n** nested http://example.org/%d\n* another\n\n", s, (page + s) % 50, s
+			if (s % 5 == 0) {
+				printf "{{{\ncode %d\n  indented\n}}}\n\n", version
+			}
+		}
+	}'
+}
+
+i=0
+while [ "$i" -lt "$commits" ]; do
+	if [ "$i" -eq 0 ]; then
+		cp "$reference" pages/creole.txt
+		p=0
+		while [ "$p" -lt 50 ]; do
+			page "$p" 0 >"pages/page$p.txt"
+			p=$((p + 1))
+		done
+	else
+		for p in $((i % 50)) $((i * 7 % 50)) $((i * 13 % 50)); do
+			page "$p" "$i" >"pages/page$p.txt"
+		done
+	fi
+	{
+		echo "== Release $i"
+		echo
+		echo "* Changed [[page$((i % 50)).html|page $((i % 50))]], //again//."
+		echo "* Fixed **$i** things."
+		echo
+	} >>pages/changelog.txt
+	git add pages
+	GIT_AUTHOR_DATE="$((1700000000 + i * 3600)) +0000" GIT_COMMITTER_DATE="$((1700000000 + i * 3600)) +0000" \
+		git commit -q -m "Commit $i"
+	i=$((i + 1))
+done
+
+cd - >/dev/null
+rm -rf "$repo"
+git clone -q --bare "$work" "$repo"
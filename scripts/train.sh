@@ -0,0 +1,27 @@
+#!/bin/sh
+#
+# Run the instrumented binaries in $1 on typical input, so they record a
+# profile for the release build: the reference test page, and the repository
+# at $2, rendered with most features enabled.
+#
+set -e
+
+if [ $# -ne 2 ]; then
+	echo "usage: $0 build-dir repo-path" >&2
+	exit 1
+fi
+build=$1
+repo=$2
+reference=$(dirname "$0")/../references/creole1.0test.txt
+
+out=$(mktemp -d)
+trap 'rm -rf "$out"' EXIT
+
+i=0
+while [ "$i" -lt 100 ]; do
+	"$build/creole" <"$reference" >/dev/null
+	i=$((i + 1))
+done
+
+"$build/simplewiki" --links --search --history --diff "$repo" "$out/site" >/dev/null
+"$build/simplewiki" --bundle --gzip "$repo" "$out/bundle" >/dev/null
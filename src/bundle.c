@@ -0,0 +1,414 @@
+#include "bundle.h"
+
+#include "die.h"        // die*
+#include "oidmap.h"     // struct oidmap, oidmap_*
+#include <fcntl.h>      // open, O_RDONLY
+#include <stdint.h>     // uint*_t, uintptr_t
+#include <stdio.h>      // FILE, fopen, fwrite
+#include <stdlib.h>     // malloc, realloc, free, qsort
+#include <string.h>     // memcmp, memcpy, strdup
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close
+
+// Content is stored in at most this many ways (e.g. rendered or copied).
+#define BUNDLE_KINDS 4
+
+#define HEADER_SIZE  8
+#define RECORD_SIZE  56
+#define TRAILER_SIZE 64
+
+//
+// On-disk layout of an index record:
+//
+//     0  u64  path offset, relative to the string table
+//     8  u64  content offset
+//    16  u64  content length
+//    24  u32  path length
+//    28  u32  kind
+//    32  [20] blob id
+//    52  [4]  padding
+//
+// And of the trailer:
+//
+//     0  [8]  magic
+//     8  u64  index offset
+//    16  u64  number of records
+//    24  u64  string table offset
+//    32  u64  string table length
+//    40  [20] latest commit
+//    60  u8   whether there is a latest commit
+//    61  [3]  padding
+//
+
+struct record {
+	char *path;
+	size_t path_len;
+	struct bundle_entry entry;
+
+	// Insertion order, so the newest record wins when paths collide.
+	size_t order;
+};
+
+struct bundle {
+	FILE *file;
+	char *path;
+	uint64_t size;
+
+	struct record *records;
+	size_t count;
+	size_t capacity;
+
+	// Maps blob ids to the index of a record with that content, plus one.
+	struct oidmap content[BUNDLE_KINDS];
+
+	git_oid latest;
+	bool has_latest;
+
+	// Whether anything changed since the last index was written.
+	bool dirty;
+};
+
+struct bundle_reader {
+	int fd;
+	const unsigned char *map;
+	size_t size;
+
+	const unsigned char *index;
+	uint64_t count;
+	const unsigned char *strings;
+
+	git_oid latest;
+	bool has_latest;
+};
+
+static void put_le32(unsigned char *p, uint32_t v) {
+	for (int i = 0; i < 4; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+	for (int i = 0; i < 8; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static void xwrite(struct bundle *b, const void *data, size_t len) {
+	if (fwrite(data, 1, len, b->file) < len) {
+		die_errno("failed to write to %s", b->path);
+	}
+	b->size += len;
+}
+
+static void add_record(struct bundle *b, const char *path, size_t path_len, const struct bundle_entry *entry) {
+	if (b->count == b->capacity) {
+		b->capacity = (b->capacity == 0) ? 1024 : b->capacity * 2;
+		b->records = realloc(b->records, b->capacity * sizeof(*b->records));
+		if (b->records == NULL) {
+			die("failed to grow bundle index to %zu records", b->capacity);
+		}
+	}
+
+	struct record *record = &b->records[b->count];
+	record->path = strndup(path, path_len);
+	if (record->path == NULL) {
+		die("failed to copy path");
+	}
+	record->path_len = path_len;
+	record->entry = *entry;
+	record->order = b->count;
+
+	void **slot = oidmap_put(&b->content[entry->kind], &entry->blob, NULL);
+	*slot = (void *)(uintptr_t)(b->count + 1);
+
+	b->count += 1;
+	b->dirty = true;
+}
+
+struct bundle *bundle_open(const char *path) {
+	struct bundle *b = calloc(1, sizeof(*b));
+	if (b == NULL) {
+		die("failed to allocate bundle");
+	}
+	b->path = strdup(path);
+	if (b->path == NULL) {
+		die("failed to copy path");
+	}
+
+	// Carry over the index of an existing bundle.
+	struct stat st;
+	if (stat(path, &st) == 0 && st.st_size > 0) {
+		struct bundle_reader *r = bundle_reader_open(path);
+		for (uint64_t i = 0; i < r->count; ++i) {
+			const unsigned char *p = r->index + i * RECORD_SIZE;
+			struct bundle_entry entry = {
+				.offset = get_le64(p + 8),
+				.length = get_le64(p + 16),
+				.kind = get_le32(p + 28),
+			};
+			memcpy(entry.blob.id, p + 32, GIT_OID_RAWSZ);
+			add_record(b, (const char *)r->strings + get_le64(p), get_le32(p + 24), &entry);
+		}
+		if (r->has_latest) {
+			git_oid_cpy(&b->latest, &r->latest);
+			b->has_latest = true;
+		}
+		bundle_reader_close(r);
+	}
+	b->dirty = false;
+
+	b->file = fopen(path, "ab");
+	if (b->file == NULL) {
+		die_errno("failed to open %s for writing", path);
+	}
+	if (fseeko(b->file, 0, SEEK_END) < 0) {
+		die_errno("failed to seek in %s", path);
+	}
+	b->size = (uint64_t)ftello(b->file);
+	if (b->size == 0) {
+		xwrite(b, BUNDLE_MAGIC, HEADER_SIZE);
+	}
+
+	return b;
+}
+
+bool bundle_find_content(const struct bundle *b, const git_oid *blob, unsigned kind, struct bundle_entry *entry) {
+	if (kind >= BUNDLE_KINDS) {
+		die("invalid bundle content kind %u", kind);
+	}
+	void **slot = oidmap_get(&b->content[kind], blob);
+	if (slot == NULL) {
+		return false;
+	}
+	*entry = b->records[(uintptr_t)*slot - 1].entry;
+	return true;
+}
+
+void bundle_append(struct bundle *b, const git_oid *blob, unsigned kind, const void *data, size_t len, struct bundle_entry *entry) {
+	if (kind >= BUNDLE_KINDS) {
+		die("invalid bundle content kind %u", kind);
+	}
+	entry->offset = b->size;
+	entry->length = len;
+	git_oid_cpy(&entry->blob, blob);
+	entry->kind = kind;
+	xwrite(b, data, len);
+}
+
+void bundle_add(struct bundle *b, const char *path, const struct bundle_entry *entry) {
+	add_record(b, path, strlen(path), entry);
+}
+
+void bundle_set_latest(struct bundle *b, const git_oid *commit) {
+	git_oid_cpy(&b->latest, commit);
+	b->has_latest = true;
+	b->dirty = true;
+}
+
+static int compare_paths(const char *a, size_t a_len, const char *b, size_t b_len) {
+	int cmp = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+// Records are sorted indirectly, so record indices stay valid for the content
+// maps across flushes.
+static const struct record *sort_records;
+
+static int compare_records(const void *a, const void *b) {
+	const struct record *ra = &sort_records[*(const size_t *)a];
+	const struct record *rb = &sort_records[*(const size_t *)b];
+	int cmp = compare_paths(ra->path, ra->path_len, rb->path, rb->path_len);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (ra->order > rb->order) - (ra->order < rb->order);
+}
+
+void bundle_flush(struct bundle *b) {
+	// Sort by path, keeping only the newest record for each path.
+	size_t *order = malloc((b->count + 1) * sizeof(*order));
+	if (order == NULL) {
+		die("failed to allocate bundle index");
+	}
+	for (size_t i = 0; i < b->count; ++i) {
+		order[i] = i;
+	}
+	sort_records = b->records;
+	qsort(order, b->count, sizeof(*order), compare_records);
+	size_t count = 0;
+	for (size_t i = 0; i < b->count; ++i) {
+		const struct record *r = &b->records[order[i]];
+		if (i + 1 < b->count) {
+			const struct record *next = &b->records[order[i + 1]];
+			if (compare_paths(r->path, r->path_len, next->path, next->path_len) == 0) {
+				continue;
+			}
+		}
+		order[count++] = order[i];
+	}
+
+	// Align the index, so it can be read straight out of a mapping.
+	static const unsigned char zeros[8];
+	xwrite(b, zeros, (8 - b->size % 8) % 8);
+
+	uint64_t index_offset = b->size;
+	uint64_t path_offset = 0;
+	for (size_t i = 0; i < count; ++i) {
+		const struct record *record = &b->records[order[i]];
+		unsigned char p[RECORD_SIZE] = {0};
+		put_le64(p, path_offset);
+		put_le64(p + 8, record->entry.offset);
+		put_le64(p + 16, record->entry.length);
+		put_le32(p + 24, (uint32_t)record->path_len);
+		put_le32(p + 28, record->entry.kind);
+		memcpy(p + 32, record->entry.blob.id, GIT_OID_RAWSZ);
+		xwrite(b, p, sizeof(p));
+		path_offset += record->path_len;
+	}
+
+	uint64_t strings_offset = b->size;
+	for (size_t i = 0; i < count; ++i) {
+		const struct record *record = &b->records[order[i]];
+		xwrite(b, record->path, record->path_len);
+	}
+	free(order);
+
+	unsigned char trailer[TRAILER_SIZE] = {0};
+	memcpy(trailer, BUNDLE_MAGIC, 8);
+	put_le64(trailer + 8, index_offset);
+	put_le64(trailer + 16, count);
+	put_le64(trailer + 24, strings_offset);
+	put_le64(trailer + 32, path_offset);
+	if (b->has_latest) {
+		memcpy(trailer + 40, b->latest.id, GIT_OID_RAWSZ);
+		trailer[60] = 1;
+	}
+	xwrite(b, trailer, sizeof(trailer));
+
+	if (fflush(b->file) == EOF) {
+		die_errno("failed to write to %s", b->path);
+	}
+	b->dirty = false;
+}
+
+void bundle_close(struct bundle *b) {
+	if (b->dirty) {
+		bundle_flush(b);
+	}
+	if (fclose(b->file) == EOF) {
+		die_errno("failed to close %s", b->path);
+	}
+
+	for (unsigned k = 0; k < BUNDLE_KINDS; ++k) {
+		oidmap_destroy(&b->content[k]);
+	}
+	for (size_t i = 0; i < b->count; ++i) {
+		free(b->records[i].path);
+	}
+	free(b->records);
+	free(b->path);
+	free(b);
+}
+
+struct bundle_reader *bundle_reader_open(const char *path) {
+	struct bundle_reader *r = calloc(1, sizeof(*r));
+	if (r == NULL) {
+		die("failed to allocate bundle reader");
+	}
+
+	r->fd = open(path, O_RDONLY);
+	if (r->fd < 0) {
+		die_errno("failed to open %s", path);
+	}
+	struct stat st;
+	if (fstat(r->fd, &st) < 0) {
+		die_errno("failed to stat %s", path);
+	}
+	r->size = (size_t)st.st_size;
+	if (r->size < HEADER_SIZE + TRAILER_SIZE) {
+		die("%s is not a bundle", path);
+	}
+	r->map = mmap(NULL, r->size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (r->map == MAP_FAILED) {
+		die_errno("failed to map %s", path);
+	}
+
+	const unsigned char *trailer = r->map + r->size - TRAILER_SIZE;
+	if (memcmp(r->map, BUNDLE_MAGIC, 8) != 0 || memcmp(trailer, BUNDLE_MAGIC, 8) != 0) {
+		die("%s is not a bundle, or was not closed properly", path);
+	}
+	uint64_t index_offset = get_le64(trailer + 8);
+	r->count = get_le64(trailer + 16);
+	uint64_t strings_offset = get_le64(trailer + 24);
+	uint64_t strings_length = get_le64(trailer + 32);
+	if (index_offset + r->count * RECORD_SIZE > strings_offset || strings_offset + strings_length > r->size - TRAILER_SIZE) {
+		die("%s has a corrupt index", path);
+	}
+	r->index = r->map + index_offset;
+	r->strings = r->map + strings_offset;
+	if (trailer[60]) {
+		memcpy(r->latest.id, trailer + 40, GIT_OID_RAWSZ);
+		r->has_latest = true;
+	}
+
+	return r;
+}
+
+bool bundle_reader_find(const struct bundle_reader *r, const char *path, size_t path_len, struct bundle_entry *entry) {
+	uint64_t lo = 0, hi = r->count;
+	while (lo < hi) {
+		uint64_t mid = lo + (hi - lo) / 2;
+		const unsigned char *p = r->index + mid * RECORD_SIZE;
+		int cmp = compare_paths((const char *)r->strings + get_le64(p), get_le32(p + 24), path, path_len);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			entry->offset = get_le64(p + 8);
+			entry->length = get_le64(p + 16);
+			entry->kind = get_le32(p + 28);
+			memcpy(entry->blob.id, p + 32, GIT_OID_RAWSZ);
+			return entry->offset + entry->length <= r->size;
+		}
+	}
+	return false;
+}
+
+const git_oid *bundle_reader_latest(const struct bundle_reader *r) {
+	return r->has_latest ? &r->latest : NULL;
+}
+
+const char *bundle_reader_data(const struct bundle_reader *r, const struct bundle_entry *entry) {
+	return (const char *)r->map + entry->offset;
+}
+
+int bundle_reader_fd(const struct bundle_reader *r) {
+	return r->fd;
+}
+
+void bundle_reader_close(struct bundle_reader *r) {
+	munmap((void *)r->map, r->size);
+	close(r->fd);
+	free(r);
+}
@@ -1,10 +1,13 @@
 #include "creole.h"
 
+#include "blockcache.h"
 #include <assert.h>
 #include <ctype.h>
+#include <pthread.h>
 #include <regex.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -13,6 +16,69 @@
 
 #define DEBUG(...) (fprintf(stderr, __VA_ARGS__), fflush(stderr))
 
+// Smaller blocks are quicker to render than to look up.
+#define MIN_CACHED_BLOCK 64
+
+// The options of the render in progress on this thread. Several threads may
+// render at once.
+static _Thread_local const struct creole_options *options;
+
+// Where the targets of links are collected while a block is rendered for the
+// block cache, if it is.
+static _Thread_local FILE *block_links;
+
+// The number of parser attempts made by the render in progress on this
+// thread, and how many it may make. See creole_options.budget. Once the
+// budget is exceeded, parse_element() stops, and the tasks left on the stack
+// are run out without parsing anything.
+static _Thread_local size_t attempts, max_attempts;
+static _Thread_local bool over_budget;
+
+// COUNT(...) updates the counters of the render in progress on this thread,
+// or does nothing unless they are compiled in.
+#ifdef CREOLE_COUNTERS
+static _Thread_local struct creole_counters counters;
+#define COUNT(...) (__VA_ARGS__)
+#else
+#define COUNT(...) ((void)0)
+#endif
+
+// Nested markup (the text of a paragraph, a link, and so on) isn't rendered by
+// recursion. Instead, parsers push tasks for it onto a stack, which process()
+// works through in a loop. Each parser pushes a few tasks at most, so the
+// stack of the thread stays flat no matter how deeply markup is nested.
+enum task_kind {
+	TASK_TEXT,    // Write `begin`, a string.
+	TASK_ESCAPED, // Write [begin, end) escaped.
+	TASK_RANGE,   // Render [begin, end).
+	TASK_LIST,    // Render the list items starting at `begin`. See do_list().
+};
+
+struct task {
+	enum task_kind kind;
+	const char *begin, *end;
+
+	// For TASK_RANGE, whether `begin` starts a block.
+	bool new_block;
+
+	// For TASK_LIST, the marker of the list and how deep the current item
+	// is nested, and whether there are items left.
+	char marker;
+	unsigned level;
+	bool more_items;
+};
+
+// The tasks of the render in progress on this thread.
+static _Thread_local struct {
+	struct task *items;
+	size_t count;
+	size_t capacity;
+
+	// Number of TASK_RANGE tasks on the stack, i.e. how deeply markup is
+	// nested right now.
+	unsigned depth;
+} tasks;
+
 void process(const char *begin, const char *end, bool new_block, FILE *out);
 long do_headers(const char *begin, const char *end, bool new_block, FILE *out);
 long do_paragraph(const char *begin, const char *end, bool new_block, FILE *out);
@@ -79,6 +145,138 @@ bool contains_only_spaces(const char *begin, const char *end) {
 	return true;
 }
 
+// Like strnstr(), but counted.
+static const char *search(const char *haystack, const char *needle, size_t length) {
+	const char *found = strnstr(haystack, needle, length);
+	COUNT(counters.searches += 1, counters.failed_searches += (found == NULL));
+	return found;
+}
+
+// Make sure `n` more tasks can be pushed without allocating.
+static void reserve_tasks(size_t n) {
+	if (tasks.count + n <= tasks.capacity) {
+		return;
+	}
+	size_t capacity = (tasks.capacity == 0) ? 64 : tasks.capacity * 2;
+	while (capacity < tasks.count + n) {
+		capacity *= 2;
+	}
+	struct task *items = realloc(tasks.items, capacity * sizeof(*items));
+	if (items == NULL) {
+		// There is no way to render the rest of the page correctly.
+		fputs("creole: failed to allocate render stack\n", stderr);
+		abort();
+	}
+	tasks.items = items;
+	tasks.capacity = capacity;
+}
+
+static void push_task(struct task task) {
+	reserve_tasks(1);
+	tasks.items[tasks.count++] = task;
+	if (task.kind == TASK_RANGE) {
+		tasks.depth += 1;
+	}
+}
+
+static void pop_task(void) {
+	assert(tasks.count > 0);
+	if (tasks.items[--tasks.count].kind == TASK_RANGE) {
+		tasks.depth -= 1;
+	}
+}
+
+// Free the stack once rendering on this thread is done.
+static void free_tasks(void) {
+	assert(tasks.count == 0);
+	free(tasks.items);
+	tasks.items = NULL;
+	tasks.capacity = 0;
+}
+
+// Render [begin, end) as the content of an element, then write `closing`.
+// Past the nesting limit the content is written as plain text instead.
+//
+// Parsers call this after writing their opening tag and must not write
+// anything after it, since the content is only rendered once the parser has
+// returned.
+static void process_nested(const char *begin, const char *end, const char *closing) {
+	unsigned max_depth = (options != NULL && options->max_depth > 0) ? options->max_depth : CREOLE_MAX_DEPTH;
+	reserve_tasks(2);
+	push_task((struct task){ .kind = TASK_TEXT, .begin = closing });
+	if (tasks.depth < max_depth) {
+		push_task((struct task){ .kind = TASK_RANGE, .begin = begin, .end = end, .new_block = false });
+	} else {
+		push_task((struct task){ .kind = TASK_ESCAPED, .begin = begin, .end = end });
+	}
+}
+
+// The closing delimiters searched for by find_closing().
+enum closing {
+	CLOSE_LINK,
+	CLOSE_EMPHASIS,
+	CLOSE_BOLD,
+	CLOSE_NOWIKI_INLINE,
+	CLOSE_NOWIKI_BLOCK,
+	CLOSE_COUNT,
+};
+
+// A search which is known to fail when started anywhere in [from, limit) of a
+// range ending at or before `end`.
+struct miss {
+	const char *from, *limit, *end;
+};
+
+// Where each closing delimiter is known to be missing. Without this, a
+// paragraph full of unclosed "[[" would be searched to its end once for every
+// one of them.
+static _Thread_local struct miss unclosed[CLOSE_COUNT];
+
+// Likewise for the scheme of a raw URL. See do_raw_url().
+static _Thread_local struct miss not_url;
+
+static bool known_miss(const struct miss *miss, const char *from, const char *end) {
+	return miss->from <= from && from < miss->limit && end <= miss->end;
+}
+
+// Only one miss is kept per search, so a search in a short nested range must
+// not replace what is known about the enclosing one.
+static void remember_miss(struct miss *miss, const char *from, const char *limit, const char *end) {
+	if (limit >= miss->limit) {
+		*miss = (struct miss){ .from = from, .limit = limit, .end = end };
+	}
+}
+
+// Forget what is known about the previous document.
+static void reset_searches(void) {
+	memset(unclosed, 0, sizeof(unclosed));
+	memset(&not_url, 0, sizeof(not_url));
+}
+
+// Find the first `delim` in [from, end) which isn't preceded by one of the
+// characters in `escapes`. Returns NULL if there is none.
+static const char *find_closing(enum closing kind, const char *from, const char *end, const char *delim, const char *escapes) {
+	if (known_miss(&unclosed[kind], from, end)) {
+		COUNT(counters.skipped_searches += 1);
+		return NULL;
+	}
+
+	const char *stop;
+	for (const char *p = from; p < end && (stop = search(p, delim, end - p)) != NULL; p = stop + 1) {
+		if (stop[-1] == '\0' || strchr(escapes, stop[-1]) == NULL) {
+			return stop;
+		}
+	}
+
+	// Like strnstr(), the search stops at a NUL byte, so that is as far as
+	// we know the delimiter is missing.
+	if (from < end) {
+		const char *nul = memchr(from, '\0', end - from);
+		remember_miss(&unclosed[kind], from, (nul != NULL) ? nul : end, end);
+	}
+	return NULL;
+}
+
 // A parser takes a (sub)string and returns the number of characters consumed, if any.
 //
 // The parameter `new_block` determines whether `begin` points to the beginning of a new block.
@@ -103,6 +301,24 @@ static parser_t parsers[] = {
 
 };
 
+// The names of the parsers, in the same order.
+static const char *parser_names[] = {
+	"headers",
+	"nowiki_block",
+	"list",
+	"horizontal_rule",
+	"paragraph",
+	"emphasis",
+	"bold",
+	"link",
+	"raw_url",
+	"nowiki_inline",
+	"replacements",
+};
+
+static_assert(LENGTH(parsers) == CREOLE_PARSER_COUNT, "CREOLE_PARSER_COUNT is out of date");
+static_assert(LENGTH(parser_names) == CREOLE_PARSER_COUNT, "parser_names is out of date");
+
 long do_headers(const char *begin, const char *end, bool new_block, FILE *out) {
 	if (!new_block) { // Headers are block-level elements.
 		return 0;
@@ -114,7 +330,7 @@ long do_headers(const char *begin, const char *end, bool new_block, FILE *out) {
 
 	unsigned level = 0;
 	const char *start = begin;
-	while (*start == '=') {
+	while (start < end && *start == '=') {
 		level += 1;
 		start += 1;
 	}
@@ -122,7 +338,7 @@ long do_headers(const char *begin, const char *end, bool new_block, FILE *out) {
 		return 0;
 	}
 
-	while (isspace(*start)) {
+	while (start < end && isspace(*start)) {
 		start += 1;
 	}
 
@@ -133,13 +349,13 @@ long do_headers(const char *begin, const char *end, bool new_block, FILE *out) {
 
 	const char *stop = eol;
 	assert(stop > begin);
-	while (stop[-1] == '=' || isspace(stop[-1])) {
+	while (stop > start && (stop[-1] == '=' || isspace(stop[-1]))) {
 		stop -= 1;
 	}
 
+	static const char *closing[] = { NULL, "</h1>", "</h2>", "</h3>", "</h4>", "</h5>", "</h6>" };
 	fprintf(out, "<h%u>", level);
-	process(start, stop, false, out);
-	fprintf(out, "</h%u>", level);
+	process_nested(start, stop, closing[level]);
 
 	return -(eol - begin);
 }
@@ -161,8 +377,7 @@ long do_paragraph(const char *begin, const char *end, bool new_block, FILE *out)
 found_double_newline:
 
 	fputs("<p>", out);
-	process(begin, stop, false, out);
-	fputs("</p>", out);
+	process_nested(begin, stop, "</p>");
 
 	return -(stop - begin);
 }
@@ -209,18 +424,22 @@ long do_link(const char *begin, const char *end, bool new_block, FILE *out)
 	const char *start = begin + 2;
 
 	// Find the matching, unescaped "]]".
-	// Poor man's for...else
-	const char *stop = start - 1;
-	do {
-		stop = strnstr(stop + 1, "]]", end - (stop + 1));
-	} while (stop != NULL && stop[-1] == '~');
+	const char *stop = find_closing(CLOSE_LINK, start, end, "]]", "~");
 	if (stop == NULL) {
 		return 0;
 	}
 
 	// FIXME: How do we handle WikiWord style links? Should we just append ".html" if is_wikiword()?
 
-	const char *pipe = strnstr(start, "|", stop - start);
+	const char *pipe = search(start, "|", stop - start);
+	const char *target_stop = (pipe != NULL) ? pipe : stop;
+	if (options != NULL && options->link != NULL) {
+		options->link(start, target_stop - start, options->arg);
+	}
+	if (block_links != NULL) {
+		fwrite(start, 1, target_stop - start, block_links);
+		fputc('\0', block_links);
+	}
 	if (pipe != NULL) {
 		const char *link_address_start = start;
 		const char *link_address_stop = pipe;
@@ -230,8 +449,7 @@ long do_link(const char *begin, const char *end, bool new_block, FILE *out)
 
 		const char *link_text_start = pipe + 1;
 		const char *link_text_stop = stop;
-		process(link_text_start, link_text_stop, false, out);
-		fprintf(out, "</a>");
+		process_nested(link_text_start, link_text_stop, "</a>");
 	} else {
 		fprintf(out, "<a href=\"");
 		hprint(out, start, stop);
@@ -260,14 +478,18 @@ long do_raw_url(const char *begin, const char *end, bool new_block, FILE *out)
 	// - URI = scheme ":" hier-part [ "?" query ] [ "#" fragment ]
 	// - scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
 	// See: <https://www.rfc-editor.org/rfc/rfc3986#section-3.1>
-	if (!isalpha(*p)) {
+	if (p >= end || !isalpha(*p)) {
 		return 0;
 	}
+	if (known_miss(&not_url, p, end)) {
+		return 0;
+	}
+	const char *scheme = p;
 	while (p < end && (isalnum(*p) || *p == '+' || *p == '-' || *p == '.')) {
 		p += 1;
 	}
 	if (p >= end || p[0] != ':') {
-		return 0;
+		goto not_a_url;
 	}
 	p += 1;
 
@@ -298,7 +520,7 @@ end_url:
         // url. Otherwise we'd incorrectly find a link with the "said" protocol
         // here: "And he said: blah blah".
         if (q == p) {
-		return 0;
+		goto not_a_url;
 	}
 
         // Special case: If we end on a ".", assume it's a full stop at the end
@@ -319,6 +541,12 @@ end_url:
 	}
 
 	return q - begin;
+
+not_a_url:
+	// Every scheme starting later in the same run ends at the same place, so
+	// if this isn't a URL, neither are they.
+	remember_miss(&not_url, scheme, p, end);
+	return 0;
 }
 
 long do_emphasis(const char *begin, const char *end, bool new_block, FILE *out) {
@@ -327,17 +555,13 @@ long do_emphasis(const char *begin, const char *end, bool new_block, FILE *out)
 	}
 	const char *start = begin + 2; /* // */
 
-	const char *stop = start;
-	do {
-		stop = strnstr(stop + 1, "//", end - (stop + 1));
-	} while (stop != NULL && (stop[-1] == '~' || stop[-1] == ':'));
+	const char *stop = find_closing(CLOSE_EMPHASIS, start + 1, end, "//", "~:");
 	if (stop == NULL) {
 		return 0;
 	}
 
 	fputs("<em>", out);
-	process(start, stop, false, out);
-	fputs("</em>", out);
+	process_nested(start, stop, "</em>");
 
 	return stop - start + 4; /* //...// */
 }
@@ -350,17 +574,13 @@ long do_bold(const char *begin, const char *end, bool new_block, FILE *out) {
 	}
 	const char *start = begin + 2; /* // */
 
-	const char *stop = start;
-	do {
-		stop = strnstr(stop + 1, "**", end - (stop + 1));
-	} while (stop != NULL && stop[-1] == '~');
+	const char *stop = find_closing(CLOSE_BOLD, start + 1, end, "**", "~");
 	if (stop == NULL) {
 		return 0;
 	}
 
 	fputs("<strong>", out);
-	process(start, stop, false, out);
-	fputs("</strong>", out);
+	process_nested(start, stop, "</strong>");
 
 	return stop - start + 4; /* **...** */
 }
@@ -374,7 +594,7 @@ long do_nowiki_inline(const char *begin, const char *end, bool new_block, FILE *
 	}
 	const char *start = begin + 3;
 
-	const char *stop = strnstr(start, "}}}", end - start);
+	const char *stop = find_closing(CLOSE_NOWIKI_INLINE, start, end, "}}}", "");
 	if (stop == NULL) {
 		return 0;
 	}
@@ -406,7 +626,7 @@ long do_nowiki_block(const char *begin, const char *end, bool new_block, FILE *o
 	}
 	const char *start = begin + 4;
 
-	const char *stop = strnstr(start - 1, "\n}}}", end - (start - 1));
+	const char *stop = find_closing(CLOSE_NOWIKI_BLOCK, start - 1, end, "\n}}}", "");
 	if (stop == NULL) {
 		return 0;
 	}
@@ -418,6 +638,88 @@ long do_nowiki_block(const char *begin, const char *end, bool new_block, FILE *o
 	return -(stop - start + 8);
 }
 
+// Find the end of the list item whose text starts at `item_begin`. Sets
+// `more_items` if another item follows.
+static const char *find_item_end(const char *item_begin, const char *end, char marker, bool *more_items) {
+	// This part essentailly emulates the regular expression /\n\n|\n[ \t]*\*|$/.
+	const char *item_end = item_begin;
+	while (true) {
+		if (starts_with(item_end, end, "\n\n")) {
+			*more_items = false;
+			break;
+		} else if (item_end == end) {
+			*more_items = false;
+			break;
+		} else if (item_end < end && *item_end == '\n') {
+			const char *q = item_end + 1;
+			while (q < end && (*q == ' ' || *q == '\t'))
+				q += 1;
+
+			if (q < end && *q == marker) {
+				// Include the final newline in the output; will be eaten by special case in process().
+				item_end = q;
+				break;
+			}
+		}
+
+		item_end++;
+	}
+	return item_end;
+}
+
+// Skip the markers at the start of a list item, returning its level.
+static unsigned skip_markers(const char **item_begin, const char *end, char marker) {
+	unsigned level = 0;
+	while (**item_begin == marker && *item_begin + 1 < end) {
+		*item_begin += 1;
+		level++;
+	}
+	return level;
+}
+
+// Render the next item of the list `task`, or close the list if there are no
+// items left. Called by process() for TASK_LIST; the task stays on the stack
+// until the list is closed.
+static void list_step(size_t index, FILE *out) {
+	struct task *task = &tasks.items[index];
+	char marker = task->marker;
+	if (!task->more_items) {
+		while (task->level > 0) {
+			fputs((marker == '*') ? "</ul>" : "</ol>", out);
+			task->level -= 1;
+		}
+		pop_task();
+		return;
+	}
+
+	// At this point in the code, item_begin should point to the
+	// first star that marks the start of a new list item. We will start by reading the depth.
+	const char *item_begin = task->begin;
+	unsigned level = skip_markers(&item_begin, task->end, marker);
+	if (level > task->level) {
+		while (level > task->level) {
+			fputs((marker == '*') ? "<ul>" : "<ol>", out);
+			task->level += 1;
+		}
+	} else if (level < task->level){
+		while (level < task->level) {
+			fputs((marker == '*') ? "</ul>" : "</ol>", out);
+			task->level -= 1;
+		}
+	}
+
+	const char *item_end = find_item_end(item_begin, task->end, marker, &task->more_items);
+	task->begin = item_end;
+
+	// Note how we don't close the <li> tag! We can avoid some
+	// tricky logic by using the fact that <li> is a self-closing tag.
+	//
+	// See: https://html.spec.whatwg.org/#syntax-tag-omission
+	// See: https://html.spec.whatwg.org/#the-li-element
+	fputs("<li>", out);
+	process_nested(item_begin, item_end, "");
+}
+
 // TODO: We still do not handle mixing ol/ul in nested lists.
 //       See: http://www.wikicreole.org/wiki/Lists#section-Lists-Mixing
 long do_list(const char *begin, const char *end, bool new_block, FILE *out) {
@@ -429,7 +731,7 @@ long do_list(const char *begin, const char *end, bool new_block, FILE *out) {
 	}
 
 	const char *begin_stripped = begin;
-	while (*begin_stripped == ' ' || *begin_stripped == '\t') {
+	while (begin_stripped < end && (*begin_stripped == ' ' || *begin_stripped == '\t')) {
 		begin_stripped++;
 	}
 
@@ -444,69 +746,23 @@ long do_list(const char *begin, const char *end, bool new_block, FILE *out) {
 		return 0;
 	}
 
+	// Find where the list ends. The items are rendered one at a time by
+	// list_step().
 	bool more_items = true;
-	unsigned current_level = 1;
-	const char *item_begin = begin_stripped, *item_end;
+	const char *item_end = begin_stripped;
 	while (more_items) {
-		// At this point in the code, item_begin should point to the
-		// first star that marks the start of a new list item. We will start by reading the depth.
-		unsigned level = 0;
-		while (*item_begin == marker && item_begin + 1 < end) {
-			item_begin++;
-			level++;
-		}
-
-		if (level > current_level) {
-			while (level > current_level) {
-				fputs((marker == '*') ? "<ul>" : "<ol>", out);
-				current_level += 1;
-			}
-		} else if (level < current_level){
-			while (level < current_level) {
-				fputs((marker == '*') ? "</ul>" : "</ol>", out);
-				current_level -= 1;
-			}
-		}
-
-		// This part essentailly emulates the regular expression /\n\n|\n[ \t]*\*|$/.
-		item_end = item_begin;
-		while (true) {
-			if (starts_with(item_end, end, "\n\n")) {
-				more_items = false;
-				break;
-			} else if (item_end == end) {
-				more_items = false;
-				break;
-			} else if (item_end < end && *item_end == '\n') {
-				const char *q = item_end + 1;
-				while (q < end && (*q == ' ' || *q == '\t'))
-					q += 1;
-
-				if (q < end && *q == marker) {
-					// Include the final newline in the output; will be eaten by special case in process().
-					item_end = q;
-					break;
-				}
-			}
-
-			item_end++;
-		}
-
-		// Note how we don't close the <li> tag! We can avoid some
-		// tricky logic by using the fact that <li> is a self-closing tag.
-		//
-		// See: https://html.spec.whatwg.org/#syntax-tag-omission
-		// See: https://html.spec.whatwg.org/#the-li-element
-		fputs("<li>", out);
-		process(item_begin, item_end, false, out);
-
-		item_begin = item_end;
-	}
-
-	while (current_level > 0) {
-		fputs((marker == '*') ? "</ul>" : "</ol>", out);
-		current_level -= 1;
+		const char *item_begin = item_end;
+		skip_markers(&item_begin, end, marker);
+		item_end = find_item_end(item_begin, end, marker, &more_items);
 	}
+	push_task((struct task){
+		.kind = TASK_LIST,
+		.begin = begin_stripped,
+		.end = end,
+		.marker = marker,
+		.level = 1,
+		.more_items = true,
+	});
 
 	return -(item_end - begin);
 }
@@ -531,58 +787,530 @@ long do_horizontal_rule(const char *begin, const char *end, bool new_block, FILE
 	return length;
 }
 
+// Parse the element at `p`, updating `new_block` for the next one. Returns
+// where the next element starts, or NULL if there is nothing left to render.
+// Whatever is nested in the element is left on the task stack.
+static const char *parse_element(const char *p, const char *end, bool *new_block, FILE *out) {
+	if (over_budget) {
+		return NULL;
+	}
+
+	// Eat all newlines if we're starting a block.
+	if (*new_block) {
+		while (*p == '\n') {
+			p += 1;
+			if (p == end) {
+				return NULL;
+			}
+		}
+	}
+
+	// Greedily try all parsers.
+	long affected;
+	for (unsigned i = 0; i < LENGTH(parsers); ++i) {
+		attempts += 1;
+		COUNT(counters.parsers[i].attempts += 1);
+		affected = parsers[i](p, end, *new_block, out);
+		if (affected) {
+			COUNT(counters.parsers[i].matches += 1, counters.parsers[i].bytes += labs(affected));
+			break;
+		}
+	}
+	if (attempts > max_attempts) {
+		over_budget = true;
+		return NULL;
+	}
+	if (affected) {
+		p += labs(affected);
+	} else {
+		fputc(*p, out);
+		p += 1;
+	}
+
+	if (p + 1 == end) {
+		// Don't print single newline at end.
+		if (*p == '\n') {
+			return NULL;
+		}
+	} else {
+		// Determine whether we've reached a new block.
+		if (p + 1 < end && p[0] == '\n' && p[1] == '\n') {
+			// Double newline characters separate blocks;
+			// if we've found them, we're starting a new block
+			*new_block = true;
+		} else {
+			// ...otherwise the parser gets to decide.
+			*new_block = affected < 0;
+		}
+	}
+	return p;
+}
+
+// Work through the task stack until only the bottom `base` tasks are left.
+static void run_tasks(size_t base, FILE *out) {
+	while (tasks.count > base) {
+		size_t top = tasks.count - 1;
+		struct task task = tasks.items[top];
+		switch (task.kind) {
+			case TASK_TEXT: {
+				fputs(task.begin, out);
+				pop_task();
+			} break;
+			case TASK_ESCAPED: {
+				hprint(out, task.begin, task.end);
+				pop_task();
+			} break;
+			case TASK_RANGE: {
+				if (task.begin == NULL || task.begin >= task.end) {
+					pop_task();
+					break;
+				}
+				// Parsing may push more tasks, which are run before
+				// the rest of the range.
+				const char *p = parse_element(task.begin, task.end, &task.new_block, out);
+				tasks.items[top].begin = p;
+				tasks.items[top].new_block = task.new_block;
+			} break;
+			case TASK_LIST: {
+				list_step(top, out);
+			} break;
+		}
+	}
+}
+
+// Render the element at `p`, updating `new_block` for the next one. Returns
+// where the next element starts, or NULL if there is nothing left to render.
+const char *process_element(const char *p, const char *end, bool *new_block, FILE *out) {
+	size_t base = tasks.count;
+	p = parse_element(p, end, new_block, out);
+	run_tasks(base, out);
+	return p;
+}
+
 void process(const char *begin, const char *end, bool new_block, FILE *out) {
 	assert(begin <= end);
 
 	// DEBUG("Processing: %.*s\n", (int)(end - begin), begin);
 
-	const char *p = begin;
-	while (p < end) {
-		// Eat all newlines if we're starting a block.
-		if (new_block) {
-			while (*p == '\n') {
-				p += 1;
-				if (p == end) {
-					return;
-				}
+	size_t base = tasks.count;
+	push_task((struct task){ .kind = TASK_RANGE, .begin = begin, .end = end, .new_block = new_block });
+	run_tasks(base, out);
+}
+
+// Like process(), except that the blocks separated by double newlines are
+// looked up in `cache` and only rendered if they aren't there yet. Rendering
+// stops at the first element starting at or after `limit`, so a document can
+// be rendered in pieces. Returns where the next element starts, or NULL if
+// there is nothing left to render.
+//
+// A block can be reused if rendering it stops right at the double newline.
+// That is the case for headers, lists and paragraphs, which never look past
+// it. Preformatted blocks ({{{) may span several blocks, so blocks containing
+// them are always rendered.
+const char *process_cached(const char *p, const char *limit, const char *end, bool *new_block_p, struct block_cache *cache, FILE *out) {
+	bool new_block = *new_block_p;
+	while (p != NULL && p < limit) {
+		if (!new_block) {
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+
+		// Find the block at `p`, including the double newline which ends it,
+		// since that also determines how it is rendered.
+		while (*p == '\n') {
+			p += 1;
+			if (p == end) {
+				*new_block_p = new_block;
+				return NULL;
 			}
 		}
+		const char *stop = p;
+		while (stop + 1 < end && !(stop[0] == '\n' && stop[1] == '\n')) {
+			stop += 1;
+		}
+		const char *block_end = (stop + 1 < end) ? stop + 2 : end;
+		if (stop + 1 >= end) {
+			stop = end;
+		}
+		size_t block_len = block_end - p;
 
-		// Greedily try all parsers.
-		long affected;
-		for (unsigned i = 0; i < LENGTH(parsers); ++i) {
-			affected = parsers[i](p, end, new_block, out);
-			if (affected) {
+		if (block_len < MIN_CACHED_BLOCK || search(p, "{{{", stop - p) != NULL) {
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+		void (*link)(const char *, size_t, void *) = (options != NULL) ? options->link : NULL;
+		size_t cost;
+		if (block_cache_get(cache, p, block_len, out, link, (options != NULL) ? options->arg : NULL, &cost)) {
+			// The block costs what rendering it took, so whether a
+			// document fits in the budget doesn't depend on the cache.
+			attempts += cost;
+			if (attempts > max_attempts) {
+				over_budget = true;
+				p = NULL;
 				break;
 			}
+			p = (stop == end) ? NULL : stop;
+			new_block = true;
+			continue;
 		}
-		if (affected) {
-			p += labs(affected);
-		} else {
-			fputc(*p, out);
-			p += 1;
+
+		// Render the block on the side, so it can be cached.
+		char *html = NULL, *links = NULL;
+		size_t html_len = 0, links_len = 0;
+		FILE *block_out = open_memstream(&html, &html_len);
+		block_links = open_memstream(&links, &links_len);
+		if (block_out == NULL || block_links == NULL) {
+			// Rendering directly works just as well.
+			if (block_out != NULL) {
+				fclose(block_out);
+				free(html);
+			}
+			if (block_links != NULL) {
+				fclose(block_links);
+				free(links);
+				block_links = NULL;
+			}
+			p = process_element(p, end, &new_block, out);
+			continue;
+		}
+		const char *q = p;
+		size_t start_attempts = attempts;
+		while (q != NULL && q < stop) {
+			q = process_element(q, end, &new_block, block_out);
+		}
+		fclose(block_out);
+		fclose(block_links);
+		block_links = NULL;
+		fwrite(html, 1, html_len, out);
+		if (!over_budget && ((q == stop && new_block) || (q == NULL && stop == end))) {
+			block_cache_put(cache, p, block_len, html, html_len, links, links_len, attempts - start_attempts);
 		}
+		free(html);
+		free(links);
+		p = q;
+	}
+	*new_block_p = new_block;
+	return p;
+}
 
-		if (p + 1 == end) {
-			// Don't print single newline at end.
-			if (*p == '\n') {
-				return;
+// Render from `p` up to the first element starting at or after `limit`,
+// using the block cache if there is one. Returns where the next element
+// starts, or NULL if there is nothing left to render.
+const char *process_range(const char *p, const char *limit, const char *end, bool *new_block, FILE *out) {
+	if (options != NULL && options->cache != NULL) {
+		return process_cached(p, limit, end, new_block, options->cache, out);
+	}
+	while (p != NULL && p < limit) {
+		p = process_element(p, end, new_block, out);
+	}
+	return p;
+}
+
+// A part of a document rendered on its own thread by process_parallel().
+struct piece {
+	// The piece starts at a double newline, where a new block begins, and
+	// ends where the next one starts. `run_end` is the first character
+	// after the newlines at `begin`.
+	const char *begin, *run_end, *limit, *end;
+
+	const struct creole_options *options;
+	struct creole_options piece_options;
+
+	FILE *out, *links;
+	char *html, *link_targets;
+	size_t html_len, link_targets_len;
+
+	// Where rendering of the piece stopped, as returned by process_range(),
+	// and what it cost.
+	const char *stop;
+	bool new_block;
+	size_t attempts;
+	bool over_budget;
+	struct creole_counters counters;
+
+	pthread_t thread;
+	bool started;
+};
+
+static void collect_link(const char *target, size_t target_len, void *arg) {
+	FILE *links = arg;
+	fwrite(target, 1, target_len, links);
+	fputc('\0', links);
+}
+
+// Reset the state of this thread for rendering a new document.
+static void start_render(const struct creole_options *render_options) {
+	options = render_options;
+	reset_searches();
+	attempts = 0;
+	max_attempts = (options != NULL && options->budget > 0) ? options->budget : SIZE_MAX;
+	over_budget = false;
+	COUNT(memset(&counters, 0, sizeof(counters)));
+}
+
+static void *render_piece(void *arg) {
+	struct piece *piece = arg;
+	start_render(&piece->piece_options);
+	piece->new_block = true;
+	piece->stop = process_range(piece->begin, piece->limit, piece->end, &piece->new_block, piece->out);
+	piece->attempts = attempts;
+	piece->over_budget = over_budget;
+	COUNT(piece->counters = counters);
+	free_tasks();
+	options = NULL;
+	return NULL;
+}
+
+// Find where the piece after the one starting at `begin` should start: at a
+// double newline at least `size` bytes on, which isn't inside a preformatted
+// block. Returns NULL if there is no such place.
+static const char *next_boundary(const char *begin, const char *end, size_t size) {
+	if ((size_t)(end - begin) <= size) {
+		return NULL;
+	}
+	const char *boundary = begin + size, *q = begin;
+	while (true) {
+		boundary = search(boundary, "\n\n", end - boundary);
+		if (boundary == NULL) {
+			return NULL;
+		}
+
+		// Skip past preformatted blocks which would be cut in two.
+		const char *open;
+		while (q < boundary && (open = search(q, "{{{", boundary - q)) != NULL) {
+			const char *close = search(open + 3, "}}}", end - (open + 3));
+			if (close == NULL) {
+				return NULL;
 			}
-		} else {
-			// Determine whether we've reached a new block.
-			if (p[0] == '\n' && p[1] == '\n') {
-				// Double newline characters separate blocks;
-				// if we've found them, we're starting a new block
-				new_block = true;
-			} else {
-				// ...otherwise the parser gets to decide.
-				new_block = affected < 0;
+			q = close + 3;
+		}
+		if (q <= boundary) {
+			break;
+		}
+		boundary = q;
+	}
+
+	// A boundary followed by nothing but newlines is no use.
+	const char *run_end = boundary;
+	while (run_end < end && *run_end == '\n') {
+		run_end += 1;
+	}
+	return (run_end < end) ? boundary : NULL;
+}
+
+// Render the document in up to `options->threads` pieces at once.
+//
+// Each piece after the first is rendered as if a new block started where it
+// does. That is only what process() would do if rendering the previous piece
+// ends right there, which isn't known until it has been rendered, so the
+// pieces are checked in order: a piece whose start doesn't match where the
+// previous one stopped is discarded and rendered again from there. Output is
+// thus the same as process() would give, even when an element spans pieces.
+// So is the number of parser attempts, as only those of the pieces which are
+// used count towards the budget.
+void process_parallel(const char *begin, const char *end, FILE *out) {
+	size_t count = options->threads;
+	size_t size = (size_t)(end - begin) / count;
+	if (size < options->split_size) {
+		size = options->split_size;
+	}
+	struct piece *pieces = calloc(count, sizeof(*pieces));
+	if (pieces == NULL) {
+		bool new_block = true;
+		process_range(begin, end, end, &new_block, out);
+		return;
+	}
+
+	size_t n = 0;
+	for (const char *p = begin; p != NULL && n < count; ++n) {
+		struct piece *piece = &pieces[n];
+		piece->begin = p;
+		piece->run_end = p;
+		while (piece->run_end < end && *piece->run_end == '\n') {
+			piece->run_end += 1;
+		}
+		piece->end = end;
+		p = (n + 1 < count) ? next_boundary(p, end, size) : NULL;
+		piece->limit = (p != NULL) ? p : end;
+	}
+	if (n > 0) {
+		pieces[n - 1].limit = end;
+	}
+
+	// The first piece is rendered directly, on this thread.
+	for (size_t i = 1; i < n; ++i) {
+		struct piece *piece = &pieces[i];
+		piece->piece_options = *options;
+		piece->out = open_memstream(&piece->html, &piece->html_len);
+		if (piece->out == NULL) {
+			continue;
+		}
+		if (options->link != NULL) {
+			piece->links = open_memstream(&piece->link_targets, &piece->link_targets_len);
+			if (piece->links == NULL) {
+				fclose(piece->out);
+				piece->out = NULL;
+				continue;
 			}
+			piece->piece_options.link = collect_link;
+			piece->piece_options.arg = piece->links;
 		}
+		piece->started = pthread_create(&piece->thread, NULL, render_piece, piece) == 0;
 	}
+
+	bool new_block = true;
+	const char *p = process_range(begin, pieces[0].limit, end, &new_block, out);
+	for (size_t i = 1; i < n; ++i) {
+		struct piece *piece = &pieces[i];
+		if (piece->started) {
+			pthread_join(piece->thread, NULL);
+			// The work was done, even if it is thrown away.
+			COUNT(creole_counters_add(&counters, &piece->counters));
+		}
+		if (piece->out != NULL) {
+			fclose(piece->out);
+		}
+		if (piece->links != NULL) {
+			fclose(piece->links);
+		}
+
+		// Newlines starting a block are skipped, so any place among them
+		// is as good as `begin`.
+		if (p == NULL) {
+			// Already done.
+		} else if (piece->started && new_block && piece->begin <= p && p <= piece->run_end) {
+			attempts += piece->attempts;
+			if (piece->over_budget || attempts > max_attempts) {
+				over_budget = true;
+				p = NULL;
+				free(piece->html);
+				free(piece->link_targets);
+				continue;
+			}
+			fwrite(piece->html, 1, piece->html_len, out);
+			for (const char *target = piece->link_targets;
+			     target < piece->link_targets + piece->link_targets_len;
+			     target += strlen(target) + 1) {
+				options->link(target, strlen(target), options->arg);
+			}
+			p = piece->stop;
+			new_block = piece->new_block;
+		} else {
+			p = process_range(p, piece->limit, end, &new_block, out);
+		}
+		free(piece->html);
+		free(piece->link_targets);
+	}
+	free(pieces);
 }
 
 void render_creole(FILE *out, const char *source, size_t source_length)
 {
-	process(source, source + source_length, true, out);
+	render_creole_ext(out, source, source_length, NULL);
+}
+
+// Render the document, returning false if it went over budget.
+static bool render_document(FILE *out, const char *source, size_t source_length, const struct creole_options *render_options)
+{
+	start_render(render_options);
+	if (options != NULL && options->threads > 1 && source_length > options->split_size) {
+		process_parallel(source, source + source_length, out);
+	} else {
+		bool new_block = true;
+		process_range(source, source + source_length, source + source_length, &new_block, out);
+	}
+	if (attempts > max_attempts) {
+		over_budget = true;
+	}
+#ifdef CREOLE_COUNTERS
+	if (options != NULL && options->counters != NULL) {
+		creole_counters_add(options->counters, &counters);
+	}
+#endif
+	free_tasks();
+	options = NULL;
+	return !over_budget;
+}
+
+bool render_creole_ext(FILE *out, const char *source, size_t source_length, const struct creole_options *render_options)
+{
+	if (render_options == NULL || render_options->budget == 0) {
+		return render_document(out, source, source_length, render_options);
+	}
+
+	// Hold back the output and links until the document is known to fit in
+	// the budget.
+	struct creole_options budget_options = *render_options;
+	char *html = NULL, *links = NULL;
+	size_t html_len = 0, links_len = 0;
+	FILE *html_out = open_memstream(&html, &html_len);
+	FILE *links_out = NULL;
+	if (html_out != NULL && render_options->link != NULL) {
+		links_out = open_memstream(&links, &links_len);
+		budget_options.link = collect_link;
+		budget_options.arg = links_out;
+	}
+	if (html_out == NULL || (render_options->link != NULL && links_out == NULL)) {
+		fputs("creole: failed to allocate output buffer\n", stderr);
+		abort();
+	}
+
+	bool fits = render_document(html_out, source, source_length, &budget_options);
+	fclose(html_out);
+	if (links_out != NULL) {
+		fclose(links_out);
+	}
+	if (fits) {
+		fwrite(html, 1, html_len, out);
+		for (const char *target = links; target < links + links_len; target += strlen(target) + 1) {
+			render_options->link(target, strlen(target), render_options->arg);
+		}
+	} else {
+		fputs("<pre>", out);
+		hprint(out, source, source + source_length);
+		fputs("</pre>", out);
+	}
+	free(html);
+	free(links);
+	return fits;
+}
+
+bool creole_counters_enabled(void)
+{
+#ifdef CREOLE_COUNTERS
+	return true;
+#else
+	return false;
+#endif
+}
+
+const char *creole_parser_name(unsigned parser)
+{
+	assert(parser < CREOLE_PARSER_COUNT);
+	return parser_names[parser];
+}
+
+void creole_counters_add(struct creole_counters *sum, const struct creole_counters *counters)
+{
+	for (unsigned i = 0; i < CREOLE_PARSER_COUNT; ++i) {
+		sum->parsers[i].attempts += counters->parsers[i].attempts;
+		sum->parsers[i].matches += counters->parsers[i].matches;
+		sum->parsers[i].bytes += counters->parsers[i].bytes;
+	}
+	sum->searches += counters->searches;
+	sum->failed_searches += counters->failed_searches;
+	sum->skipped_searches += counters->skipped_searches;
+}
+
+void creole_counters_print(FILE *out, const struct creole_counters *counters)
+{
+	fprintf(out, "%-16s %14s %14s %6s %14s\n", "parser", "attempts", "matches", "hit%", "bytes");
+	for (unsigned i = 0; i < CREOLE_PARSER_COUNT; ++i) {
+		uint64_t attempts = counters->parsers[i].attempts, matches = counters->parsers[i].matches;
+		double rate = (attempts > 0) ? 100.0 * (double)matches / (double)attempts : 0;
+		fprintf(out, "%-16s %14llu %14llu %6.1f %14llu\n", parser_names[i], (unsigned long long)attempts,
+		        (unsigned long long)matches, rate, (unsigned long long)counters->parsers[i].bytes);
+	}
+	fprintf(out, "searches: %llu, failed: %llu, skipped: %llu\n", (unsigned long long)counters->searches,
+	        (unsigned long long)counters->failed_searches, (unsigned long long)counters->skipped_searches);
 }
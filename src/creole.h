@@ -7,9 +7,90 @@
 // [1]: http://www.wikicreole.org/wiki/Home
 // [2]: http://www.wikicreole.org/wiki/EBNFGrammarForWikiCreole1.0
 
-#include <stddef.h> // size_t
-#include <stdio.h>  // FILE
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+#include <stdio.h>   // FILE
+
+struct block_cache;
+
+// The number of parsers, which are numbered in the order they are tried. See
+// creole_parser_name().
+#define CREOLE_PARSER_COUNT 11
+
+// What the parsers did. Only counted if the renderer is built with
+// CREOLE_COUNTERS defined, since counting slows down the inner loop.
+struct creole_counters {
+	struct {
+		uint64_t attempts; // Times the parser was tried...
+		uint64_t matches;  // ...and found its element.
+		uint64_t bytes;    // Source in those elements, nested ones included.
+	} parsers[CREOLE_PARSER_COUNT];
+
+	// Scans of the source for closing delimiters and other markup, how
+	// many of them found nothing, and how many were skipped because the
+	// delimiter was known to be missing.
+	uint64_t searches;
+	uint64_t failed_searches;
+	uint64_t skipped_searches;
+};
 
 void render_creole(FILE *out, const char *source, size_t length);
 
+// Options for render_creole_ext(). Zeroed options behave like
+// render_creole().
+struct creole_options {
+	// If not NULL, called with the target of every [[link]] as it is
+	// rendered.
+	void (*link)(const char *target, size_t target_len, void *arg);
+	void *arg;
+
+	// If not NULL, blocks which were rendered before are taken from here
+	// instead of being rendered again.
+	struct block_cache *cache;
+
+	// If greater than one, documents longer than `split_size` bytes are
+	// split into pieces of at least that size, which are rendered by up to
+	// `threads` threads at once. The output is the same either way.
+	unsigned threads;
+	size_t split_size;
+
+	// How deeply markup may be nested before the rest is written as plain
+	// text. Zero means CREOLE_MAX_DEPTH.
+	unsigned max_depth;
+
+	// How many times the parsers may try to parse an element before the
+	// document is given up on and written as preformatted text instead.
+	// Zero means no limit. Attempts are counted rather than time, so
+	// whether a document fits doesn't depend on the machine, the cache or
+	// the number of threads.
+	size_t budget;
+
+	// If not NULL, what the parsers did is added to this, if counted at
+	// all. Blocks taken from the cache aren't parsed, so they don't count.
+	struct creole_counters *counters;
+};
+
+#define CREOLE_MAX_DEPTH 256
+
+// Bumped whenever the output of the renderer changes for some input, so
+// output rendered before can be told apart from what it gives now.
+#define CREOLE_VERSION 1
+
+// Like render_creole(), with options. Returns false if the document exceeded
+// the budget, in which case `link` isn't called at all.
+bool render_creole_ext(FILE *out, const char *source, size_t length, const struct creole_options *options);
+
+// Returns true if the renderer was built with CREOLE_COUNTERS defined.
+bool creole_counters_enabled(void);
+
+// Returns the name of parser number `parser`, e.g. "link".
+const char *creole_parser_name(unsigned parser);
+
+// Add `counters` to `sum`.
+void creole_counters_add(struct creole_counters *sum, const struct creole_counters *counters);
+
+// Print `counters` as a table, a parser per line, followed by the searches.
+void creole_counters_print(FILE *out, const struct creole_counters *counters);
+
 #endif
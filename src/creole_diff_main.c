@@ -0,0 +1,325 @@
+#include "blockcache.h"
+#include "creole.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// Renders a corpus with both the renderer and a frozen reference build of it,
+// and reports every input for which the two disagree. The reference is linked
+// in with its render_creole() renamed; see the difftest target in the Makefile.
+//
+// The corpus is made of the files given on the command line, a stream in the
+// format of `git cat-file --batch` on stdin (with -b) and generated inputs
+// (with -g). See scripts/difftest.sh.
+
+void reference_render_creole(FILE *out, const char *source, size_t length);
+
+// How much of each output is shown around the first difference.
+#define CONTEXT 40
+
+// Don't report more differences than this.
+#define MAX_REPORTS 20
+
+struct input {
+	char *name;
+	char *data;
+	size_t length;
+};
+
+static struct input *inputs;
+static size_t input_count, input_capacity;
+
+// Options, shared by all threads.
+static unsigned long generated_count;
+static unsigned long seed = 1;
+static struct creole_options options;
+
+static atomic_size_t next_input;
+static atomic_size_t differences;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void fail(const char *what) {
+	perror(what);
+	exit(EXIT_FAILURE);
+}
+
+static void add_input(char *name, char *data, size_t length) {
+	if (input_count == input_capacity) {
+		input_capacity = (input_capacity == 0) ? 64 : input_capacity * 2;
+		inputs = realloc(inputs, input_capacity * sizeof(*inputs));
+		if (inputs == NULL) {
+			fail("Failed to allocate corpus");
+		}
+	}
+	inputs[input_count++] = (struct input){ .name = name, .data = data, .length = length };
+}
+
+static void read_file(const char *path) {
+	FILE *fp = fopen(path, "rb");
+	if (fp == NULL) {
+		fail(path);
+	}
+	char *data = NULL;
+	size_t length = 0;
+	FILE *buffer = open_memstream(&data, &length);
+	if (buffer == NULL) {
+		fail("open_memstream");
+	}
+	char chunk[BUFSIZ];
+	size_t nread;
+	while ((nread = fread(chunk, 1, sizeof(chunk), fp)) > 0) {
+		fwrite(chunk, 1, nread, buffer);
+	}
+	if (ferror(fp)) {
+		fail(path);
+	}
+	fclose(fp);
+	fclose(buffer);
+	add_input(strdup(path), data, length);
+}
+
+// Read the output of `git cat-file --batch` from stdin. Every object is taken
+// to be a page.
+static void read_batch(void) {
+	char *line = NULL;
+	size_t line_capacity = 0;
+	ssize_t line_len;
+	while ((line_len = getline(&line, &line_capacity, stdin)) > 0) {
+		char name[128], type[32];
+		unsigned long long size;
+		if (sscanf(line, "%127s %31s %llu", name, type, &size) != 3) {
+			// Missing objects have no size, and no contents either.
+			fprintf(stderr, "Skipping %s", line);
+			continue;
+		}
+		char *data = malloc(size + 1);
+		if (data == NULL) {
+			fail("Failed to allocate page");
+		}
+		// The contents are followed by a newline.
+		if (fread(data, 1, size + 1, stdin) != size + 1) {
+			fprintf(stderr, "Truncated contents of %s\n", name);
+			exit(EXIT_FAILURE);
+		}
+		add_input(strdup(name), data, size);
+	}
+	free(line);
+	if (ferror(stdin)) {
+		fail("Failed to read stdin");
+	}
+}
+
+// A small, fast generator whose output only depends on the seed, so generated
+// inputs can be recreated from their number alone.
+static uint64_t next_random(uint64_t *state) {
+	// splitmix64.
+	uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+}
+
+// Generate input number `n`: a jumble of markup, balanced or not, mixed with
+// text and the occasional random byte.
+static char *generate(unsigned long n, size_t *length) {
+	static const char *pieces[] = {
+		"lorem ipsum ", "dolor", "\n", "\n\n", "\n\n\n", "  ", "\t", "~",
+		"= Head =\n", "== Head\n", "=== Head ==\n", "====== x", "=======", "=",
+		"* item\n", "** sub\n", "*** subsub\n", "# one\n", "## two\n", " * indented\n", "*", "#",
+		"[[Page]]", "[[Page|text]]", "[[a|//em// **b**]]", "[[", "]]", "|", "~[[",
+		"//em//", "**bold**", "//", "**", "~//", "~**", "://",
+		"{{{x}}}", "{{{", "}}}", "\n{{{\ncode\n\n}}}\n", "\n{{{\n", "\n}}}\n",
+		"http://example.com/a.", "https://example.com", "mailto:", "a+b-c.d:e", "~http://x",
+		"----", "----\n", "<&>\"'",
+	};
+
+	uint64_t state = seed * 0x100000001b3ULL + n;
+	char *data = NULL;
+	FILE *out = open_memstream(&data, length);
+	if (out == NULL) {
+		fail("open_memstream");
+	}
+	// Mostly short inputs, but some long enough to be split into pieces.
+	unsigned long count = next_random(&state) % 200;
+	if (next_random(&state) % 50 == 0) {
+		count *= 500;
+	}
+	for (unsigned long i = 0; i < count; ++i) {
+		uint64_t r = next_random(&state);
+		if (r % 20 == 0) {
+			fputc((int)(r >> 8) & 0xff, out);
+		} else {
+			fputs(pieces[(r >> 8) % (sizeof(pieces) / sizeof(pieces[0]))], out);
+		}
+	}
+	fclose(out);
+	return data;
+}
+
+// Print the part of `output` around `offset` with unprintable characters
+// escaped, followed by a line marking the byte at `offset`.
+static void print_context(const char *label, const char *output, size_t length, size_t offset) {
+	size_t from = (offset > CONTEXT) ? offset - CONTEXT : 0;
+	size_t to = (length - offset > CONTEXT) ? offset + CONTEXT : length;
+	int column = fprintf(stderr, "  %-10s %s\"", label, (from > 0) ? "..." : "");
+	int mark = column;
+	for (size_t i = from; i < to; ++i) {
+		if (i == offset) {
+			mark = column;
+		}
+		unsigned char c = (unsigned char)output[i];
+		if (c == '\n') {
+			column += fprintf(stderr, "\\n");
+		} else if (c == '\t') {
+			column += fprintf(stderr, "\\t");
+		} else if (c == '"' || c == '\\') {
+			column += fprintf(stderr, "\\%c", c);
+		} else if (c < ' ' || c >= 0x7f) {
+			column += fprintf(stderr, "\\x%02x", c);
+		} else {
+			column += fprintf(stderr, "%c", c);
+		}
+	}
+	if (offset == to) {
+		mark = column;
+	}
+	fprintf(stderr, "\"%s\n%*s^\n", (to < length) ? "..." : "", mark, "");
+}
+
+// Render one input with both engines and report the first difference, if any.
+static void check(const char *name, const char *source, size_t length) {
+	char *expected = NULL, *actual = NULL;
+	size_t expected_len, actual_len;
+	FILE *out = open_memstream(&expected, &expected_len);
+	if (out == NULL) {
+		fail("open_memstream");
+	}
+	reference_render_creole(out, source, length);
+	fclose(out);
+	out = open_memstream(&actual, &actual_len);
+	if (out == NULL) {
+		fail("open_memstream");
+	}
+	render_creole_ext(out, source, length, &options);
+	fclose(out);
+
+	size_t common = (expected_len < actual_len) ? expected_len : actual_len;
+	size_t offset = 0;
+	while (offset < common && expected[offset] == actual[offset]) {
+		offset += 1;
+	}
+	if (offset < common || expected_len != actual_len) {
+		size_t reported = atomic_fetch_add(&differences, 1);
+		if (reported < MAX_REPORTS) {
+			pthread_mutex_lock(&report_lock);
+			fprintf(stderr, "%s: outputs differ at byte %zu (of %zu and %zu)\n", name, offset, expected_len, actual_len);
+			print_context("reference:", expected, expected_len, offset);
+			print_context("new:", actual, actual_len, offset);
+			pthread_mutex_unlock(&report_lock);
+		}
+	}
+	free(expected);
+	free(actual);
+}
+
+static void *worker(void *arg) {
+	size_t total = input_count + generated_count;
+	size_t i;
+	while ((i = atomic_fetch_add(&next_input, 1)) < total) {
+		if (i < input_count) {
+			check(inputs[i].name, inputs[i].data, inputs[i].length);
+		} else {
+			unsigned long n = i - input_count;
+			char name[64];
+			snprintf(name, sizeof(name), "generated #%lu (seed %lu)", n, seed);
+			size_t length;
+			char *source = generate(n, &length);
+			check(name, source, length);
+			free(source);
+		}
+	}
+	return NULL;
+}
+
+static void usage(const char *program) {
+	fprintf(stderr, "Usage: %s [-b] [-g count] [-s seed] [-j jobs] [-t threads] [-S split-size] [-c cache-size] [file...]\n", program);
+	exit(EXIT_FAILURE);
+}
+
+static unsigned long parse_number(const char *program, const char *arg) {
+	char *end;
+	errno = 0;
+	unsigned long n = strtoul(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0') {
+		usage(program);
+	}
+	return n;
+}
+
+int main(int argc, char *argv[]) {
+	bool batch = false;
+	unsigned long jobs = (unsigned long)sysconf(_SC_NPROCESSORS_ONLN);
+	unsigned long cache_size = 0;
+	int opt;
+	while ((opt = getopt(argc, argv, "bg:s:j:t:S:c:")) != -1) {
+		switch (opt) {
+			case 'b': batch = true; break;
+			case 'g': generated_count = parse_number(argv[0], optarg); break;
+			case 's': seed = parse_number(argv[0], optarg); break;
+			case 'j': jobs = parse_number(argv[0], optarg); break;
+			case 't': options.threads = (unsigned)parse_number(argv[0], optarg); break;
+			case 'S': options.split_size = parse_number(argv[0], optarg); break;
+			case 'c': cache_size = parse_number(argv[0], optarg); break;
+			default: usage(argv[0]);
+		}
+	}
+	if (jobs == 0) {
+		jobs = 1;
+	}
+
+	for (int i = optind; i < argc; ++i) {
+		read_file(argv[i]);
+	}
+	if (batch) {
+		read_batch();
+	}
+	if (cache_size > 0 && (options.cache = block_cache_create(cache_size)) == NULL) {
+		fail("Failed to create block cache");
+	}
+
+	pthread_t *threads = calloc(jobs, sizeof(*threads));
+	if (threads == NULL) {
+		fail("Failed to allocate threads");
+	}
+	for (unsigned long i = 0; i < jobs; ++i) {
+		errno = pthread_create(&threads[i], NULL, worker, NULL);
+		if (errno != 0) {
+			fail("Failed to start thread");
+		}
+	}
+	for (unsigned long i = 0; i < jobs; ++i) {
+		pthread_join(threads[i], NULL);
+	}
+
+	size_t total = input_count + generated_count;
+	size_t differing = atomic_load(&differences);
+	printf("%zu of %zu inputs differ\n", differing, total);
+
+	for (size_t i = 0; i < input_count; ++i) {
+		free(inputs[i].name);
+		free(inputs[i].data);
+	}
+	free(inputs);
+	free(threads);
+	if (options.cache != NULL) {
+		block_cache_destroy(options.cache);
+	}
+	return (differing == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -9,6 +9,7 @@
 
 struct {
 	const char *name, *input, *output;
+	struct creole_options options;
 } tests[] = {
 	{
 		.name    =  "Empty input produces no output",
@@ -301,6 +302,36 @@ struct {
 		.input   =  "Some text\n\n----\n\nSome more text",
 		.output  =  "<p>Some text</p><hr /><p>Some more text</p>"
 	},
+	{
+		.name    =  "Document within the budget",
+		.input   =  "Some **bold** & <text>\n\nMore",
+		.output  =  "<p>Some <strong>bold</strong> &amp; &lt;text&gt;</p><p>More</p>",
+		.options =  { .budget = 1000 }
+	},
+	{
+		.name    =  "Document over the budget is preformatted",
+		.input   =  "Some **bold** & <text>\n\nMore",
+		.output  =  "<pre>Some **bold** &amp; &lt;text&gt;\n\nMore</pre>",
+		.options =  { .budget = 3 }
+	},
+	{
+		.name    =  "Markup nested within the maximum depth",
+		.input   =  "**//bold & italic//**",
+		.output  =  "<p><strong><em>bold &amp; italic</em></strong></p>",
+		.options =  { .max_depth = 2 }
+	},
+	{
+		.name    =  "Markup nested beyond the maximum depth is text",
+		.input   =  "**//bold & italic//**",
+		.output  =  "<p><strong>//bold &amp; italic//</strong></p>",
+		.options =  { .max_depth = 1 }
+	},
+	{
+		.name    =  "Link text nested beyond the maximum depth is text",
+		.input   =  "[[link|**bold**]]",
+		.output  =  "<p><a href=\"link\">**bold**</a></p>",
+		.options =  { .max_depth = 1 }
+	},
 #if 0
 	{
 		.name    =  "Ordered item with ordered sublist",
@@ -385,7 +416,7 @@ int main(void) {
 
 		static char buffer[1024];
 		FILE *fp = fmemopen(buffer, sizeof(buffer), "wb");
-		render_creole(fp, tests[i].input, strlen(tests[i].input));
+		render_creole_ext(fp, tests[i].input, strlen(tests[i].input), &tests[i].options);
 		long buffer_length = ftell(fp);
 		fclose(fp);
 
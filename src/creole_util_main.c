@@ -5,6 +5,7 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <unistd.h>
 
 #define CHUNK_SIZE 128
 
@@ -87,7 +88,23 @@ int read_file(const char *file_path, char **out_buffer, size_t *out_length) {
 	return 0;
 }
 
-int main(void) {
+int main(int argc, char *argv[]) {
+	// With -c, print what the parsers did to stderr.
+	bool count = false;
+	int opt;
+	while ((opt = getopt(argc, argv, "c")) != -1) {
+		switch (opt) {
+			case 'c': count = true; break;
+			default:
+				fprintf(stderr, "Usage: %s [-c] <input >output\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+	if (count && !creole_counters_enabled()) {
+		fprintf(stderr, "%s: built without CREOLE_COUNTERS; see the counters target of the Makefile\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
 	size_t buffer_length = 0;
 	char *buffer = NULL;
 	if (read_file("/dev/stdin", &buffer, &buffer_length) < 0) {
@@ -95,7 +112,12 @@ int main(void) {
 		return EXIT_FAILURE;
 	}
 
-	render_creole(stdout, buffer, buffer_length);
+	struct creole_counters counters = {0};
+	struct creole_options options = { .counters = count ? &counters : NULL };
+	render_creole_ext(stdout, buffer, buffer_length, &options);
+	if (count) {
+		creole_counters_print(stderr, &counters);
+	}
 
         // The lack of return value makes it painfully obvious that we aren't
         // handling errors at all. This represents my half-hearted attempt to fix that.
@@ -0,0 +1,21 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+//
+// This module defines line diffs between two revisions of a page.
+//
+// Lines are compared by hash first, and the shortest edit script is found with
+// the linear-space variant of Myers' algorithm, after stripping the lines the
+// two revisions have in common at the start and end. Since most edits touch a
+// small part of a page, the cost is usually proportional to the size of the
+// page plus the square of the size of the edit.
+//
+
+#include <stddef.h> // size_t
+#include <stdio.h>  // FILE
+
+// Write the differences between `old` and `new` to `out` as an HTML fragment,
+// in the unified format with three lines of context.
+void render_diff(FILE *out, const char *old, size_t old_len, const char *new, size_t new_len);
+
+#endif
@@ -0,0 +1,560 @@
+#include "linkgraph.h"
+
+#include "die.h"        // die*
+#include <errno.h>      // errno
+#include <fcntl.h>      // open, O_RDONLY
+#include <stdint.h>     // uint32_t, uint64_t
+#include <stdio.h>      // FILE, fopen, fwrite, open_memstream
+#include <stdlib.h>     // malloc, calloc, realloc, free, qsort
+#include <string.h>     // memcmp, memcpy, strcmp, strlen, strdup
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // close
+
+#define LINKS_MAGIC "SWLINK01"
+
+#define HEADER_SIZE 32
+
+//
+// On-disk layout of the header:
+//
+//     0  [8]  magic
+//     8  u32  number of pages
+//    12  u32  number of edges
+//    16  u32  number of broken links
+//    20  u32  length of the strings
+//    24  [8]  padding
+//
+
+// A file of the commit.
+struct file {
+	char *path;
+	bool is_page;
+	const char *links;
+	size_t links_len;
+
+	// Assigned when the graph is written.
+	uint32_t page;
+};
+
+struct link_graph {
+	char *prefix;
+	size_t prefix_len;
+	char *path;
+
+	struct file *files;
+	size_t count;
+	size_t capacity;
+};
+
+struct link_file {
+	const unsigned char *map;
+	size_t size;
+
+	uint32_t pages;
+	uint32_t edges;
+	uint32_t broken;
+
+	const unsigned char *strings_index;
+	const unsigned char *index[3];
+	const unsigned char *links[3];
+	const unsigned char *strings;
+	uint32_t strings_len;
+};
+
+// A growable array of 32-bit integers.
+struct u32s {
+	uint32_t *items;
+	size_t count;
+	size_t capacity;
+};
+
+static void push(struct u32s *a, uint32_t v) {
+	if (a->count == a->capacity) {
+		a->capacity = (a->capacity == 0) ? 64 : a->capacity * 2;
+		a->items = realloc(a->items, a->capacity * sizeof(*a->items));
+		if (a->items == NULL) {
+			die("failed to grow link graph to %zu entries", a->capacity);
+		}
+	}
+	a->items[a->count++] = v;
+}
+
+static void put_le32(unsigned char *p, uint32_t v) {
+	for (int i = 0; i < 4; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+struct link_graph *link_graph_create(const char *prefix, const char *path) {
+	struct link_graph *g = calloc(1, sizeof(*g));
+	if (g == NULL) {
+		die("failed to allocate link graph");
+	}
+	g->prefix = strdup(prefix);
+	g->path = strdup(path);
+	if (g->prefix == NULL || g->path == NULL) {
+		die("failed to copy path");
+	}
+	g->prefix_len = strlen(prefix);
+	return g;
+}
+
+void link_graph_add(struct link_graph *g, const char *path, bool is_page, const char *links, size_t links_len) {
+	if (strncmp(path, g->prefix, g->prefix_len) == 0 && path[g->prefix_len] == '/') {
+		path += g->prefix_len + 1;
+	}
+
+	if (g->count == g->capacity) {
+		g->capacity = (g->capacity == 0) ? 256 : g->capacity * 2;
+		g->files = realloc(g->files, g->capacity * sizeof(*g->files));
+		if (g->files == NULL) {
+			die("failed to grow link graph to %zu files", g->capacity);
+		}
+	}
+	struct file *file = &g->files[g->count++];
+	*file = (struct file){
+		.path = strdup(path),
+		.is_page = is_page,
+		.links = links,
+		.links_len = links_len,
+	};
+	if (file->path == NULL) {
+		die("failed to copy path");
+	}
+}
+
+//
+// Resolving links
+//
+
+// A hash set of paths, mapping each to its file.
+struct path_set {
+	struct file **slots;
+	size_t capacity;
+};
+
+static uint64_t hash_path(const char *path, size_t len) {
+	// FNV-1a.
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < len; ++i) {
+		h = (h ^ (unsigned char)path[i]) * 1099511628211ULL;
+	}
+	return h;
+}
+
+static void path_set_init(struct path_set *set, const struct link_graph *g) {
+	set->capacity = 16;
+	while (set->capacity < g->count * 2) {
+		set->capacity *= 2;
+	}
+	set->slots = calloc(set->capacity, sizeof(*set->slots));
+	if (set->slots == NULL) {
+		die("failed to allocate path set");
+	}
+	for (size_t i = 0; i < g->count; ++i) {
+		struct file *file = &g->files[i];
+		size_t j = hash_path(file->path, strlen(file->path)) & (set->capacity - 1);
+		while (set->slots[j] != NULL) {
+			j = (j + 1) & (set->capacity - 1);
+		}
+		set->slots[j] = file;
+	}
+}
+
+static const struct file *path_set_find(const struct path_set *set, const char *path, size_t len) {
+	size_t j = hash_path(path, len) & (set->capacity - 1);
+	while (set->slots[j] != NULL) {
+		const char *candidate = set->slots[j]->path;
+		if (strncmp(candidate, path, len) == 0 && candidate[len] == '\0') {
+			return set->slots[j];
+		}
+		j = (j + 1) & (set->capacity - 1);
+	}
+	return NULL;
+}
+
+// Returns true if `target` starts with a URL scheme such as "https:".
+static bool has_scheme(const char *target, size_t len) {
+	for (size_t i = 0; i < len; ++i) {
+		char c = target[i];
+		if (c == ':') {
+			return i > 0;
+		}
+		bool alpha = (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+		if (!alpha && (i == 0 || !((c >= '0' && c <= '9') || c == '+' || c == '-' || c == '.'))) {
+			return false;
+		}
+	}
+	return false;
+}
+
+// Resolve `target` relative to the directory of `page` into `out`, which must
+// have room for both plus ".html". Returns the length of the result, or -1 if
+// the target leaves the commit.
+static long resolve(const char *page, const char *target, size_t target_len, char *out) {
+	// Start from the directory of the page.
+	const char *slash = strrchr(page, '/');
+	size_t len = (slash == NULL) ? 0 : (size_t)(slash - page);
+	memcpy(out, page, len);
+
+	const char *p = target, *end = target + target_len;
+	while (p < end) {
+		const char *segment_end = memchr(p, '/', end - p);
+		if (segment_end == NULL) {
+			segment_end = end;
+		}
+		size_t segment_len = segment_end - p;
+
+		if (segment_len == 0 || (segment_len == 1 && p[0] == '.')) {
+			// Nothing to do.
+		} else if (segment_len == 2 && p[0] == '.' && p[1] == '.') {
+			if (len == 0) {
+				return -1;
+			}
+			while (len > 0 && out[len - 1] != '/') {
+				len--;
+			}
+			if (len > 0) {
+				len--; // The slash.
+			}
+		} else {
+			if (len > 0) {
+				out[len++] = '/';
+			}
+			memcpy(out + len, p, segment_len);
+			len += segment_len;
+		}
+		p = segment_end + 1;
+	}
+	return (long)len;
+}
+
+// Look up the file a link on `page` leads to. Returns NULL if the link is
+// broken. Sets `ignored` if the link doesn't lead into the commit at all.
+static const struct file *follow(const struct path_set *set, const char *page, const char *target, bool *ignored) {
+	*ignored = false;
+	size_t target_len = strcspn(target, "#?");
+	if (target_len == 0 || target[0] == '/' || has_scheme(target, target_len)) {
+		*ignored = true;
+		return NULL;
+	}
+
+	char *path = malloc(strlen(page) + target_len + sizeof(".html") + 1);
+	if (path == NULL) {
+		die("failed to allocate path");
+	}
+	long len = resolve(page, target, target_len, path);
+	const struct file *file = NULL;
+	if (len > 0) {
+		file = path_set_find(set, path, len);
+		if (file == NULL) {
+			memcpy(path + len, ".html", 5);
+			file = path_set_find(set, path, len + 5);
+		}
+	}
+	free(path);
+	return file;
+}
+
+static int compare_files(const void *a, const void *b) {
+	return strcmp(((const struct file *)a)->path, ((const struct file *)b)->path);
+}
+
+static int compare_u32(const void *a, const void *b) {
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void write_u32s(FILE *out, const uint32_t *items, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		unsigned char buf[4];
+		put_le32(buf, items[i]);
+		fwrite(buf, 1, sizeof(buf), out);
+	}
+}
+
+void link_graph_write(struct link_graph *g) {
+	// Number the pages in order of their paths. There are no files, and no
+	// array to sort, if nothing was rendered.
+	if (g->count > 1) {
+		qsort(g->files, g->count, sizeof(*g->files), compare_files);
+	}
+	uint32_t pages = 0;
+	for (size_t i = 0; i < g->count; ++i) {
+		if (g->files[i].is_page) {
+			g->files[i].page = pages++;
+		}
+	}
+	struct path_set set;
+	path_set_init(&set, g);
+
+	// Follow every link, collecting the edges and broken links.
+	struct u32s links_index = {0}, links = {0}, broken_index = {0};
+	char *broken_strings;
+	size_t broken_strings_len;
+	FILE *broken = open_memstream(&broken_strings, &broken_strings_len);
+	if (broken == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	struct u32s broken_offsets = {0};
+	for (size_t i = 0; i < g->count; ++i) {
+		const struct file *file = &g->files[i];
+		if (!file->is_page) {
+			continue;
+		}
+		push(&links_index, (uint32_t)links.count);
+		push(&broken_index, (uint32_t)broken_offsets.count);
+
+		size_t first = links.count;
+		for (const char *target = file->links; target < file->links + file->links_len; target += strlen(target) + 1) {
+			bool ignored;
+			const struct file *to = follow(&set, file->path, target, &ignored);
+			if (to != NULL && to->is_page) {
+				push(&links, to->page);
+			} else if (to == NULL && !ignored) {
+				push(&broken_offsets, (uint32_t)ftello(broken));
+				fputs(target, broken);
+			}
+		}
+
+		// Several links to the same page are one edge. Until some page links
+		// somewhere, `links.items` is NULL, which qsort() mustn't be given.
+		if (links.count - first > 1) {
+			qsort(links.items + first, links.count - first, sizeof(*links.items), compare_u32);
+		}
+		size_t unique = first;
+		for (size_t j = first; j < links.count; ++j) {
+			if (j == first || links.items[j] != links.items[unique - 1]) {
+				links.items[unique++] = links.items[j];
+			}
+		}
+		links.count = unique;
+	}
+	push(&links_index, (uint32_t)links.count);
+	push(&broken_index, (uint32_t)broken_offsets.count);
+	if (fclose(broken) == EOF) {
+		die_errno("failed to collect broken links");
+	}
+
+	// Invert the edges with a counting sort, so backlinks come out sorted
+	// by source page.
+	struct u32s backlinks_index = {0};
+	uint32_t *backlinks = calloc(links.count + 1, sizeof(*backlinks));
+	uint32_t *fill = calloc(pages + 1, sizeof(*fill));
+	if (backlinks == NULL || fill == NULL) {
+		die("failed to allocate backlinks");
+	}
+	for (size_t i = 0; i < links.count; ++i) {
+		fill[links.items[i]] += 1;
+	}
+	uint32_t total = 0;
+	for (uint32_t page = 0; page < pages; ++page) {
+		push(&backlinks_index, total);
+		uint32_t n = fill[page];
+		fill[page] = total;
+		total += n;
+	}
+	push(&backlinks_index, total);
+	for (uint32_t page = 0; page < pages; ++page) {
+		for (uint32_t j = links_index.items[page]; j < links_index.items[page + 1]; ++j) {
+			backlinks[fill[links.items[j]]++] = page;
+		}
+	}
+
+	// Page paths come first in the strings, then broken link targets.
+	char *strings;
+	size_t strings_len;
+	FILE *s = open_memstream(&strings, &strings_len);
+	if (s == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	struct u32s strings_index = {0};
+	for (size_t i = 0; i < g->count; ++i) {
+		if (g->files[i].is_page) {
+			push(&strings_index, (uint32_t)ftello(s));
+			fputs(g->files[i].path, s);
+		}
+	}
+	uint32_t broken_base = (uint32_t)ftello(s);
+	for (size_t i = 0; i < broken_offsets.count; ++i) {
+		push(&strings_index, broken_base + broken_offsets.items[i]);
+	}
+	fwrite(broken_strings, 1, broken_strings_len, s);
+	push(&strings_index, (uint32_t)ftello(s));
+	if (fclose(s) == EOF) {
+		die_errno("failed to collect strings");
+	}
+
+	size_t temp_len = strlen(g->path) + 8;
+	char *temp = malloc(temp_len);
+	if (temp == NULL) {
+		die("failed to allocate path");
+	}
+	snprintf(temp, temp_len, "%s.tmp", g->path);
+	FILE *out = fopen(temp, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", temp);
+	}
+	unsigned char header[HEADER_SIZE] = {0};
+	memcpy(header, LINKS_MAGIC, 8);
+	put_le32(header + 8, pages);
+	put_le32(header + 12, (uint32_t)links.count);
+	put_le32(header + 16, (uint32_t)broken_offsets.count);
+	put_le32(header + 20, (uint32_t)strings_len);
+	fwrite(header, 1, sizeof(header), out);
+	write_u32s(out, strings_index.items, strings_index.count);
+	write_u32s(out, links_index.items, links_index.count);
+	write_u32s(out, links.items, links.count);
+	write_u32s(out, backlinks_index.items, backlinks_index.count);
+	write_u32s(out, backlinks, links.count);
+	write_u32s(out, broken_index.items, broken_index.count);
+	fwrite(strings, 1, strings_len, out);
+	if (ferror(out) | (fclose(out) == EOF)) {
+		die_errno("failed to write %s", temp);
+	}
+	if (rename(temp, g->path) < 0) {
+		die_errno("failed to rename %s", temp);
+	}
+	free(temp);
+
+	free(strings);
+	free(strings_index.items);
+	free(broken_strings);
+	free(broken_offsets.items);
+	free(broken_index.items);
+	free(backlinks_index.items);
+	free(backlinks);
+	free(fill);
+	free(links.items);
+	free(links_index.items);
+	free(set.slots);
+	for (size_t i = 0; i < g->count; ++i) {
+		free(g->files[i].path);
+	}
+	free(g->files);
+	free(g->prefix);
+	free(g->path);
+	free(g);
+}
+
+//
+// Reading graphs
+//
+
+struct link_file *link_file_open(const char *path) {
+	struct link_file *f = calloc(1, sizeof(*f));
+	if (f == NULL) {
+		die("failed to allocate link graph");
+	}
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		die_errno("failed to open %s", path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		die_errno("failed to stat %s", path);
+	}
+	f->size = (size_t)st.st_size;
+	if (f->size < HEADER_SIZE) {
+		die("%s is not a link graph", path);
+	}
+	f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (f->map == MAP_FAILED) {
+		die_errno("failed to map %s", path);
+	}
+	close(fd);
+
+	if (memcmp(f->map, LINKS_MAGIC, 8) != 0) {
+		die("%s is not a link graph", path);
+	}
+	f->pages = get_le32(f->map + 8);
+	f->edges = get_le32(f->map + 12);
+	f->broken = get_le32(f->map + 16);
+	f->strings_len = get_le32(f->map + 20);
+
+	uint64_t words = ((uint64_t)f->pages + f->broken + 1) + 3 * ((uint64_t)f->pages + 1) + 2 * (uint64_t)f->edges;
+	if (HEADER_SIZE + 4 * words + f->strings_len != f->size) {
+		die("%s is corrupt", path);
+	}
+	const unsigned char *p = f->map + HEADER_SIZE;
+	f->strings_index = p;
+	p += 4 * ((size_t)f->pages + f->broken + 1);
+	f->index[LINKS_OUT] = p;
+	p += 4 * ((size_t)f->pages + 1);
+	f->links[LINKS_OUT] = p;
+	p += 4 * (size_t)f->edges;
+	f->index[LINKS_IN] = p;
+	p += 4 * ((size_t)f->pages + 1);
+	f->links[LINKS_IN] = p;
+	p += 4 * (size_t)f->edges;
+	f->index[LINKS_BROKEN] = p;
+	p += 4 * ((size_t)f->pages + 1);
+	f->strings = p;
+	return f;
+}
+
+uint32_t link_file_pages(const struct link_file *f) {
+	return f->pages;
+}
+
+const char *link_file_string(const struct link_file *f, uint32_t i, size_t *len) {
+	uint32_t begin = get_le32(f->strings_index + 4 * (size_t)i);
+	uint32_t end = get_le32(f->strings_index + 4 * ((size_t)i + 1));
+	if (begin > end || end > f->strings_len) {
+		die("link graph is corrupt");
+	}
+	*len = end - begin;
+	return (const char *)f->strings + begin;
+}
+
+bool link_file_find(const struct link_file *f, const char *path, uint32_t *page) {
+	size_t path_len = strlen(path);
+	uint32_t lo = 0, hi = f->pages;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		size_t len;
+		const char *s = link_file_string(f, mid, &len);
+		int cmp = memcmp(s, path, (len < path_len) ? len : path_len);
+		if (cmp == 0) {
+			cmp = (len > path_len) - (len < path_len);
+		}
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			*page = mid;
+			return true;
+		}
+	}
+	return false;
+}
+
+uint32_t link_file_count(const struct link_file *f, enum link_kind kind, uint32_t page) {
+	const unsigned char *index = f->index[kind] + 4 * (size_t)page;
+	return get_le32(index + 4) - get_le32(index);
+}
+
+uint32_t link_file_get(const struct link_file *f, enum link_kind kind, uint32_t page, uint32_t i) {
+	uint32_t j = get_le32(f->index[kind] + 4 * (size_t)page) + i;
+	if (kind == LINKS_BROKEN) {
+		// Broken links are strings, which follow the page paths.
+		return f->pages + j;
+	}
+	return get_le32(f->links[kind] + 4 * (size_t)j);
+}
+
+void link_file_close(struct link_file *f) {
+	munmap((void *)f->map, f->size);
+	free(f);
+}
@@ -0,0 +1,80 @@
+#ifndef LINKGRAPH_H
+#define LINKGRAPH_H
+
+//
+// This module defines the link graph of a commit: which pages link to which,
+// and which links lead nowhere.
+//
+// A graph is built from the files of a commit and the targets of the links on
+// each page, and written to a file in compressed sparse row form. After a
+// header, the file holds these arrays:
+//
+//     strings index    [pages + broken links + 1]
+//     links index      [pages + 1]
+//     links            [edges]
+//     backlinks index  [pages + 1]
+//     backlinks        [edges]
+//     broken index     [pages + 1]
+//     strings
+//
+// Pages are numbered in order of their paths. The links of page `i` are the
+// page numbers links[links_index[i] .. links_index[i + 1]], and likewise for
+// backlinks and broken links, so each query is a pair of array lookups.
+// String `i` is the path of page `i` if `i` is less than the number of pages,
+// and the target of broken link `i - pages` otherwise. All integers are
+// 32-bit little-endian.
+//
+// Link targets are resolved like a browser would resolve them relative to the
+// page, trying the target with ".html" appended if it doesn't name a file.
+// Targets with a URL scheme are ignored.
+//
+
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint32_t
+
+struct link_graph;
+
+// Start a graph of the files below `prefix`, to be written to `path`.
+struct link_graph *link_graph_create(const char *prefix, const char *path);
+
+// Add the file at `path` (which is below the prefix). If `is_page` is true,
+// `links` holds its link targets, each terminated by a NUL byte. The links
+// must stay valid until the graph is written.
+void link_graph_add(struct link_graph *g, const char *path, bool is_page, const char *links, size_t links_len);
+
+// Resolve the links, write the graph and free it.
+// Panics on failure.
+void link_graph_write(struct link_graph *g);
+
+enum link_kind {
+	LINKS_OUT,    // Pages a page links to.
+	LINKS_IN,     // Pages linking to a page.
+	LINKS_BROKEN, // Strings of the targets of a page's broken links.
+};
+
+struct link_file;
+
+// Map the graph at `path`.
+// Panics on failure.
+struct link_file *link_file_open(const char *path);
+
+// Returns the number of pages.
+uint32_t link_file_pages(const struct link_file *f);
+
+// Look up the page at `path`. Returns false if there is no such page.
+bool link_file_find(const struct link_file *f, const char *path, uint32_t *page);
+
+// Returns the number of links of the given kind on `page`.
+uint32_t link_file_count(const struct link_file *f, enum link_kind kind, uint32_t page);
+
+// Returns the `i`th link of the given kind on `page`.
+uint32_t link_file_get(const struct link_file *f, enum link_kind kind, uint32_t page, uint32_t i);
+
+// Returns string `i`, which is not NUL-terminated.
+const char *link_file_string(const struct link_file *f, uint32_t i, size_t *len);
+
+// Unmap the graph.
+void link_file_close(struct link_file *f);
+
+#endif
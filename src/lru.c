@@ -0,0 +1,111 @@
+#include "lru.h"
+
+#include "die.h"        // die
+#include "oidmap.h"     // struct oidmap, oidmap_*
+#include <stdlib.h>     // calloc, free
+
+struct entry {
+	git_oid key;
+	char *data;
+	size_t len;
+
+	// Entries form a circular list, most recently used first.
+	struct entry *prev, *next;
+};
+
+struct lru {
+	struct oidmap map;
+	struct entry list; // Sentinel.
+	size_t used;
+	size_t max_bytes;
+};
+
+// What an entry costs against the limit.
+static size_t entry_size(const struct entry *entry) {
+	return sizeof(*entry) + entry->len;
+}
+
+static void unlink_entry(struct entry *entry) {
+	entry->prev->next = entry->next;
+	entry->next->prev = entry->prev;
+}
+
+static void push_front(struct lru *cache, struct entry *entry) {
+	entry->prev = &cache->list;
+	entry->next = cache->list.next;
+	cache->list.next->prev = entry;
+	cache->list.next = entry;
+}
+
+static void evict(struct lru *cache, struct entry *entry) {
+	unlink_entry(entry);
+	oidmap_remove(&cache->map, &entry->key);
+	cache->used -= entry_size(entry);
+	free(entry->data);
+	free(entry);
+}
+
+struct lru *lru_create(size_t max_bytes) {
+	struct lru *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL) {
+		die("failed to allocate cache");
+	}
+	cache->list.prev = cache->list.next = &cache->list;
+	cache->max_bytes = max_bytes;
+	return cache;
+}
+
+const char *lru_get(struct lru *cache, const git_oid *key, size_t *len) {
+	void **slot = oidmap_get(&cache->map, key);
+	if (slot == NULL) {
+		return NULL;
+	}
+
+	struct entry *entry = *slot;
+	unlink_entry(entry);
+	push_front(cache, entry);
+	*len = entry->len;
+	return entry->data;
+}
+
+bool lru_put(struct lru *cache, const git_oid *key, char *data, size_t len) {
+	struct entry *entry = calloc(1, sizeof(*entry));
+	if (entry == NULL) {
+		die("failed to allocate cache entry");
+	}
+	git_oid_cpy(&entry->key, key);
+	entry->data = data;
+	entry->len = len;
+
+	if (entry_size(entry) > cache->max_bytes) {
+		free(entry);
+		return false;
+	}
+
+	// Replace any existing entry for the same key.
+	void **slot = oidmap_get(&cache->map, key);
+	if (slot != NULL) {
+		evict(cache, *slot);
+	}
+
+	while (cache->used + entry_size(entry) > cache->max_bytes) {
+		evict(cache, cache->list.prev);
+	}
+
+	*oidmap_put(&cache->map, key, NULL) = entry;
+	push_front(cache, entry);
+	cache->used += entry_size(entry);
+	return true;
+}
+
+size_t lru_used(const struct lru *cache) {
+	return cache->used;
+}
+
+void lru_destroy(struct lru *cache) {
+	while (cache->list.next != &cache->list) {
+		evict(cache, cache->list.next);
+	}
+	oidmap_destroy(&cache->map);
+	free(cache);
+}
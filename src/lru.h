@@ -0,0 +1,38 @@
+#ifndef LRU_H
+#define LRU_H
+
+//
+// This module defines a cache of byte strings keyed by git object ids. When
+// the cache grows beyond its size limit, the least recently used entries are
+// evicted.
+//
+// The cache is not thread-safe.
+//
+
+#include <git2.h>    // git_oid
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+
+struct lru;
+
+// Create a cache holding at most `max_bytes` bytes, including bookkeeping.
+// Panics on failure to allocate.
+struct lru *lru_create(size_t max_bytes);
+
+// Look up `key`, marking it as recently used.
+// Returns NULL if there is no such entry. Otherwise the result is valid until
+// the next call to lru_put().
+const char *lru_get(struct lru *cache, const git_oid *key, size_t *len);
+
+// Insert `data`, which must have been allocated with malloc(). If the entry is
+// too large to ever fit, false is returned and the caller keeps ownership of
+// `data`. Otherwise the cache takes ownership of it.
+bool lru_put(struct lru *cache, const git_oid *key, char *data, size_t len);
+
+// Returns the number of bytes currently used by the cache.
+size_t lru_used(const struct lru *cache);
+
+// Free the cache and all of its entries.
+void lru_destroy(struct lru *cache);
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef MANIFEST_H
+#define MANIFEST_H
+
+//
+// This module defines the deploy manifest, which lists every file in the
+// output directory so a deploy script doesn't have to scan for changes.
+//
+// The manifest is a text file with one line per file, sorted by path:
+//
+//     <output hash> <size> <source id> <path>
+//
+// The output hash is the git blob id of the file's contents, so it can be
+// checked with `git hash-object` and used as a strong ETag. The source id is
+// the blob the file was produced from. Paths are relative to the output
+// directory.
+//
+// Next to it, a delta manifest in the same format lists only the files which
+// were added or changed since the manifest was last written.
+//
+// The manifest is not thread-safe.
+//
+
+#include <git2.h>    // git_oid
+#include <stdint.h>  // uint64_t
+
+struct manifest;
+
+// Load the manifest of the output directory `root`, if there is one.
+// Panics on failure.
+struct manifest *manifest_load(const char *root);
+
+// Record that `path` (which is below `root`) now holds `size` bytes hashing
+// to `hash`, produced from `source`.
+void manifest_add(struct manifest *m, const char *path, const git_oid *source, const git_oid *hash, uint64_t size);
+
+// Record every file listed by the manifest of the output directory `root`, as
+// if each had been added with manifest_add(). Paths stay relative, so the
+// files are expected to have been moved to the same place below the root of
+// `m`. Does nothing if `root` has no manifest.
+// Panics on failure.
+void manifest_add_all(struct manifest *m, const char *root);
+
+// Write the manifest and the delta since the last write. Both are replaced
+// atomically.
+// Panics on failure.
+void manifest_write(struct manifest *m);
+
+// Free the manifest.
+void manifest_free(struct manifest *m);
+
+#endif
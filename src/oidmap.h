@@ -0,0 +1,44 @@
+#ifndef OIDMAP_H
+#define OIDMAP_H
+
+//
+// This module defines a hash map from git object ids to pointers. It is used
+// to remember work which has already been done for a given blob, so it isn't
+// repeated for every commit the blob appears in.
+//
+// The map is not thread-safe.
+//
+
+#include <git2.h>    // git_oid
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+
+struct oidmap_entry {
+	git_oid key;
+	void *value;
+	bool used;
+};
+
+struct oidmap {
+	struct oidmap_entry *entries;
+	size_t capacity;
+	size_t count;
+};
+
+// Look up `key`. Returns a pointer to the value slot, or NULL if the key is
+// not in the map. The pointer is invalidated by the next insertion.
+void **oidmap_get(const struct oidmap *map, const git_oid *key);
+
+// Look up `key`, inserting it with a NULL value if it is not present.
+// Returns a pointer to the value slot, which is invalidated by the next
+// insertion. If `inserted` is not NULL, it is set to whether the key was new.
+// Panics on failure to allocate.
+void **oidmap_put(struct oidmap *map, const git_oid *key, bool *inserted);
+
+// Remove `key` from the map, if present. Invalidates pointers to value slots.
+void oidmap_remove(struct oidmap *map, const git_oid *key);
+
+// Free the memory used by the map itself. Values are not freed.
+void oidmap_destroy(struct oidmap *map);
+
+#endif
@@ -0,0 +1,445 @@
+#include "pagecache.h"
+
+#include "die.h"        // die*
+#include <errno.h>      // errno, EINTR
+#include <fcntl.h>      // open, fcntl, struct flock
+#include <stdatomic.h>  // atomic_*
+#include <stdbool.h>    // bool
+#include <stdlib.h>     // calloc, realloc, free
+#include <string.h>     // memcmp, memcpy, strdup
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat
+#include <unistd.h>     // ftruncate, pread, close
+
+#define MAGIC   "swpages"
+#define VERSION 1
+
+// Bytes of page contents per chunk.
+#define CHUNK_SIZE 1024
+
+// Entries per set of the hash table.
+#define WAYS 8
+
+// How many chunks an entry is assumed to take when sizing a new file.
+#define CHUNKS_PER_ENTRY 4
+
+// A lookup which keeps seeing an entry change gives up after this many tries.
+#define MAX_TRIES 4
+
+// Ends a chain of chunks.
+#define NO_CHUNK UINT32_MAX
+
+struct slot {
+	// Odd while the entry is being changed.
+	_Atomic uint32_t seq;
+
+	// Set by lookups, cleared by the CLOCK hands.
+	_Atomic uint32_t referenced;
+
+	// The rest is only meaningful if `full` is set.
+	uint32_t full;
+	uint32_t first; // The first chunk of the page.
+	uint64_t len;
+	git_oid key;
+};
+
+struct set {
+	struct slot ways[WAYS];
+	uint32_t hand; // The next way considered for eviction.
+};
+
+struct header {
+	char magic[8];
+	uint32_t version;
+	uint32_t slot_size; // Tells builds with another git_oid apart.
+	uint32_t set_count;
+	uint32_t chunk_count;
+	uint64_t tag;
+
+	// The rest is only used with the file locked.
+
+	// Set while the cache is being changed, so if a process dies doing
+	// so, the next one to lock the file knows to repair it.
+	uint32_t dirty;
+
+	// Free chunks are chained like the chunks of a page.
+	uint32_t free_chunk;
+	uint32_t free_count;
+
+	// The next entry considered for eviction when chunks run out, as an
+	// index into all slots.
+	uint32_t hand;
+};
+
+struct page_cache {
+	char *path;
+	int fd;
+	char *map;
+	size_t size;
+
+	struct header *header;
+	struct set *sets;
+	uint32_t *next; // The chunk after each chunk.
+	char *chunks;
+
+	// Copied from the header, which is shared.
+	uint32_t set_count;
+	uint32_t chunk_count;
+};
+
+static size_t align(size_t n) {
+	return (n + 63) & ~(size_t)63;
+}
+
+// Returns the size of a file with the given geometry, and where its parts go.
+static size_t layout(uint32_t set_count, uint32_t chunk_count, size_t *sets_at, size_t *next_at, size_t *chunks_at) {
+	*sets_at = align(sizeof(struct header));
+	*next_at = align(*sets_at + (size_t)set_count * sizeof(struct set));
+	*chunks_at = align(*next_at + (size_t)chunk_count * sizeof(uint32_t));
+	return *chunks_at + (size_t)chunk_count * CHUNK_SIZE;
+}
+
+static size_t chunks_for(size_t len) {
+	return (len + CHUNK_SIZE - 1) / CHUNK_SIZE;
+}
+
+static struct set *set_of(struct page_cache *cache, const git_oid *key) {
+	// Object ids are random enough as they are.
+	uint64_t hash;
+	memcpy(&hash, key->id, sizeof(hash));
+	return &cache->sets[hash % cache->set_count];
+}
+
+static struct slot *slot_at(struct page_cache *cache, uint32_t index) {
+	return &cache->sets[index / WAYS].ways[index % WAYS];
+}
+
+// Changes to an entry are bracketed by these. A lookup which reads anything
+// written after begin_change() sees the sequence number change.
+static void begin_change(struct slot *slot) {
+	uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+static void end_change(struct slot *slot) {
+	uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_relaxed);
+	atomic_store_explicit(&slot->seq, seq + 1, memory_order_release);
+}
+
+// Move the `count` chunks starting at `first` to the free list.
+static void free_chunks(struct page_cache *cache, uint32_t first, size_t count) {
+	if (count == 0) {
+		return;
+	}
+	uint32_t last = first;
+	for (size_t i = 1; i < count; ++i) {
+		last = cache->next[last];
+	}
+	cache->next[last] = cache->header->free_chunk;
+	cache->header->free_chunk = first;
+	cache->header->free_count += (uint32_t)count;
+}
+
+// Take `count` chunks off the free list, which must have that many.
+static uint32_t allocate_chunks(struct page_cache *cache, size_t count) {
+	if (count == 0) {
+		return NO_CHUNK;
+	}
+	uint32_t first = cache->header->free_chunk;
+	uint32_t last = first;
+	for (size_t i = 1; i < count; ++i) {
+		last = cache->next[last];
+	}
+	cache->header->free_chunk = cache->next[last];
+	cache->header->free_count -= (uint32_t)count;
+	cache->next[last] = NO_CHUNK;
+	return first;
+}
+
+static void evict(struct page_cache *cache, struct slot *slot) {
+	begin_change(slot);
+	slot->full = 0;
+	end_change(slot);
+	free_chunks(cache, slot->first, chunks_for(slot->len));
+}
+
+// Empty the cache.
+static void clear(struct page_cache *cache) {
+	for (uint32_t i = 0; i < cache->set_count * WAYS; ++i) {
+		struct slot *slot = slot_at(cache, i);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) % 2 == 0) {
+			begin_change(slot);
+		}
+		slot->full = 0;
+		end_change(slot);
+	}
+	for (uint32_t i = 0; i < cache->chunk_count; ++i) {
+		cache->next[i] = (i + 1 < cache->chunk_count) ? i + 1 : NO_CHUNK;
+	}
+	cache->header->free_chunk = 0;
+	cache->header->free_count = cache->chunk_count;
+	cache->header->hand = 0;
+}
+
+// Undo whatever a process which died while changing the cache left behind:
+// finish its changes to entries by emptying them, and find the chunks which
+// are free. Returns false if the cache is beyond repair.
+static bool repair(struct page_cache *cache) {
+	bool *used = calloc(cache->chunk_count, sizeof(*used));
+	if (used == NULL) {
+		die("failed to allocate chunk map");
+	}
+	bool ok = true;
+	for (uint32_t i = 0; i < cache->set_count * WAYS && ok; ++i) {
+		struct slot *slot = slot_at(cache, i);
+		if (atomic_load_explicit(&slot->seq, memory_order_relaxed) % 2 != 0) {
+			slot->full = 0;
+			end_change(slot);
+		}
+		if (!slot->full) {
+			continue;
+		}
+		uint32_t chunk = slot->first;
+		for (size_t n = chunks_for(slot->len); n > 0 && ok; --n) {
+			ok = chunk < cache->chunk_count && !used[chunk];
+			if (ok) {
+				used[chunk] = true;
+				chunk = cache->next[chunk];
+			}
+		}
+	}
+
+	cache->header->free_chunk = NO_CHUNK;
+	cache->header->free_count = 0;
+	for (uint32_t i = cache->chunk_count; ok && i-- > 0;) {
+		if (!used[i]) {
+			free_chunks(cache, i, 1);
+		}
+	}
+	free(used);
+	return ok;
+}
+
+static void lock_file(struct page_cache *cache, short type) {
+	struct flock lock = { .l_type = type, .l_whence = SEEK_SET };
+	while (fcntl(cache->fd, F_SETLKW, &lock) < 0) {
+		if (errno != EINTR) {
+			die_errno("failed to lock %s", cache->path);
+		}
+	}
+}
+
+// Lock the cache for changing it.
+static void lock(struct page_cache *cache) {
+	lock_file(cache, F_WRLCK);
+	if (cache->header->dirty && !repair(cache)) {
+		clear(cache);
+	}
+	cache->header->dirty = 1;
+}
+
+static void unlock(struct page_cache *cache) {
+	cache->header->dirty = 0;
+	lock_file(cache, F_UNLCK);
+}
+
+// Make way for a page in the entries of `set`, evicting one if they are all
+// taken. The CLOCK hand of the set spares entries which were used since it
+// last passed them, but only once.
+static struct slot *take_slot(struct page_cache *cache, struct set *set) {
+	for (int i = 0; i < WAYS; ++i) {
+		if (!set->ways[i].full) {
+			return &set->ways[i];
+		}
+	}
+	while (true) {
+		struct slot *slot = &set->ways[set->hand];
+		set->hand = (set->hand + 1) % WAYS;
+		if (atomic_exchange_explicit(&slot->referenced, 0, memory_order_relaxed) == 0) {
+			evict(cache, slot);
+			return slot;
+		}
+	}
+}
+
+// Evict entries until `count` chunks are free, with a hand which goes around
+// all entries like the hands of the sets do. Since lookups may keep marking
+// entries as used, the hand stops sparing them after going around twice.
+static void free_up(struct page_cache *cache, size_t count) {
+	struct header *header = cache->header;
+	uint32_t slot_count = cache->set_count * WAYS;
+	for (uint64_t steps = 0; header->free_count < count; ++steps) {
+		struct slot *slot = slot_at(cache, header->hand);
+		header->hand = (header->hand + 1) % slot_count;
+		if (slot->full && (atomic_exchange_explicit(&slot->referenced, 0, memory_order_relaxed) == 0 || steps >= 2 * (uint64_t)slot_count)) {
+			evict(cache, slot);
+		}
+	}
+}
+
+struct page_cache *page_cache_open(const char *path, size_t max_bytes, uint64_t tag) {
+	struct page_cache *cache = calloc(1, sizeof(*cache));
+	if (cache == NULL || (cache->path = strdup(path)) == NULL) {
+		die("failed to allocate page cache");
+	}
+	cache->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (cache->fd < 0) {
+		die_errno("failed to open %s", path);
+	}
+	lock_file(cache, F_WRLCK);
+
+	// Use the file as it is if it looks like one of ours.
+	struct header header;
+	struct stat st;
+	if (fstat(cache->fd, &st) < 0) {
+		die_errno("failed to stat %s", path);
+	}
+	size_t sets_at, next_at, chunks_at;
+	bool valid = pread(cache->fd, &header, sizeof(header), 0) == sizeof(header) &&
+	             memcmp(header.magic, MAGIC, sizeof(header.magic)) == 0 &&
+	             header.version == VERSION &&
+	             header.slot_size == sizeof(struct slot) &&
+	             header.set_count > 0 && header.chunk_count > 0 &&
+	             (size_t)st.st_size == layout(header.set_count, header.chunk_count, &sets_at, &next_at, &chunks_at);
+	if (!valid) {
+		size_t per_chunk = CHUNK_SIZE + sizeof(uint32_t) + sizeof(struct set) / (WAYS * CHUNKS_PER_ENTRY);
+		size_t chunk_count = (max_bytes > sizeof(header)) ? (max_bytes - sizeof(header)) / per_chunk : 0;
+		if (chunk_count < WAYS * CHUNKS_PER_ENTRY) {
+			chunk_count = WAYS * CHUNKS_PER_ENTRY;
+		} else if (chunk_count >= NO_CHUNK) {
+			chunk_count = NO_CHUNK - 1;
+		}
+		header.chunk_count = (uint32_t)chunk_count;
+		header.set_count = (uint32_t)(chunk_count / (WAYS * CHUNKS_PER_ENTRY));
+		size_t size = layout(header.set_count, header.chunk_count, &sets_at, &next_at, &chunks_at);
+		if (ftruncate(cache->fd, 0) < 0 || ftruncate(cache->fd, (off_t)size) < 0) {
+			die_errno("failed to size %s", path);
+		}
+	}
+
+	cache->set_count = header.set_count;
+	cache->chunk_count = header.chunk_count;
+	cache->size = layout(cache->set_count, cache->chunk_count, &sets_at, &next_at, &chunks_at);
+	cache->map = mmap(NULL, cache->size, PROT_READ | PROT_WRITE, MAP_SHARED, cache->fd, 0);
+	if (cache->map == MAP_FAILED) {
+		die_errno("failed to map %s", path);
+	}
+	cache->header = (struct header *)cache->map;
+	cache->sets = (struct set *)(cache->map + sets_at);
+	cache->next = (uint32_t *)(cache->map + next_at);
+	cache->chunks = cache->map + chunks_at;
+
+	if (!valid || cache->header->tag != tag) {
+		memcpy(cache->header->magic, MAGIC, sizeof(cache->header->magic));
+		cache->header->version = VERSION;
+		cache->header->slot_size = sizeof(struct slot);
+		cache->header->set_count = cache->set_count;
+		cache->header->chunk_count = cache->chunk_count;
+		cache->header->tag = tag;
+		clear(cache);
+	} else if (cache->header->dirty && !repair(cache)) {
+		clear(cache);
+	}
+	cache->header->dirty = 0;
+	lock_file(cache, F_UNLCK);
+	return cache;
+}
+
+// Copy `len` bytes of page contents from the chunks starting at `chunk`.
+// Returns false if the chain ends early, which happens if it changed while
+// being followed.
+static bool copy_chunks(struct page_cache *cache, char *out, size_t len, uint32_t chunk) {
+	for (size_t offset = 0; offset < len; offset += CHUNK_SIZE) {
+		if (chunk >= cache->chunk_count) {
+			return false;
+		}
+		size_t n = (len - offset < CHUNK_SIZE) ? len - offset : CHUNK_SIZE;
+		memcpy(out + offset, cache->chunks + (size_t)chunk * CHUNK_SIZE, n);
+		chunk = cache->next[chunk];
+	}
+	return true;
+}
+
+char *page_cache_get(struct page_cache *cache, const git_oid *key, size_t *len) {
+	struct set *set = set_of(cache, key);
+	char *page = NULL;
+	for (int i = 0; i < WAYS; ++i) {
+		struct slot *slot = &set->ways[i];
+		for (int tries = 0; tries < MAX_TRIES; ++tries) {
+			uint32_t seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+			if (seq % 2 != 0) {
+				continue;
+			}
+			if (!slot->full || !git_oid_equal(&slot->key, key)) {
+				break;
+			}
+			size_t page_len = slot->len;
+			uint32_t first = slot->first;
+			if (chunks_for(page_len) > cache->chunk_count) {
+				continue;
+			}
+			char *resized = realloc(page, (page_len > 0) ? page_len : 1);
+			if (resized == NULL) {
+				die("failed to allocate page");
+			}
+			page = resized;
+			bool copied = copy_chunks(cache, page, page_len, first);
+
+			// Only keep the copy if nothing changed while making it.
+			atomic_thread_fence(memory_order_acquire);
+			if (copied && atomic_load_explicit(&slot->seq, memory_order_relaxed) == seq) {
+				if (atomic_load_explicit(&slot->referenced, memory_order_relaxed) == 0) {
+					atomic_store_explicit(&slot->referenced, 1, memory_order_relaxed);
+				}
+				*len = page_len;
+				return page;
+			}
+		}
+	}
+	free(page);
+	return NULL;
+}
+
+void page_cache_put(struct page_cache *cache, const git_oid *key, const char *data, size_t len) {
+	size_t count = chunks_for(len);
+	if (count > cache->chunk_count / 2) {
+		return;
+	}
+
+	lock(cache);
+	struct set *set = set_of(cache, key);
+	for (int i = 0; i < WAYS; ++i) {
+		if (set->ways[i].full && git_oid_equal(&set->ways[i].key, key)) {
+			// Another process got here first.
+			unlock(cache);
+			return;
+		}
+	}
+	struct slot *slot = take_slot(cache, set);
+	free_up(cache, count);
+
+	// The chunks are free, so no lookup will accept what it reads from
+	// them until the entry is complete.
+	uint32_t first = allocate_chunks(cache, count);
+	for (size_t offset = 0, chunk = first; offset < len; offset += CHUNK_SIZE, chunk = cache->next[chunk]) {
+		size_t n = (len - offset < CHUNK_SIZE) ? len - offset : CHUNK_SIZE;
+		memcpy(cache->chunks + chunk * CHUNK_SIZE, data + offset, n);
+	}
+
+	begin_change(slot);
+	slot->full = 1;
+	slot->first = first;
+	slot->len = len;
+	git_oid_cpy(&slot->key, key);
+	atomic_store_explicit(&slot->referenced, 0, memory_order_relaxed);
+	end_change(slot);
+	unlock(cache);
+}
+
+void page_cache_close(struct page_cache *cache) {
+	munmap(cache->map, cache->size);
+	close(cache->fd);
+	free(cache->path);
+	free(cache);
+}
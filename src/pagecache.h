@@ -0,0 +1,47 @@
+#ifndef PAGECACHE_H
+#define PAGECACHE_H
+
+//
+// This module defines a cache of rendered pages keyed by blob id, kept in a
+// file which is mapped into memory, so several server processes share one
+// cache and a restarted server starts with the pages rendered before.
+//
+// Page contents are stored in fixed-size chunks. Entries live in a hash
+// table of small sets; when a set or the chunks run out, a CLOCK hand picks
+// entries which haven't been used since it last passed, and evicts them.
+//
+// Lookups take no lock: every entry carries a sequence number which is odd
+// while the entry is being changed, and a lookup which sees it change while
+// copying the page tries again. Changes are serialized by a lock on the file,
+// so they are safe between processes but not between threads of one process.
+//
+// The file is in the native layout of the machine and only meant to be shared
+// between processes of the same build.
+//
+
+#include <git2.h>    // git_oid
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+struct page_cache;
+
+// Map the cache in the file at `path`, creating it if needed. A new file is
+// sized to hold about `max_bytes` bytes, including bookkeeping; an existing
+// one keeps its size. Pages rendered with another `tag` are dropped, so it
+// should identify the renderer and the options which affect its output.
+// Panics if the file can't be opened or mapped.
+struct page_cache *page_cache_open(const char *path, size_t max_bytes, uint64_t tag);
+
+// Look up `key`, marking it as recently used.
+// Returns NULL if there is no such entry. Otherwise returns a copy of the page
+// allocated with malloc(), and stores its length in `len`.
+char *page_cache_get(struct page_cache *cache, const git_oid *key, size_t *len);
+
+// Insert a copy of `data`, unless `key` is already there. Pages too large to
+// ever fit are silently not cached.
+void page_cache_put(struct page_cache *cache, const git_oid *key, const char *data, size_t len);
+
+// Unmap the cache. The file stays.
+void page_cache_close(struct page_cache *cache);
+
+#endif
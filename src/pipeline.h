@@ -0,0 +1,215 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+//
+// This module defines the rendering pipeline. The caller (the walk stage)
+// submits one job per file in each commit. Markup is rendered by a pool of
+// render workers and the results are handed to a single writer thread, which
+// writes files or hardlinks them to earlier, identical outputs. Alternatively
+// the writer can append everything to a bundle (see bundle.h).
+//
+// Files of a commit can be written to a staging directory, which is renamed
+// into place once all of them have been written, so readers never see a
+// commit half-written.
+//
+// The stages are connected by bounded queues, so memory use is bounded by the
+// queue depth rather than the size of the repository, and the walk stage is
+// held back when the later stages cannot keep up. Render workers take the
+// biggest waiting job first, so a huge page submitted late doesn't leave one
+// worker busy long after the others have run out of work. The walk stage can
+// also be held back by the memory the jobs in the pipeline take up.
+//
+
+#include "creole.h"  // struct creole_counters
+#include <git2.h>    // git_oid, git_blob
+#include <stdbool.h> // bool
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+enum job_kind {
+	JOB_MARKUP, // Render blob as Creole.
+	JOB_COPY,   // Copy blob verbatim.
+	JOB_DIFF,   // Render the changes from old_blob to blob.
+	JOB_KIND_COUNT,
+};
+
+// How the gzipped sibling of a JOB_MARKUP job's output is identified in
+// bundles.
+#define OUTPUT_MARKUP_GZIP JOB_KIND_COUNT
+
+// A directory which is written under another name and renamed to `path` when
+// complete. Both paths are owned by the stage, which is freed by the writer
+// once it has been renamed.
+struct stage {
+	char *path;
+	char *staging_path;
+};
+
+struct job {
+	enum job_kind kind;
+
+	// Where the output should be written. Owned by the job. When writing to
+	// a bundle, this is the path within the bundle.
+	char *path;
+
+	// The blob to process. If `blob` is NULL, an earlier job has already
+	// produced output for `oid` and this job's output is linked to that.
+	git_oid oid;
+	struct git_blob *blob;
+
+	// For JOB_DIFF, the earlier revision, or NULL if the file is new. Then
+	// `oid` identifies the pair of blobs rather than `blob` alone.
+	struct git_blob *old_blob;
+
+	// The contents to write. Filled in by the render stage.
+	char *output;
+	size_t output_len;
+
+	// The contents compressed with gzip, if enabled. Also filled in by the
+	// render stage.
+	char *compressed;
+	size_t compressed_len;
+
+	// Hashes of `output` and `compressed`, if a manifest is kept. Also
+	// filled in by the render stage.
+	git_oid output_hash;
+	git_oid compressed_hash;
+
+	// The words of the page, if it is indexed for search. See
+	// search_terms(). Also filled in by the render stage.
+	char *terms;
+	size_t terms_len;
+
+	// The targets of the links on the page, if a link graph is built, each
+	// terminated by a NUL byte. Also filled in by the render stage.
+	char *links;
+	size_t links_len;
+
+	// If not NULL, the file is added to this link graph.
+	struct link_graph *graph;
+
+	// If not NULL, `path` lies below `stage->path`, but the file is written
+	// to the same place below `stage->staging_path` instead.
+	struct stage *stage;
+
+	// If set, the job is no file but a marker submitted after the last file
+	// with the same `graph` and `stage`, saying that there were
+	// `commit_files` of them. Once they have all been written, the graph is
+	// written and the stage renamed into place, and both are freed.
+	bool commit_end;
+	size_t commit_files;
+
+	// Used internally by the pipeline.
+	struct job *next;
+	size_t memory;
+};
+
+struct pipeline_options {
+	// Number of render workers.
+	unsigned jobs;
+
+	// How many jobs may wait between two stages.
+	size_t queue_depth;
+
+	// How many bytes the jobs in the pipeline may take up, roughly, before
+	// pipeline_submit() blocks. A single job may take up more. Zero means
+	// no limit.
+	size_t memory_limit;
+
+	// How many bytes of rendered blocks to keep, so blocks which appear in
+	// several revisions of a page are only rendered once. Zero disables the
+	// cache.
+	size_t block_cache_size;
+
+	// Pages longer than this many bytes are split into pieces rendered by up
+	// to `jobs` threads at once. Zero disables splitting.
+	size_t split_size;
+
+	// How much work rendering a page may take, as creole_options.budget.
+	// Pages exceeding it are written as preformatted text. Zero means no
+	// limit.
+	size_t render_budget;
+
+	// If true, every rendered page is also written compressed with gzip at
+	// the given zlib level, next to the page with ".gz" appended.
+	bool gzip;
+	int gzip_level;
+
+	// If not NULL, output is added to this bundle instead of being written
+	// to files. Only touched by the writer until the pipeline is finished.
+	struct bundle *bundle;
+
+	// If not NULL, every file written is recorded in this manifest. Only
+	// touched by the writer while jobs are outstanding.
+	struct manifest *manifest;
+
+	// If not NULL, every rendered page is added to this search index. Only
+	// touched by the writer while jobs are outstanding.
+	struct search_index *search;
+
+	// If true, the render stage collects the targets of the links on every
+	// page for the link graphs of the jobs.
+	bool links;
+
+	// If not NULL, filled in by pipeline_finish().
+	struct pipeline_stats *stats;
+};
+
+// What the render workers did.
+struct pipeline_stats {
+	// Jobs rendered, and the bytes of source they rendered.
+	size_t rendered;
+	uint64_t bytes;
+
+	// Pages which exceeded the render budget.
+	size_t over_budget;
+
+	// What the parsers did, if counted. See creole_counters_enabled().
+	struct creole_counters counters;
+
+	// Seconds spent rendering, summed over all workers, and from the first
+	// job starting to the last one finishing.
+	double busy;
+	double elapsed;
+
+	// The job which took longest, and how long it took. `slowest_path` is
+	// owned by the caller.
+	char *slowest_path;
+	double slowest;
+};
+
+// What the pipeline holds in memory, in bytes.
+struct pipeline_memory {
+	// Held by jobs which haven't been written yet, the most that has been
+	// at once, and the limit. See pipeline_options.memory_limit.
+	size_t jobs;
+	size_t peak_jobs;
+	size_t jobs_limit;
+
+	// Held by the block cache, and its size.
+	size_t block_cache;
+	size_t block_cache_size;
+};
+
+struct pipeline;
+
+// Start the worker threads.
+// Panics on failure.
+struct pipeline *pipeline_start(const struct pipeline_options *options);
+
+// Hand a job to the pipeline. The pipeline takes ownership of `job` and the
+// reference to its blob. Blocks if the pipeline is saturated.
+void pipeline_submit(struct pipeline *p, struct job *job);
+
+// Wait for all submitted jobs to be written. The pipeline can still be used
+// afterwards.
+void pipeline_wait(struct pipeline *p);
+
+// Get what the pipeline holds in memory right now.
+void pipeline_memory(struct pipeline *p, struct pipeline_memory *usage);
+
+// Wait for all submitted jobs to be written, then stop the worker threads and
+// free the pipeline.
+void pipeline_finish(struct pipeline *p);
+
+#endif
@@ -0,0 +1,167 @@
+#include "queue.h"
+
+#include "die.h"            // die
+#include <assert.h>         // assert
+#include <pthread.h>        // pthread_*
+#include <stdatomic.h>      // atomic_*
+#include <stdbool.h>        // bool
+#include <stdlib.h>         // malloc, free
+
+// This is Dmitry Vyukov's bounded MPMC queue. Each cell carries a sequence
+// number which tells producers and consumers whose turn it is to use it.
+// See: <https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue>
+struct cell {
+	atomic_size_t sequence;
+	void *item;
+};
+
+struct queue {
+	struct cell *cells;
+	size_t mask;
+
+	// Keep the two ends on separate cache lines so producers and consumers
+	// don't fight over the same line.
+	_Alignas(64) atomic_size_t enqueue_pos;
+	_Alignas(64) atomic_size_t dequeue_pos;
+
+	// Slow path for when the queue is full or empty. The waiter counts let
+	// the other end skip the mutex entirely when nobody is sleeping.
+	_Alignas(64) pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+	atomic_uint full_waiters;
+	atomic_uint empty_waiters;
+};
+
+struct queue *queue_create(size_t capacity) {
+	// The capacity must be a power of two so we can mask instead of mod.
+	size_t size = 2;
+	while (size < capacity) {
+		size *= 2;
+	}
+
+	struct queue *q = malloc(sizeof(*q));
+	if (q == NULL) {
+		die("failed to allocate queue");
+	}
+	q->cells = malloc(size * sizeof(*q->cells));
+	if (q->cells == NULL) {
+		die("failed to allocate queue of %zu items", size);
+	}
+	q->mask = size - 1;
+	for (size_t i = 0; i < size; ++i) {
+		atomic_init(&q->cells[i].sequence, i);
+	}
+	atomic_init(&q->enqueue_pos, 0);
+	atomic_init(&q->dequeue_pos, 0);
+
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	atomic_init(&q->full_waiters, 0);
+	atomic_init(&q->empty_waiters, 0);
+
+	return q;
+}
+
+static bool try_push(struct queue *q, void *item) {
+	size_t pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+	while (true) {
+		struct cell *cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		if (seq == pos) {
+			// The cell is free; try to claim it.
+			if (atomic_compare_exchange_weak_explicit(&q->enqueue_pos, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed)) {
+				cell->item = item;
+				atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+				return true;
+			}
+			// Somebody beat us to it. `pos` was updated by the failed CAS.
+		} else if (seq < pos) {
+			// The cell still holds an item from the previous lap.
+			return false;
+		} else {
+			pos = atomic_load_explicit(&q->enqueue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+static bool try_pop(struct queue *q, void **item) {
+	size_t pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+	while (true) {
+		struct cell *cell = &q->cells[pos & q->mask];
+		size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+		if (seq == pos + 1) {
+			if (atomic_compare_exchange_weak_explicit(&q->dequeue_pos, &pos, pos + 1,
+			                                          memory_order_relaxed, memory_order_relaxed)) {
+				*item = cell->item;
+				atomic_store_explicit(&cell->sequence, pos + q->mask + 1, memory_order_release);
+				return true;
+			}
+		} else if (seq < pos + 1) {
+			// Nothing has been written to this cell yet.
+			return false;
+		} else {
+			pos = atomic_load_explicit(&q->dequeue_pos, memory_order_relaxed);
+		}
+	}
+}
+
+// Wake up anybody sleeping on `cond`.
+//
+// The fence pairs with the one in the sleeping thread: either the sleeper's
+// retry sees our update to the queue, or we see its waiter count.
+static void wake(struct queue *q, pthread_cond_t *cond, atomic_uint *waiters) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(waiters, memory_order_relaxed) > 0) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_broadcast(cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+void queue_push(struct queue *q, void *item) {
+	if (!try_push(q, item)) {
+		pthread_mutex_lock(&q->lock);
+		atomic_fetch_add(&q->full_waiters, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!try_push(q, item)) {
+			pthread_cond_wait(&q->not_full, &q->lock);
+		}
+		atomic_fetch_sub(&q->full_waiters, 1);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	wake(q, &q->not_empty, &q->empty_waiters);
+}
+
+void *queue_pop(struct queue *q) {
+	void *item;
+	if (!try_pop(q, &item)) {
+		pthread_mutex_lock(&q->lock);
+		atomic_fetch_add(&q->empty_waiters, 1);
+		atomic_thread_fence(memory_order_seq_cst);
+		while (!try_pop(q, &item)) {
+			pthread_cond_wait(&q->not_empty, &q->lock);
+		}
+		atomic_fetch_sub(&q->empty_waiters, 1);
+		pthread_mutex_unlock(&q->lock);
+	}
+
+	wake(q, &q->not_full, &q->full_waiters);
+	return item;
+}
+
+size_t queue_capacity(const struct queue *q) {
+	return q->mask + 1;
+}
+
+void queue_destroy(struct queue *q) {
+	assert(q != NULL);
+	pthread_mutex_destroy(&q->lock);
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	free(q->cells);
+	free(q);
+}
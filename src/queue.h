@@ -0,0 +1,33 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+//
+// This module defines a bounded, multi-producer multi-consumer queue of
+// pointers. It is used to connect the stages of the rendering pipeline.
+//
+// Pushing and popping are lock-free as long as the queue is neither full nor
+// empty. Otherwise the caller sleeps on a condition variable until the other
+// end catches up, which gives producers backpressure without spinning.
+//
+
+#include <stddef.h>  // size_t
+
+struct queue;
+
+// Create a queue which can hold at least `capacity` items.
+// Panics on failure to allocate.
+struct queue *queue_create(size_t capacity);
+
+// Push an item, blocking while the queue is full.
+void queue_push(struct queue *q, void *item);
+
+// Pop an item, blocking while the queue is empty.
+void *queue_pop(struct queue *q);
+
+// Returns the number of items which could be held by the queue.
+size_t queue_capacity(const struct queue *q);
+
+// Free the queue. It is an error to destroy a queue which is still in use.
+void queue_destroy(struct queue *q);
+
+#endif
@@ -0,0 +1,1015 @@
+#include "search.h"
+
+#include "die.h"        // die*
+#include "oidmap.h"     // struct oidmap, oidmap_*
+#include <errno.h>      // errno, ENOENT, EEXIST
+#include <fcntl.h>      // open, O_RDONLY
+#include <pthread.h>    // pthread_*
+#include <stdbool.h>    // bool
+#include <stdint.h>     // uint*_t
+#include <stdio.h>      // FILE, fopen, open_memstream, snprintf
+#include <stdlib.h>     // malloc, realloc, free, qsort
+#include <string.h>     // memcmp, memcpy, strcmp, strlen
+#include <sys/mman.h>   // mmap, munmap
+#include <sys/stat.h>   // fstat, mkdir
+#include <unistd.h>     // close, unlink
+
+#define SEGMENT_MAGIC "SWIDX001"
+
+// Merge once there are more segments than this.
+#define MAX_SEGMENTS 8
+
+// Longer words are ignored. They are most likely not words at all.
+#define MAX_WORD 64
+
+// How often to retry a search if a merge removes a segment under our feet.
+#define SEARCH_RETRIES 3
+
+#define HEADER_SIZE  48
+#define RECORD_SIZE  24
+
+//
+// On-disk layout of the header:
+//
+//     0  [8]  magic
+//     8  u32  number of docs
+//    12  u32  number of terms
+//    16  u64  offset of docs
+//    24  u64  offset of terms
+//    32  u64  offset of strings
+//    40  u64  offset of postings
+//
+// And of a term record:
+//
+//     0  u32  offset of the word, relative to the strings
+//     4  u32  length of the word
+//     8  u64  offset of the postings, relative to the postings
+//    16  u32  length of the postings in bytes
+//    20  u32  number of docs containing the word
+//
+
+// A mapped segment.
+struct segment {
+	const unsigned char *map;
+	size_t size;
+
+	uint32_t doc_count;
+	uint32_t term_count;
+	const unsigned char *docs;
+	const unsigned char *terms;
+	const unsigned char *strings;
+	size_t strings_len;
+	const unsigned char *postings;
+	size_t postings_len;
+};
+
+// Builds a segment in memory, to be written with builder_write().
+struct builder {
+	git_oid *docs;
+	size_t doc_count;
+	size_t doc_capacity;
+
+	size_t term_count;
+	FILE *terms;
+	char *terms_buf;
+	size_t terms_len;
+
+	FILE *strings;
+	char *strings_buf;
+	size_t strings_len;
+
+	FILE *postings;
+	char *postings_buf;
+	size_t postings_len;
+};
+
+// A page added since the last flush.
+struct pending {
+	git_oid blob;
+	char *terms;
+	size_t terms_len;
+};
+
+struct search_index {
+	char *path;
+
+	// Blobs which are in some segment or pending. Values are unused.
+	struct oidmap indexed;
+
+	struct pending *pending;
+	size_t pending_count;
+	size_t pending_capacity;
+
+	// Guards everything below, which is shared with the merge thread.
+	pthread_mutex_t lock;
+
+	// Names of the live segments.
+	char **segments;
+	size_t segment_count;
+	unsigned next_id;
+
+	pthread_t merge_thread;
+	bool merge_started;
+	bool merging;
+};
+
+// A list of doc ids.
+struct docs {
+	uint32_t *ids;
+	size_t count;
+	size_t capacity;
+};
+
+static void put_le32(unsigned char *p, uint32_t v) {
+	for (int i = 0; i < 4; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static void put_le64(unsigned char *p, uint64_t v) {
+	for (int i = 0; i < 8; ++i) {
+		p[i] = (unsigned char)(v >> (8 * i));
+	}
+}
+
+static uint32_t get_le32(const unsigned char *p) {
+	uint32_t v = 0;
+	for (int i = 3; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static uint64_t get_le64(const unsigned char *p) {
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; --i) {
+		v = (v << 8) | p[i];
+	}
+	return v;
+}
+
+static char *join(const char *dir, const char *name) {
+	size_t dir_len = strlen(dir), name_len = strlen(name);
+	char *path = malloc(dir_len + 1 + name_len + 1);
+	if (path == NULL) {
+		die("failed to allocate path");
+	}
+	memcpy(path, dir, dir_len);
+	path[dir_len] = '/';
+	memcpy(path + dir_len + 1, name, name_len + 1);
+	return path;
+}
+
+static void docs_push(struct docs *docs, uint32_t id) {
+	if (docs->count == docs->capacity) {
+		docs->capacity = (docs->capacity == 0) ? 64 : docs->capacity * 2;
+		docs->ids = realloc(docs->ids, docs->capacity * sizeof(*docs->ids));
+		if (docs->ids == NULL) {
+			die("failed to grow posting list to %zu entries", docs->capacity);
+		}
+	}
+	docs->ids[docs->count++] = id;
+}
+
+//
+// Extracting words
+//
+
+static bool is_word_byte(unsigned char c) {
+	// Bytes of multi-byte UTF-8 sequences count as letters, so words in
+	// other scripts are indexed too, if not case-folded.
+	return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c >= 0x80;
+}
+
+static int compare_words(const void *a, const void *b) {
+	return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+size_t search_terms(const char *html, size_t html_len, char **terms) {
+	// First collect every word, lowercased and NUL-terminated.
+	char *words;
+	size_t words_len;
+	FILE *out = open_memstream(&words, &words_len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	size_t word_count = 0;
+	for (size_t i = 0; i < html_len; ) {
+		unsigned char c = (unsigned char)html[i];
+		if (c == '<') {
+			// Skip tags, and with them attributes such as URLs.
+			while (i < html_len && html[i] != '>') {
+				i++;
+			}
+		} else if (c == '&') {
+			// Skip entities, which only stand for punctuation here.
+			while (i < html_len && html[i] != ';' && html[i] != ' ') {
+				i++;
+			}
+		} else if (is_word_byte(c)) {
+			size_t start = i;
+			while (i < html_len && is_word_byte((unsigned char)html[i])) {
+				i++;
+			}
+			if (i - start <= MAX_WORD) {
+				for (size_t j = start; j < i; ++j) {
+					char ch = html[j];
+					fputc((ch >= 'A' && ch <= 'Z') ? ch - 'A' + 'a' : ch, out);
+				}
+				fputc('\0', out);
+				word_count += 1;
+			}
+			continue;
+		}
+		i++;
+	}
+	if (fclose(out) == EOF) {
+		die_errno("failed to collect words");
+	}
+
+	// Then sort them and drop duplicates.
+	const char **sorted = malloc((word_count + 1) * sizeof(*sorted));
+	if (sorted == NULL) {
+		die("failed to allocate %zu words", word_count);
+	}
+	const char *p = words;
+	for (size_t i = 0; i < word_count; ++i) {
+		sorted[i] = p;
+		p += strlen(p) + 1;
+	}
+	qsort(sorted, word_count, sizeof(*sorted), compare_words);
+
+	char *result = malloc(words_len + 1);
+	if (result == NULL) {
+		die("failed to allocate words");
+	}
+	size_t result_len = 0;
+	for (size_t i = 0; i < word_count; ++i) {
+		if (i > 0 && strcmp(sorted[i], sorted[i - 1]) == 0) {
+			continue;
+		}
+		size_t len = strlen(sorted[i]) + 1;
+		memcpy(result + result_len, sorted[i], len);
+		result_len += len;
+	}
+
+	free(sorted);
+	free(words);
+	*terms = result;
+	return result_len;
+}
+
+//
+// Reading segments
+//
+
+// Map the segment at `path`. Returns false if it doesn't exist, which
+// happens when a merge removes it.
+static bool segment_open(struct segment *seg, const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		if (errno == ENOENT) {
+			return false;
+		}
+		die_errno("failed to open %s", path);
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+		die_errno("failed to stat %s", path);
+	}
+	seg->size = (size_t)st.st_size;
+	if (seg->size < HEADER_SIZE) {
+		die("%s is not a search index segment", path);
+	}
+	seg->map = mmap(NULL, seg->size, PROT_READ, MAP_SHARED, fd, 0);
+	if (seg->map == MAP_FAILED) {
+		die_errno("failed to map %s", path);
+	}
+	close(fd);
+
+	const unsigned char *h = seg->map;
+	if (memcmp(h, SEGMENT_MAGIC, 8) != 0) {
+		die("%s is not a search index segment", path);
+	}
+	seg->doc_count = get_le32(h + 8);
+	seg->term_count = get_le32(h + 12);
+	uint64_t docs = get_le64(h + 16);
+	uint64_t terms = get_le64(h + 24);
+	uint64_t strings = get_le64(h + 32);
+	uint64_t postings = get_le64(h + 40);
+	if (docs + (uint64_t)seg->doc_count * GIT_OID_RAWSZ > terms
+	    || terms + (uint64_t)seg->term_count * RECORD_SIZE > strings
+	    || strings > postings || postings > seg->size) {
+		die("%s is corrupt", path);
+	}
+	seg->docs = seg->map + docs;
+	seg->terms = seg->map + terms;
+	seg->strings = seg->map + strings;
+	seg->strings_len = postings - strings;
+	seg->postings = seg->map + postings;
+	seg->postings_len = seg->size - postings;
+	return true;
+}
+
+static void segment_close(struct segment *seg) {
+	munmap((void *)seg->map, seg->size);
+}
+
+static void segment_doc(const struct segment *seg, uint32_t doc, git_oid *blob) {
+	memcpy(blob->id, seg->docs + (size_t)doc * GIT_OID_RAWSZ, GIT_OID_RAWSZ);
+}
+
+// Returns the word of term `i`.
+static const char *segment_term(const struct segment *seg, uint32_t i, size_t *len) {
+	const unsigned char *r = seg->terms + (size_t)i * RECORD_SIZE;
+	uint32_t offset = get_le32(r);
+	*len = get_le32(r + 4);
+	if ((uint64_t)offset + *len > seg->strings_len) {
+		die("search index segment is corrupt");
+	}
+	return (const char *)seg->strings + offset;
+}
+
+static int compare_term(const char *a, size_t a_len, const char *b, size_t b_len) {
+	int cmp = memcmp(a, b, (a_len < b_len) ? a_len : b_len);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (a_len > b_len) - (a_len < b_len);
+}
+
+// Find the term for `word`. Returns false if no doc contains it.
+static bool segment_find(const struct segment *seg, const char *word, size_t word_len, uint32_t *term) {
+	uint32_t lo = 0, hi = seg->term_count;
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		size_t len;
+		const char *s = segment_term(seg, mid, &len);
+		int cmp = compare_term(s, len, word, word_len);
+		if (cmp < 0) {
+			lo = mid + 1;
+		} else if (cmp > 0) {
+			hi = mid;
+		} else {
+			*term = mid;
+			return true;
+		}
+	}
+	return false;
+}
+
+// Append the docs containing term `i`, plus `base`, to `docs`.
+static void segment_postings(const struct segment *seg, uint32_t i, uint32_t base, struct docs *docs) {
+	const unsigned char *r = seg->terms + (size_t)i * RECORD_SIZE;
+	uint64_t offset = get_le64(r + 8);
+	uint32_t len = get_le32(r + 16);
+	if (offset + len > seg->postings_len) {
+		die("search index segment is corrupt");
+	}
+
+	const unsigned char *p = seg->postings + offset, *end = p + len;
+	uint32_t doc = 0;
+	while (p < end) {
+		uint32_t delta = 0;
+		for (unsigned shift = 0; ; shift += 7) {
+			if (p == end || shift > 28) {
+				die("search index segment is corrupt");
+			}
+			delta |= (uint32_t)(*p & 0x7f) << shift;
+			if (!(*p++ & 0x80)) {
+				break;
+			}
+		}
+		doc += delta;
+		if (doc >= seg->doc_count) {
+			die("search index segment is corrupt");
+		}
+		docs_push(docs, base + doc);
+	}
+}
+
+// Read the list of live segments in the index at `path`.
+static char **read_segments(const char *path, size_t *count) {
+	*count = 0;
+	char *list_path = join(path, "segments");
+	FILE *in = fopen(list_path, "r");
+	if (in == NULL) {
+		if (errno != ENOENT) {
+			die_errno("failed to open %s", list_path);
+		}
+		free(list_path);
+		return NULL;
+	}
+
+	char **names = NULL;
+	size_t capacity = 0;
+	char *line = NULL;
+	size_t line_size = 0;
+	ssize_t len;
+	while ((len = getline(&line, &line_size, in)) >= 0) {
+		if (len > 0 && line[len - 1] == '\n') {
+			line[--len] = '\0';
+		}
+		if (len == 0) {
+			continue;
+		}
+		if (*count == capacity) {
+			capacity = (capacity == 0) ? 16 : capacity * 2;
+			names = realloc(names, capacity * sizeof(*names));
+			if (names == NULL) {
+				die("failed to allocate segment list");
+			}
+		}
+		names[(*count)++] = strdup(line);
+		if (names[*count - 1] == NULL) {
+			die("failed to copy segment name");
+		}
+	}
+	if (ferror(in)) {
+		die_errno("failed to read %s", list_path);
+	}
+	free(line);
+	fclose(in);
+	free(list_path);
+	return names;
+}
+
+static void free_segments(char **names, size_t count) {
+	for (size_t i = 0; i < count; ++i) {
+		free(names[i]);
+	}
+	free(names);
+}
+
+//
+// Writing segments
+//
+
+static FILE *xopen_memstream(char **buf, size_t *len) {
+	FILE *out = open_memstream(buf, len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	return out;
+}
+
+static void builder_init(struct builder *b) {
+	*b = (struct builder){0};
+	b->terms = xopen_memstream(&b->terms_buf, &b->terms_len);
+	b->strings = xopen_memstream(&b->strings_buf, &b->strings_len);
+	b->postings = xopen_memstream(&b->postings_buf, &b->postings_len);
+}
+
+// Add a doc. Returns its id.
+static uint32_t builder_add_doc(struct builder *b, const git_oid *blob) {
+	if (b->doc_count == b->doc_capacity) {
+		b->doc_capacity = (b->doc_capacity == 0) ? 256 : b->doc_capacity * 2;
+		b->docs = realloc(b->docs, b->doc_capacity * sizeof(*b->docs));
+		if (b->docs == NULL) {
+			die("failed to allocate %zu docs", b->doc_capacity);
+		}
+	}
+	git_oid_cpy(&b->docs[b->doc_count], blob);
+	return (uint32_t)b->doc_count++;
+}
+
+// Add a term. Terms must be added in order, and `docs` must be ascending.
+static void builder_add_term(struct builder *b, const char *word, size_t word_len, const struct docs *docs) {
+	unsigned char r[RECORD_SIZE] = {0};
+	put_le32(r, (uint32_t)ftello(b->strings));
+	put_le32(r + 4, (uint32_t)word_len);
+	fwrite(word, 1, word_len, b->strings);
+
+	off_t start = ftello(b->postings);
+	uint32_t previous = 0;
+	for (size_t i = 0; i < docs->count; ++i) {
+		uint32_t delta = docs->ids[i] - previous;
+		previous = docs->ids[i];
+		do {
+			unsigned char byte = delta & 0x7f;
+			delta >>= 7;
+			fputc(byte | (delta != 0 ? 0x80 : 0), b->postings);
+		} while (delta != 0);
+	}
+	put_le64(r + 8, (uint64_t)start);
+	put_le32(r + 16, (uint32_t)(ftello(b->postings) - start));
+	put_le32(r + 20, (uint32_t)docs->count);
+	fwrite(r, 1, sizeof(r), b->terms);
+	b->term_count += 1;
+}
+
+static void xfwrite(const void *data, size_t len, FILE *out, const char *path) {
+	if (len > 0 && fwrite(data, 1, len, out) < len) {
+		die_errno("failed to write %s", path);
+	}
+}
+
+// Write the segment to `path` and free the builder.
+static void builder_write(struct builder *b, const char *path) {
+	if (fclose(b->terms) == EOF || fclose(b->strings) == EOF || fclose(b->postings) == EOF) {
+		die_errno("failed to build search index segment");
+	}
+
+	uint64_t docs = HEADER_SIZE;
+	uint64_t terms = docs + b->doc_count * GIT_OID_RAWSZ;
+	uint64_t strings = terms + b->terms_len;
+	uint64_t postings = strings + b->strings_len;
+	unsigned char header[HEADER_SIZE];
+	memcpy(header, SEGMENT_MAGIC, 8);
+	put_le32(header + 8, (uint32_t)b->doc_count);
+	put_le32(header + 12, (uint32_t)b->term_count);
+	put_le64(header + 16, docs);
+	put_le64(header + 24, terms);
+	put_le64(header + 32, strings);
+	put_le64(header + 40, postings);
+
+	// Segments are immutable, so they are written under a temporary name
+	// and only appear once complete.
+	size_t temp_len = strlen(path) + 8;
+	char *temp = malloc(temp_len);
+	if (temp == NULL) {
+		die("failed to allocate path");
+	}
+	snprintf(temp, temp_len, "%s.tmp", path);
+	FILE *out = fopen(temp, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", temp);
+	}
+	xfwrite(header, sizeof(header), out, temp);
+	for (size_t i = 0; i < b->doc_count; ++i) {
+		xfwrite(b->docs[i].id, GIT_OID_RAWSZ, out, temp);
+	}
+	xfwrite(b->terms_buf, b->terms_len, out, temp);
+	xfwrite(b->strings_buf, b->strings_len, out, temp);
+	xfwrite(b->postings_buf, b->postings_len, out, temp);
+	if (fclose(out) == EOF) {
+		die_errno("failed to write %s", temp);
+	}
+	if (rename(temp, path) < 0) {
+		die_errno("failed to rename %s", temp);
+	}
+
+	free(temp);
+	free(b->docs);
+	free(b->terms_buf);
+	free(b->strings_buf);
+	free(b->postings_buf);
+}
+
+// Replace the list of live segments. Must hold the lock.
+static void write_segments(struct search_index *index) {
+	char *list_path = join(index->path, "segments");
+	char *temp = join(index->path, "segments.tmp");
+	FILE *out = fopen(temp, "w");
+	if (out == NULL) {
+		die_errno("failed to open %s for writing", temp);
+	}
+	for (size_t i = 0; i < index->segment_count; ++i) {
+		fprintf(out, "%s\n", index->segments[i]);
+	}
+	if (ferror(out) | (fclose(out) == EOF)) {
+		die_errno("failed to write %s", temp);
+	}
+	if (rename(temp, list_path) < 0) {
+		die_errno("failed to replace %s", list_path);
+	}
+	free(temp);
+	free(list_path);
+}
+
+// Allocate a name for a new segment. Must hold the lock.
+static char *new_segment_name(struct search_index *index) {
+	char name[32];
+	snprintf(name, sizeof(name), "seg-%08u", index->next_id++);
+	char *copy = strdup(name);
+	if (copy == NULL) {
+		die("failed to copy segment name");
+	}
+	return copy;
+}
+
+//
+// Merging
+//
+
+struct merge {
+	struct search_index *index;
+	char **names;
+	size_t count;
+};
+
+static void *merge_worker(void *arg) {
+	struct merge *merge = arg;
+	struct search_index *index = merge->index;
+
+	struct segment *segs = calloc(merge->count, sizeof(*segs));
+	uint32_t *bases = calloc(merge->count, sizeof(*bases));
+	uint32_t *cursors = calloc(merge->count, sizeof(*cursors));
+	if (segs == NULL || bases == NULL || cursors == NULL) {
+		die("failed to allocate merge state");
+	}
+
+	// The docs of the merged segment are those of the inputs, one after
+	// the other, so doc ids only have to be offset.
+	struct builder b;
+	builder_init(&b);
+	for (size_t i = 0; i < merge->count; ++i) {
+		char *path = join(index->path, merge->names[i]);
+		if (!segment_open(&segs[i], path)) {
+			die("search index segment %s disappeared", path);
+		}
+		free(path);
+
+		bases[i] = (uint32_t)b.doc_count;
+		for (uint32_t d = 0; d < segs[i].doc_count; ++d) {
+			git_oid blob;
+			segment_doc(&segs[i], d, &blob);
+			builder_add_doc(&b, &blob);
+		}
+	}
+
+	// Merge the sorted term lists.
+	struct docs docs = {0};
+	while (true) {
+		const char *word = NULL;
+		size_t word_len = 0;
+		for (size_t i = 0; i < merge->count; ++i) {
+			if (cursors[i] == segs[i].term_count) {
+				continue;
+			}
+			size_t len;
+			const char *s = segment_term(&segs[i], cursors[i], &len);
+			if (word == NULL || compare_term(s, len, word, word_len) < 0) {
+				word = s;
+				word_len = len;
+			}
+		}
+		if (word == NULL) {
+			break;
+		}
+
+		docs.count = 0;
+		for (size_t i = 0; i < merge->count; ++i) {
+			if (cursors[i] == segs[i].term_count) {
+				continue;
+			}
+			size_t len;
+			const char *s = segment_term(&segs[i], cursors[i], &len);
+			if (compare_term(s, len, word, word_len) == 0) {
+				segment_postings(&segs[i], cursors[i], bases[i], &docs);
+				cursors[i] += 1;
+			}
+		}
+		builder_add_term(&b, word, word_len, &docs);
+	}
+	free(docs.ids);
+
+	pthread_mutex_lock(&index->lock);
+	char *name = new_segment_name(index);
+	pthread_mutex_unlock(&index->lock);
+
+	char *path = join(index->path, name);
+	builder_write(&b, path);
+	free(path);
+	for (size_t i = 0; i < merge->count; ++i) {
+		segment_close(&segs[i]);
+	}
+
+	// Segments may have been added while we were merging, so only replace
+	// the ones we merged.
+	pthread_mutex_lock(&index->lock);
+	size_t count = 0;
+	for (size_t i = 0; i < index->segment_count; ++i) {
+		bool merged = false;
+		for (size_t j = 0; j < merge->count; ++j) {
+			merged |= strcmp(index->segments[i], merge->names[j]) == 0;
+		}
+		if (merged) {
+			free(index->segments[i]);
+		} else {
+			index->segments[count++] = index->segments[i];
+		}
+	}
+	index->segments[count++] = name;
+	index->segment_count = count;
+	write_segments(index);
+	index->merging = false;
+	pthread_mutex_unlock(&index->lock);
+
+	// Searches which already read the old list retry if these are gone.
+	for (size_t i = 0; i < merge->count; ++i) {
+		char *old = join(index->path, merge->names[i]);
+		unlink(old);
+		free(old);
+	}
+
+	free_segments(merge->names, merge->count);
+	free(merge);
+	free(segs);
+	free(bases);
+	free(cursors);
+	return NULL;
+}
+
+// Start merging all segments if there are too many. Must hold the lock.
+static void maybe_merge(struct search_index *index) {
+	if (index->merging || index->segment_count <= MAX_SEGMENTS) {
+		return;
+	}
+	if (index->merge_started) {
+		// The previous merge is done, but its thread must still be reaped.
+		pthread_join(index->merge_thread, NULL);
+		index->merge_started = false;
+	}
+
+	struct merge *merge = calloc(1, sizeof(*merge));
+	if (merge == NULL) {
+		die("failed to allocate merge");
+	}
+	merge->index = index;
+	merge->count = index->segment_count;
+	merge->names = calloc(merge->count, sizeof(*merge->names));
+	if (merge->names == NULL) {
+		die("failed to allocate merge");
+	}
+	for (size_t i = 0; i < merge->count; ++i) {
+		merge->names[i] = strdup(index->segments[i]);
+		if (merge->names[i] == NULL) {
+			die("failed to copy segment name");
+		}
+	}
+
+	index->merging = true;
+	if ((errno = pthread_create(&index->merge_thread, NULL, merge_worker, merge)) != 0) {
+		die_errno("failed to start merge thread");
+	}
+	index->merge_started = true;
+}
+
+//
+// The index
+//
+
+struct search_index *search_open(const char *path) {
+	struct search_index *index = calloc(1, sizeof(*index));
+	if (index == NULL) {
+		die("failed to allocate search index");
+	}
+	index->path = strdup(path);
+	if (index->path == NULL) {
+		die("failed to copy path");
+	}
+	pthread_mutex_init(&index->lock, NULL);
+
+	if (mkdir(path, 0755) < 0 && errno != EEXIST) {
+		die_errno("failed to mkdir %s", path);
+	}
+
+	// Remember what is indexed already, so it isn't indexed again.
+	index->segments = read_segments(path, &index->segment_count);
+	for (size_t i = 0; i < index->segment_count; ++i) {
+		unsigned id;
+		if (sscanf(index->segments[i], "seg-%u", &id) == 1 && id >= index->next_id) {
+			index->next_id = id + 1;
+		}
+
+		char *seg_path = join(path, index->segments[i]);
+		struct segment seg;
+		if (!segment_open(&seg, seg_path)) {
+			die("search index segment %s is missing", seg_path);
+		}
+		for (uint32_t d = 0; d < seg.doc_count; ++d) {
+			git_oid blob;
+			segment_doc(&seg, d, &blob);
+			*oidmap_put(&index->indexed, &blob, NULL) = index;
+		}
+		segment_close(&seg);
+		free(seg_path);
+	}
+
+	return index;
+}
+
+void search_add(struct search_index *index, const git_oid *blob, char *terms, size_t terms_len) {
+	bool inserted;
+	void **slot = oidmap_put(&index->indexed, blob, &inserted);
+	if (!inserted) {
+		free(terms);
+		return;
+	}
+	*slot = index;
+
+	if (index->pending_count == index->pending_capacity) {
+		index->pending_capacity = (index->pending_capacity == 0) ? 256 : index->pending_capacity * 2;
+		index->pending = realloc(index->pending, index->pending_capacity * sizeof(*index->pending));
+		if (index->pending == NULL) {
+			die("failed to allocate %zu pending pages", index->pending_capacity);
+		}
+	}
+	struct pending *p = &index->pending[index->pending_count++];
+	git_oid_cpy(&p->blob, blob);
+	p->terms = terms;
+	p->terms_len = terms_len;
+}
+
+// An occurrence of a word in a pending page.
+struct posting {
+	const char *word;
+	uint32_t doc;
+};
+
+static int compare_postings(const void *a, const void *b) {
+	const struct posting *pa = a, *pb = b;
+	int cmp = strcmp(pa->word, pb->word);
+	if (cmp != 0) {
+		return cmp;
+	}
+	return (pa->doc > pb->doc) - (pa->doc < pb->doc);
+}
+
+void search_flush(struct search_index *index) {
+	if (index->pending_count > 0) {
+		// Invert the pending pages: list every (word, doc) pair and sort
+		// them by word.
+		struct builder b;
+		builder_init(&b);
+		struct posting *postings = NULL;
+		size_t count = 0, capacity = 0;
+		for (size_t i = 0; i < index->pending_count; ++i) {
+			struct pending *p = &index->pending[i];
+			uint32_t doc = builder_add_doc(&b, &p->blob);
+			for (const char *word = p->terms; word < p->terms + p->terms_len; word += strlen(word) + 1) {
+				if (count == capacity) {
+					capacity = (capacity == 0) ? 4096 : capacity * 2;
+					postings = realloc(postings, capacity * sizeof(*postings));
+					if (postings == NULL) {
+						die("failed to allocate %zu postings", capacity);
+					}
+				}
+				postings[count++] = (struct posting){ word, doc };
+			}
+		}
+		qsort(postings, count, sizeof(*postings), compare_postings);
+
+		struct docs docs = {0};
+		for (size_t i = 0; i < count; ) {
+			docs.count = 0;
+			size_t j = i;
+			while (j < count && strcmp(postings[j].word, postings[i].word) == 0) {
+				docs_push(&docs, postings[j].doc);
+				j++;
+			}
+			builder_add_term(&b, postings[i].word, strlen(postings[i].word), &docs);
+			i = j;
+		}
+		free(docs.ids);
+		free(postings);
+
+		pthread_mutex_lock(&index->lock);
+		char *name = new_segment_name(index);
+		pthread_mutex_unlock(&index->lock);
+
+		char *path = join(index->path, name);
+		builder_write(&b, path);
+		free(path);
+
+		for (size_t i = 0; i < index->pending_count; ++i) {
+			free(index->pending[i].terms);
+		}
+		index->pending_count = 0;
+
+		pthread_mutex_lock(&index->lock);
+		index->segments = realloc(index->segments, (index->segment_count + 1) * sizeof(*index->segments));
+		if (index->segments == NULL) {
+			die("failed to grow segment list");
+		}
+		index->segments[index->segment_count++] = name;
+		write_segments(index);
+		pthread_mutex_unlock(&index->lock);
+	}
+
+	pthread_mutex_lock(&index->lock);
+	maybe_merge(index);
+	pthread_mutex_unlock(&index->lock);
+}
+
+void search_close(struct search_index *index) {
+	search_flush(index);
+	if (index->merge_started) {
+		pthread_join(index->merge_thread, NULL);
+	}
+
+	free_segments(index->segments, index->segment_count);
+	free(index->pending);
+	oidmap_destroy(&index->indexed);
+	pthread_mutex_destroy(&index->lock);
+	free(index->path);
+	free(index);
+}
+
+//
+// Searching
+//
+
+// Keep only the ids in `a` which are also in `b`. Both are ascending.
+static void intersect(struct docs *a, const struct docs *b) {
+	size_t count = 0, j = 0;
+	for (size_t i = 0; i < a->count; ++i) {
+		while (j < b->count && b->ids[j] < a->ids[i]) {
+			j++;
+		}
+		if (j < b->count && b->ids[j] == a->ids[i]) {
+			a->ids[count++] = a->ids[i];
+		}
+	}
+	a->count = count;
+}
+
+// Call `found` for every doc in `seg` containing all of `terms`.
+static void search_segment(const struct segment *seg, const char *terms, size_t terms_len,
+                           void (*found)(const git_oid *blob, void *arg), void *arg) {
+	struct docs result = {0}, other = {0};
+	bool first = true;
+	for (const char *word = terms; word < terms + terms_len; word += strlen(word) + 1) {
+		uint32_t term;
+		if (!segment_find(seg, word, strlen(word), &term)) {
+			result.count = 0;
+			break;
+		}
+		struct docs *docs = first ? &result : &other;
+		docs->count = 0;
+		segment_postings(seg, term, 0, docs);
+		if (!first) {
+			intersect(&result, &other);
+		}
+		first = false;
+		if (result.count == 0) {
+			break;
+		}
+	}
+
+	for (size_t i = 0; i < result.count; ++i) {
+		git_oid blob;
+		segment_doc(seg, result.ids[i], &blob);
+		found(&blob, arg);
+	}
+	free(result.ids);
+	free(other.ids);
+}
+
+void search_find(const char *path, char *const *words, size_t word_count,
+                 void (*found)(const git_oid *blob, void *arg), void *arg) {
+	// Normalize the words like those of pages.
+	char *query;
+	size_t query_len;
+	FILE *out = xopen_memstream(&query, &query_len);
+	for (size_t i = 0; i < word_count; ++i) {
+		fprintf(out, "%s ", words[i]);
+	}
+	if (fclose(out) == EOF) {
+		die_errno("failed to build query");
+	}
+	char *terms;
+	size_t terms_len = search_terms(query, query_len, &terms);
+	free(query);
+	if (terms_len == 0) {
+		free(terms);
+		return;
+	}
+
+	// Map every segment before searching any, since a merge may replace
+	// them in the meantime.
+	for (unsigned attempt = 0; attempt < SEARCH_RETRIES; ++attempt) {
+		size_t count;
+		char **names = read_segments(path, &count);
+		struct segment *segs = calloc(count + 1, sizeof(*segs));
+		if (segs == NULL) {
+			die("failed to allocate segments");
+		}
+		size_t opened = 0;
+		for (; opened < count; ++opened) {
+			char *seg_path = join(path, names[opened]);
+			bool ok = segment_open(&segs[opened], seg_path);
+			free(seg_path);
+			if (!ok) {
+				break;
+			}
+		}
+
+		if (opened == count) {
+			for (size_t i = 0; i < count; ++i) {
+				search_segment(&segs[i], terms, terms_len, found, arg);
+			}
+		}
+		for (size_t i = 0; i < opened; ++i) {
+			segment_close(&segs[i]);
+		}
+		free(segs);
+		free_segments(names, count);
+		if (opened == count) {
+			free(terms);
+			return;
+		}
+	}
+	die("search index at %s keeps changing", path);
+}
@@ -0,0 +1,67 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+//
+// This module defines the full-text search index, which maps words to the
+// pages containing them.
+//
+// Pages are identified by the blob they were rendered from, so a page is
+// indexed once no matter how many commits contain it, and searching a
+// commit is a matter of checking which of the matching blobs are in its
+// tree.
+//
+// The index is a directory of immutable segments plus a file "segments"
+// listing the live ones. Each run which renders new pages adds a segment
+// for them. Once there are too many segments, they are merged into one by a
+// background thread. A segment looks like this:
+//
+//     +--------+------+-------+---------+----------+
+//     | header | docs | terms | strings | postings |
+//     +--------+------+-------+---------+----------+
+//
+// The docs are the blob ids of the pages in the segment, so a page is known
+// by its position in this array. The terms are fixed-size records sorted
+// by word, each pointing at the word in the string table and at its
+// postings: the ascending positions of the pages containing the word, stored
+// as LEB128 varints of the difference to the previous position. All
+// integers are little-endian, so a segment is searched straight out of a
+// mapping.
+//
+
+#include <git2.h>    // git_oid
+#include <stddef.h>  // size_t
+
+struct search_index;
+
+// Extract the words of the rendered page `html`, ignoring markup. Sets
+// `terms` to the distinct words, lowercased and sorted, each terminated by a
+// NUL byte, and returns their total length. The caller must free `terms`.
+// Safe to call from any thread.
+size_t search_terms(const char *html, size_t html_len, char **terms);
+
+// Open the index in the directory `path`, creating it if needed.
+// Panics on failure.
+struct search_index *search_open(const char *path);
+
+// Add the page rendered from `blob`, with words as returned by
+// search_terms(). Takes ownership of `terms`. Pages which are already in the
+// index are ignored.
+void search_add(struct search_index *index, const git_oid *blob, char *terms, size_t terms_len);
+
+// Write a segment with the pages added since the last flush, and start
+// merging segments in the background if there are too many.
+// Panics on failure.
+void search_flush(struct search_index *index);
+
+// Flush the index, wait for merging to finish and free the index.
+// Panics on failure.
+void search_close(struct search_index *index);
+
+// Call `found` with the blob id of every page in the index at `path` which
+// contains all of the given words. The words are normalized the same way as
+// by search_terms().
+// Panics on failure.
+void search_find(const char *path, char *const *words, size_t word_count,
+                 void (*found)(const git_oid *blob, void *arg), void *arg);
+
+#endif
@@ -0,0 +1,762 @@
+#include "serve.h"
+
+#include "bundle.h"       // struct bundle_reader, bundle_reader_*
+#include "creole.h"       // render_creole_ext, CREOLE_*
+#include "die.h"          // die*
+#include "lru.h"          // struct lru, lru_*
+#include "pagecache.h"    // struct page_cache, page_cache_*
+#include "pipeline.h"     // JOB_MARKUP, OUTPUT_MARKUP_GZIP
+#include "strutil.h"      // endswith
+#include <errno.h>        // errno, EAGAIN, EINTR
+#include <fcntl.h>        // fcntl, O_NONBLOCK
+#include <limits.h>       // SSIZE_MAX
+#include <netdb.h>        // getaddrinfo
+#include <poll.h>         // poll, struct pollfd
+#include <signal.h>       // signal, SIGPIPE
+#include <stdbool.h>      // bool
+#include <stdint.h>       // uint64_t
+#include <stdio.h>        // FILE, open_memstream, fprintf
+#include <stdlib.h>       // malloc, free
+#include <string.h>       // memcmp, memmove, strchr, strstr
+#include <strings.h>      // strcasecmp, strncasecmp
+#include <sys/socket.h>   // socket, bind, listen, accept
+#include <unistd.h>       // read, write, close, fork
+#ifdef __linux__
+#include <sys/sendfile.h> // sendfile
+#endif
+
+// Upper bounds which keep a misbehaving client from hogging the server.
+#define MAX_CONNECTIONS  256
+#define MAX_REQUEST      8192
+
+struct connection {
+	int fd;
+
+	// Bytes received but not yet handled.
+	char in[MAX_REQUEST];
+	size_t in_len;
+
+	// The response currently being sent.
+	char *out;
+	size_t out_len;
+	size_t out_sent;
+
+	// When serving a bundle, the body is sent straight from the bundle
+	// after `out`, which then only holds the headers.
+	uint64_t body_offset;
+	uint64_t body_remaining;
+
+	bool keep_alive;
+};
+
+struct server {
+	// Pages come either from the repository or from a bundle.
+	struct git_repository *repo;
+	struct bundle_reader *bundle;
+
+	const struct serve_options *options;
+
+	// Rendered pages are cached in one or the other.
+	struct lru *cache;
+	struct page_cache *pages;
+
+	// fds[0] is the listening socket. The rest are connections, in the
+	// same order as `connections`.
+	struct pollfd fds[1 + MAX_CONNECTIONS];
+	struct connection *connections[1 + MAX_CONNECTIONS];
+	size_t count;
+};
+
+// A parsed request.
+struct request {
+	const char *method;
+	char *target;
+	const char *if_none_match;
+	bool head;
+	bool accept_gzip;
+};
+
+// A response to be sent.
+struct response {
+	int status;
+	const char *reason;
+	const char *content_type;
+	const char *content_encoding;
+	const char *etag;
+	const char *body;
+	size_t body_len;
+
+	// If not NULL, the body is this entry of the bundle instead.
+	const struct bundle_entry *entry;
+};
+
+static const struct {
+	const char *suffix, *type;
+} content_types[] = {
+	{ ".html", "text/html; charset=utf-8" },
+	{ ".css",  "text/css" },
+	{ ".js",   "text/javascript" },
+	{ ".txt",  "text/plain; charset=utf-8" },
+	{ ".png",  "image/png" },
+	{ ".jpg",  "image/jpeg" },
+	{ ".jpeg", "image/jpeg" },
+	{ ".gif",  "image/gif" },
+	{ ".svg",  "image/svg+xml" },
+	{ ".gz",   "application/gzip" },
+};
+
+static const char *content_type(const char *path) {
+	for (size_t i = 0; i < sizeof(content_types)/sizeof(content_types[0]); ++i) {
+		if (endswith(path, content_types[i].suffix)) {
+			return content_types[i].type;
+		}
+	}
+	return "application/octet-stream";
+}
+
+static void set_nonblocking(int fd) {
+	int flags = fcntl(fd, F_GETFL);
+	if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		die_errno("failed to make socket non-blocking");
+	}
+}
+
+static int listen_on(const char *address, const char *port) {
+	struct addrinfo hints = {
+		.ai_family = AF_UNSPEC,
+		.ai_socktype = SOCK_STREAM,
+		.ai_flags = AI_PASSIVE,
+	};
+	struct addrinfo *info;
+	int ret = getaddrinfo(address, port, &hints, &info);
+	if (ret != 0) {
+		die("failed to resolve %s:%s: %s", address, port, gai_strerror(ret));
+	}
+
+	int fd = -1;
+	for (struct addrinfo *ai = info; ai != NULL; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0) {
+			continue;
+		}
+		int yes = 1;
+		setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+		if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, SOMAXCONN) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(info);
+	if (fd < 0) {
+		die_errno("failed to listen on %s:%s", address, port);
+	}
+
+	set_nonblocking(fd);
+	return fd;
+}
+
+// Queue `response` for sending on `c`.
+static void respond(struct connection *c, const struct request *req, const struct response *res) {
+	FILE *out = open_memstream(&c->out, &c->out_len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream");
+	}
+
+	uint64_t body_len = (res->entry != NULL) ? res->entry->length : res->body_len;
+	fprintf(out, "HTTP/1.1 %d %s\r\n", res->status, res->reason);
+	fprintf(out, "Content-Length: %llu\r\n", (unsigned long long)body_len);
+	if (res->content_type != NULL) {
+		fprintf(out, "Content-Type: %s\r\n", res->content_type);
+	}
+	if (res->content_encoding != NULL) {
+		fprintf(out, "Content-Encoding: %s\r\n", res->content_encoding);
+		fputs("Vary: Accept-Encoding\r\n", out);
+	}
+	if (res->etag != NULL) {
+		fprintf(out, "ETag: \"%s\"\r\n", res->etag);
+	}
+	if (!c->keep_alive) {
+		fputs("Connection: close\r\n", out);
+	}
+	fputs("\r\n", out);
+	c->body_offset = 0;
+	c->body_remaining = 0;
+	if ((req == NULL || !req->head) && res->entry != NULL) {
+		c->body_offset = res->entry->offset;
+		c->body_remaining = res->entry->length;
+	} else if ((req == NULL || !req->head) && res->body_len > 0) {
+		fwrite(res->body, 1, res->body_len, out);
+	}
+
+	if (fclose(out) == EOF) {
+		die_errno("failed to build response");
+	}
+	c->out_sent = 0;
+
+	if (req != NULL) {
+		printf("%s %s %d\n", req->method, req->target, res->status);
+	}
+}
+
+static void respond_error(struct connection *c, const struct request *req, int status, const char *reason) {
+	struct response res = {
+		.status = status,
+		.reason = reason,
+		.content_type = "text/plain; charset=utf-8",
+		.body = reason,
+		.body_len = strlen(reason),
+	};
+	respond(c, req, &res);
+}
+
+// Decode %XX escapes in place. Returns false on malformed input.
+static bool percent_decode(char *s) {
+	char *out = s;
+	for (char *p = s; *p != '\0'; ++p) {
+		if (*p == '%') {
+			unsigned value;
+			if (sscanf(p + 1, "%2x", &value) != 1 || value == 0) {
+				return false;
+			}
+			*out++ = (char)value;
+			p += 2;
+		} else {
+			*out++ = *p;
+		}
+	}
+	*out = '\0';
+	return true;
+}
+
+// Returns true if the client already has the representation tagged `etag`.
+static bool etag_matches(const char *if_none_match, const char *etag) {
+	if (if_none_match == NULL) {
+		return false;
+	}
+	if (strcmp(if_none_match, "*") == 0) {
+		return true;
+	}
+	// Good enough for lists of tags too, as our tags never contain quotes.
+	char quoted[GIT_OID_HEXSZ + 24];
+	snprintf(quoted, sizeof(quoted), "\"%s\"", etag);
+	return strstr(if_none_match, quoted) != NULL;
+}
+
+// Look up the blob at `path` in `tree`. Returns NULL if there is none.
+static struct git_blob *lookup_blob(struct server *s, struct git_tree *tree, const char *path) {
+	git_tree_entry *entry;
+	if (git_tree_entry_bypath(&entry, tree, path) < 0) {
+		return NULL;
+	}
+
+	struct git_blob *blob = NULL;
+	if (git_tree_entry_type(entry) == GIT_OBJECT_BLOB) {
+		if (git_blob_lookup(&blob, s->repo, git_tree_entry_id(entry)) < 0) {
+			blob = NULL;
+		}
+	}
+	git_tree_entry_free(entry);
+	return blob;
+}
+
+// Returns the options pages are rendered with.
+static struct creole_options render_options(const struct server *s) {
+	return (struct creole_options){
+		.max_depth = CREOLE_MAX_DEPTH,
+		.budget = s->options->render_budget,
+	};
+}
+
+// Returns a hash of the renderer version and of the options which affect its
+// output, so a cache file doesn't serve pages rendered otherwise.
+static uint64_t render_tag(const struct server *s) {
+	struct creole_options options = render_options(s);
+	uint64_t values[] = { CREOLE_VERSION, options.max_depth, options.budget };
+	// FNV-1a.
+	uint64_t h = 14695981039346656037ULL;
+	for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+		for (int shift = 0; shift < 64; shift += 8) {
+			h = (h ^ ((values[i] >> shift) & 0xff)) * 1099511628211ULL;
+		}
+	}
+	return h;
+}
+
+// Returns the rendered contents of `blob`, rendering it if it isn't cached.
+// The result is valid until the next call.
+static const char *render_blob(struct server *s, struct git_blob *blob, size_t *len, char **to_free) {
+	*to_free = NULL;
+	if (s->pages != NULL) {
+		// Pages in the shared cache may change under us, so we get a copy.
+		*to_free = page_cache_get(s->pages, git_blob_id(blob), len);
+		if (*to_free != NULL) {
+			return *to_free;
+		}
+	} else {
+		const char *cached = lru_get(s->cache, git_blob_id(blob), len);
+		if (cached != NULL) {
+			return cached;
+		}
+	}
+
+	char *html;
+	FILE *out = open_memstream(&html, len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	struct creole_options options = render_options(s);
+	render_creole_ext(out, git_blob_rawcontent(blob), git_blob_rawsize(blob), &options);
+	if (fclose(out) == EOF) {
+		die_errno("failed to render %s", git_oid_tostr_s(git_blob_id(blob)));
+	}
+
+	if (s->pages != NULL) {
+		page_cache_put(s->pages, git_blob_id(blob), html, *len);
+		*to_free = html;
+	} else if (!lru_put(s->cache, git_blob_id(blob), html, *len)) {
+		// Too large to cache. The caller must free it.
+		*to_free = html;
+	}
+	return html;
+}
+
+// Serve `path` of the commit `revision` out of the bundle.
+static void handle_bundle_get(struct server *s, struct connection *c, struct request *req, const char *revision, int revision_len, const char *path) {
+	char latest[GIT_OID_HEXSZ + 1];
+	if (revision_len == 6 && memcmp(revision, "latest", 6) == 0) {
+		const git_oid *oid = bundle_reader_latest(s->bundle);
+		if (oid == NULL) {
+			respond_error(c, req, 404, "Not Found");
+			return;
+		}
+		git_oid_tostr(latest, sizeof(latest), oid);
+		revision = latest;
+		revision_len = GIT_OID_HEXSZ;
+	}
+
+	// Bundles are indexed by "<commit sha>/<path>", so only full commit
+	// ids can be looked up.
+	char *key;
+	size_t key_len;
+	FILE *out = open_memstream(&key, &key_len);
+	if (out == NULL) {
+		die_errno("failed to open memory stream");
+	}
+	fprintf(out, "%.*s/%s.gz", revision_len, revision, path);
+	if (fclose(out) == EOF) {
+		die_errno("failed to build bundle path");
+	}
+
+	// Send the precompressed page if there is one and the client takes it.
+	struct bundle_entry entry;
+	bool found = false;
+	if (req->accept_gzip && endswith(path, ".html")) {
+		found = bundle_reader_find(s->bundle, key, key_len, &entry);
+	}
+	if (!found) {
+		found = bundle_reader_find(s->bundle, key, key_len - 3, &entry);
+	}
+	free(key);
+	if (!found) {
+		respond_error(c, req, 404, "Not Found");
+		return;
+	}
+
+	// Same tags as when rendering from the repository.
+	char etag[GIT_OID_HEXSZ + 16];
+	git_oid_tostr(etag, GIT_OID_HEXSZ + 1, &entry.blob);
+	if (entry.kind == JOB_MARKUP) {
+		strcat(etag, ".html");
+	} else if (entry.kind == OUTPUT_MARKUP_GZIP) {
+		strcat(etag, ".html.gz");
+	}
+
+	struct response res = {
+		.status = 200,
+		.reason = "OK",
+		.content_type = content_type(path),
+		.etag = etag,
+		.entry = &entry,
+	};
+	if (entry.kind == OUTPUT_MARKUP_GZIP && endswith(path, ".html")) {
+		res.content_encoding = "gzip";
+	}
+	if (etag_matches(req->if_none_match, etag)) {
+		res.status = 304;
+		res.reason = "Not Modified";
+		res.content_type = NULL;
+		res.entry = NULL;
+	}
+	respond(c, req, &res);
+}
+
+static void handle_get(struct server *s, struct connection *c, struct request *req) {
+	// Drop the query string, if any.
+	char *query = strchr(req->target, '?');
+	if (query != NULL) {
+		*query = '\0';
+	}
+
+	if (req->target[0] != '/' || !percent_decode(req->target)) {
+		respond_error(c, req, 400, "Bad Request");
+		return;
+	}
+
+	// Split /<revision>/<path>.
+	char *revision = req->target + 1;
+	char *slash = strchr(revision, '/');
+	if (slash == NULL || slash[1] == '\0') {
+		respond_error(c, req, 404, "Not Found");
+		return;
+	}
+	const char *path = slash + 1;
+	if (s->bundle != NULL) {
+		handle_bundle_get(s, c, req, revision, (int)(slash - revision), path);
+		return;
+	}
+	*slash = '\0';
+	if (strcmp(revision, "latest") == 0) {
+		revision = (char *)s->options->latest;
+	}
+
+	git_object *obj, *tree = NULL;
+	if (git_revparse_single(&obj, s->repo, revision) < 0) {
+		*slash = '/';
+		respond_error(c, req, 404, "Not Found");
+		return;
+	}
+	if (git_object_peel(&tree, obj, GIT_OBJECT_TREE) < 0) {
+		git_object_free(obj);
+		*slash = '/';
+		respond_error(c, req, 404, "Not Found");
+		return;
+	}
+	git_object_free(obj);
+	*slash = '/'; // Restore the target for logging.
+
+	// Prefer rendering markup, like the static output does.
+	struct git_blob *blob = NULL;
+	bool markup = false;
+	if (endswith(path, ".html")) {
+		size_t path_len = strlen(path);
+		char *source_path = malloc(path_len);
+		if (source_path == NULL) {
+			die("failed to allocate path");
+		}
+		memcpy(source_path, path, path_len - 5);
+		strcpy(source_path + path_len - 5, ".txt");
+		blob = lookup_blob(s, (struct git_tree *)tree, source_path);
+		free(source_path);
+
+		if (blob != NULL && git_blob_is_binary(blob)) {
+			git_blob_free(blob);
+			blob = NULL;
+		}
+		markup = (blob != NULL);
+	}
+	if (blob == NULL) {
+		blob = lookup_blob(s, (struct git_tree *)tree, path);
+	}
+	git_object_free(tree);
+	if (blob == NULL) {
+		respond_error(c, req, 404, "Not Found");
+		return;
+	}
+
+	// The blob id identifies the content, and the suffix tells the rendered
+	// and raw representations of the same blob apart.
+	char etag[GIT_OID_HEXSZ + 8];
+	git_oid_tostr(etag, GIT_OID_HEXSZ + 1, git_blob_id(blob));
+	if (markup) {
+		strcat(etag, ".html");
+	}
+
+	struct response res = {
+		.status = 200,
+		.reason = "OK",
+		.content_type = content_type(path),
+		.etag = etag,
+	};
+	char *to_free = NULL;
+	if (etag_matches(req->if_none_match, etag)) {
+		res.status = 304;
+		res.reason = "Not Modified";
+		res.content_type = NULL;
+	} else if (markup) {
+		res.body = render_blob(s, blob, &res.body_len, &to_free);
+	} else {
+		res.body = git_blob_rawcontent(blob);
+		res.body_len = git_blob_rawsize(blob);
+	}
+	respond(c, req, &res);
+
+	free(to_free);
+	git_blob_free(blob);
+}
+
+// Handle a single request of `len` bytes at the start of the input buffer.
+static void handle_request(struct server *s, struct connection *c, size_t len) {
+	// Make the request a string, so we can use the usual string functions.
+	// There is always room for this since the request ends with "\r\n\r\n".
+	char *p = c->in;
+	p[len - 2] = '\0';
+
+	// Parse the request line: method SP target SP version CRLF.
+	char *eol = strstr(p, "\r\n");
+	*eol = '\0';
+	char *method = p;
+	char *target = strchr(method, ' ');
+	char *version = (target != NULL) ? strchr(target + 1, ' ') : NULL;
+	if (version == NULL) {
+		c->keep_alive = false;
+		respond_error(c, NULL, 400, "Bad Request");
+		return;
+	}
+	*target++ = '\0';
+	*version++ = '\0';
+
+	struct request req = {
+		.method = method,
+		.target = target,
+		.head = strcmp(method, "HEAD") == 0,
+	};
+	c->keep_alive = strcmp(version, "HTTP/1.1") == 0;
+
+	// Parse the headers we care about.
+	for (char *line = eol + 2; *line != '\0'; ) {
+		char *next = strstr(line, "\r\n");
+		if (next != NULL) {
+			*next = '\0';
+		}
+		if (strncasecmp(line, "If-None-Match:", 14) == 0) {
+			req.if_none_match = line + 14 + strspn(line + 14, " \t");
+		} else if (strncasecmp(line, "Accept-Encoding:", 16) == 0) {
+			// Good enough, as nobody sends "gzip;q=0".
+			req.accept_gzip = strstr(line + 16, "gzip") != NULL;
+		} else if (strncasecmp(line, "Connection:", 11) == 0) {
+			const char *value = line + 11 + strspn(line + 11, " \t");
+			if (strcasecmp(value, "close") == 0) {
+				c->keep_alive = false;
+			} else if (strcasecmp(value, "keep-alive") == 0) {
+				c->keep_alive = true;
+			}
+		} else if (strncasecmp(line, "Content-Length:", 15) == 0 || strncasecmp(line, "Transfer-Encoding:", 18) == 0) {
+			// We don't accept request bodies, so we can't tell where
+			// the next request would start.
+			c->keep_alive = false;
+		}
+		if (next == NULL) {
+			break;
+		}
+		line = next + 2;
+	}
+
+	if (strcmp(method, "GET") == 0 || req.head) {
+		handle_get(s, c, &req);
+	} else {
+		c->keep_alive = false;
+		respond_error(c, &req, 405, "Method Not Allowed");
+	}
+}
+
+// Returns the length of the first complete request in the input buffer, or
+// zero if there is none yet.
+static size_t complete_request(const struct connection *c) {
+	for (size_t i = 0; i + 4 <= c->in_len; ++i) {
+		if (memcmp(c->in + i, "\r\n\r\n", 4) == 0) {
+			return i + 4;
+		}
+	}
+	return 0;
+}
+
+// Handle buffered requests until one produces output.
+static void handle_input(struct server *s, struct connection *c) {
+	size_t len;
+	while (c->out == NULL && (len = complete_request(c)) > 0) {
+		handle_request(s, c, len);
+		memmove(c->in, c->in + len, c->in_len - len);
+		c->in_len -= len;
+	}
+}
+
+static void close_connection(struct server *s, size_t i) {
+	struct connection *c = s->connections[i];
+	close(c->fd);
+	free(c->out);
+	free(c);
+
+	// Move the last connection into the hole.
+	s->count -= 1;
+	s->fds[i] = s->fds[s->count];
+	s->connections[i] = s->connections[s->count];
+}
+
+static void accept_connections(struct server *s) {
+	while (true) {
+		int fd = accept(s->fds[0].fd, NULL, NULL);
+		if (fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+				perror("failed to accept connection");
+			}
+			return;
+		}
+		if (s->count == 1 + MAX_CONNECTIONS) {
+			close(fd);
+			continue;
+		}
+		set_nonblocking(fd);
+
+		struct connection *c = calloc(1, sizeof(*c));
+		if (c == NULL) {
+			die("failed to allocate connection");
+		}
+		c->fd = fd;
+		s->connections[s->count] = c;
+		s->fds[s->count] = (struct pollfd){ .fd = fd, .events = POLLIN };
+		s->count += 1;
+	}
+}
+
+// Send as much of the bundle-backed body as the socket will take.
+static ssize_t send_body(struct server *s, struct connection *c) {
+	size_t len = (c->body_remaining > SSIZE_MAX) ? SSIZE_MAX : (size_t)c->body_remaining;
+#ifdef __linux__
+	// Let the kernel copy straight from the page cache.
+	off_t offset = (off_t)c->body_offset;
+	ssize_t n = sendfile(c->fd, bundle_reader_fd(s->bundle), &offset, len);
+#else
+	struct bundle_entry entry = { .offset = c->body_offset };
+	ssize_t n = write(c->fd, bundle_reader_data(s->bundle, &entry), len);
+#endif
+	if (n > 0) {
+		c->body_offset += n;
+		c->body_remaining -= n;
+	}
+	return n;
+}
+
+// Service connection `i`. Returns false if the connection should be closed.
+static bool service_connection(struct server *s, size_t i) {
+	struct connection *c = s->connections[i];
+	short revents = s->fds[i].revents;
+
+	if (revents & POLLIN) {
+		ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+		if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+			return false;
+		}
+		if (n > 0) {
+			c->in_len += n;
+		}
+		handle_input(s, c);
+		if (c->out == NULL && c->in_len == sizeof(c->in)) {
+			c->keep_alive = false;
+			respond_error(c, NULL, 431, "Request Header Fields Too Large");
+		}
+	} else if (revents & (POLLERR | POLLHUP | POLLNVAL)) {
+		return false;
+	}
+
+	while (c->out != NULL) {
+		ssize_t n;
+		if (c->out_sent < c->out_len) {
+			n = write(c->fd, c->out + c->out_sent, c->out_len - c->out_sent);
+			if (n > 0) {
+				c->out_sent += n;
+			}
+		} else {
+			n = send_body(s, c);
+		}
+		if (n < 0) {
+			if (errno == EAGAIN || errno == EINTR) {
+				break;
+			}
+			return false;
+		}
+		if (c->out_sent < c->out_len || c->body_remaining > 0) {
+			continue;
+		}
+
+		// Response complete. Move on to the next pipelined request.
+		free(c->out);
+		c->out = NULL;
+		if (!c->keep_alive) {
+			return false;
+		}
+		handle_input(s, c);
+	}
+
+	// Only wait for writability while there is something to write, and
+	// don't read more requests until the current response is out.
+	s->fds[i].events = (c->out != NULL) ? POLLOUT : POLLIN;
+	return true;
+}
+
+static noreturn void run(struct server *s);
+
+noreturn void serve(struct git_repository *repo, const struct serve_options *options) {
+	static struct server s;
+	s.repo = repo;
+	s.options = options;
+	if (options->cache_file != NULL) {
+		s.pages = page_cache_open(options->cache_file, options->cache_size, render_tag(&s));
+	} else {
+		s.cache = lru_create(options->cache_size);
+	}
+	run(&s);
+}
+
+noreturn void serve_bundle(struct bundle_reader *bundle, const struct serve_options *options) {
+	static struct server s;
+	s.bundle = bundle;
+	s.options = options;
+	run(&s);
+}
+
+static noreturn void run(struct server *s) {
+	const struct serve_options *options = s->options;
+
+	// Writing to a connection the client closed should fail, not kill us.
+	signal(SIGPIPE, SIG_IGN);
+
+	s->fds[0] = (struct pollfd){ .fd = listen_on(options->address, options->port), .events = POLLIN };
+	s->count = 1;
+
+	printf("Listening on %s port %s\n", options->address, options->port);
+	fflush(stdout);
+
+	// The other workers accept connections on the same socket, whichever
+	// gets there first. They share the page cache only if it is in a file.
+	for (unsigned i = 1; i < options->workers; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			die_errno("failed to start worker");
+		}
+		if (pid == 0) {
+			break;
+		}
+	}
+
+	while (true) {
+		if (poll(s->fds, s->count, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			die_errno("failed to poll");
+		}
+
+		// Iterate backwards, since closing moves the last connection into
+		// the current slot.
+		for (size_t i = s->count - 1; i > 0; --i) {
+			if (s->fds[i].revents != 0 && !service_connection(s, i)) {
+				close_connection(s, i);
+			}
+		}
+		if (s->fds[0].revents & POLLIN) {
+			accept_connections(s);
+		}
+		fflush(stdout);
+	}
+}
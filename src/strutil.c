@@ -20,7 +20,7 @@ int vaprintf(struct arena *a, char **out, const char *fmt, va_list args) {
 	// Calculate size.
 	va_list tmp;
 	va_copy(tmp, args);
-	int size = vsnprintf(NULL, 0, fmt, args);
+	int size = vsnprintf(NULL, 0, fmt, tmp);
 	va_end(tmp);
 
 	// If e.g. the format string was broken, we cannot continue.
@@ -0,0 +1,131 @@
+#include "treediff.h"
+
+#include "die.h"        // die*
+#include <stdbool.h>    // bool
+#include <stdlib.h>     // malloc, free
+#include <string.h>     // memcpy, strlen
+
+struct tree_diff {
+	git_repository *repo;
+	tree_change_fn *changed;
+	void *arg;
+};
+
+// Returns `prefix/name`, or `name` if there is no prefix.
+static char *join(const char *prefix, const char *name) {
+	size_t prefix_len = (prefix == NULL) ? 0 : strlen(prefix), name_len = strlen(name);
+	char *path = malloc(prefix_len + 1 + name_len + 1);
+	if (path == NULL) {
+		die("failed to allocate path");
+	}
+	if (prefix != NULL) {
+		memcpy(path, prefix, prefix_len);
+		path[prefix_len++] = '/';
+	}
+	memcpy(path + prefix_len, name, name_len + 1);
+	return path;
+}
+
+// Compare entries the way git orders them, which is by name except that the
+// names of trees are taken to end in '/'.
+static int compare_entries(const git_tree_entry *a, const git_tree_entry *b) {
+	const unsigned char *x = (const unsigned char *)git_tree_entry_name(a);
+	const unsigned char *y = (const unsigned char *)git_tree_entry_name(b);
+	while (*x != '\0' && *x == *y) {
+		x++;
+		y++;
+	}
+	int cx = (*x != '\0') ? *x : (git_tree_entry_type(a) == GIT_OBJECT_TREE) ? '/' : 0;
+	int cy = (*y != '\0') ? *y : (git_tree_entry_type(b) == GIT_OBJECT_TREE) ? '/' : 0;
+	return cx - cy;
+}
+
+static git_tree *lookup_tree(const struct tree_diff *d, const git_tree_entry *entry) {
+	git_tree *tree;
+	if (git_tree_lookup(&tree, d->repo, git_tree_entry_id(entry)) < 0) {
+		die_git("read tree %s", git_oid_tostr_s(git_tree_entry_id(entry)));
+	}
+	return tree;
+}
+
+static void diff_trees(const struct tree_diff *d, const char *prefix, const git_tree *old_tree, const git_tree *new_tree);
+
+// Report `entry` as added (if `added` is true) or deleted.
+static void diff_entry(const struct tree_diff *d, const char *prefix, const git_tree_entry *entry, bool added) {
+	char *path = join(prefix, git_tree_entry_name(entry));
+	switch (git_tree_entry_type(entry)) {
+		case GIT_OBJECT_BLOB: {
+			const git_oid *id = git_tree_entry_id(entry);
+			d->changed(path, added ? NULL : id, added ? id : NULL, d->arg);
+		} break;
+		case GIT_OBJECT_TREE: {
+			git_tree *tree = lookup_tree(d, entry);
+			diff_trees(d, path, added ? NULL : tree, added ? tree : NULL);
+			git_tree_free(tree);
+		} break;
+		default: {
+			// Ignore submodules, as the rest of simplewiki does.
+		} break;
+	}
+	free(path);
+}
+
+// Report the differences between two trees, either of which may be NULL.
+// Since both are sorted, they are compared in a single pass.
+static void diff_trees(const struct tree_diff *d, const char *prefix, const git_tree *old_tree, const git_tree *new_tree) {
+	size_t old_count = (old_tree == NULL) ? 0 : git_tree_entrycount(old_tree);
+	size_t new_count = (new_tree == NULL) ? 0 : git_tree_entrycount(new_tree);
+	size_t i = 0, j = 0;
+	while (i < old_count || j < new_count) {
+		const git_tree_entry *old = (i < old_count) ? git_tree_entry_byindex(old_tree, i) : NULL;
+		const git_tree_entry *new = (j < new_count) ? git_tree_entry_byindex(new_tree, j) : NULL;
+		int cmp = (old == NULL) ? 1 : (new == NULL) ? -1 : compare_entries(old, new);
+		if (cmp < 0) {
+			diff_entry(d, prefix, old, false);
+			i += 1;
+			continue;
+		}
+		if (cmp > 0) {
+			diff_entry(d, prefix, new, true);
+			j += 1;
+			continue;
+		}
+
+		// Unchanged entries, and with them whole subtrees, are skipped.
+		if (!git_oid_equal(git_tree_entry_id(old), git_tree_entry_id(new))) {
+			git_object_t type = git_tree_entry_type(new);
+			char *path = join(prefix, git_tree_entry_name(new));
+			if (type == GIT_OBJECT_TREE) {
+				git_tree *old_subtree = lookup_tree(d, old);
+				git_tree *new_subtree = lookup_tree(d, new);
+				diff_trees(d, path, old_subtree, new_subtree);
+				git_tree_free(old_subtree);
+				git_tree_free(new_subtree);
+			} else if (type == GIT_OBJECT_BLOB && git_tree_entry_type(old) == GIT_OBJECT_BLOB) {
+				d->changed(path, git_tree_entry_id(old), git_tree_entry_id(new), d->arg);
+			}
+			free(path);
+		}
+		i += 1;
+		j += 1;
+	}
+}
+
+void diff_commit(git_repository *repo, git_commit *commit, tree_change_fn *changed, void *arg) {
+	struct tree_diff d = { .repo = repo, .changed = changed, .arg = arg };
+
+	git_tree *tree, *parent_tree = NULL;
+	if (git_commit_tree(&tree, commit) < 0) {
+		die_git("get tree for commit %s", git_oid_tostr_s(git_commit_id(commit)));
+	}
+	if (git_commit_parentcount(commit) > 0) {
+		git_commit *parent;
+		if (git_commit_parent(&parent, commit, 0) < 0 || git_commit_tree(&parent_tree, parent) < 0) {
+			die_git("get tree for parent of %s", git_oid_tostr_s(git_commit_id(commit)));
+		}
+		git_commit_free(parent);
+	}
+	diff_trees(&d, NULL, parent_tree, tree);
+	git_tree_free(parent_tree);
+	git_tree_free(tree);
+}